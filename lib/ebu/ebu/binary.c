@@ -675,6 +675,7 @@ end_position={%d,%d})",
 	    context->size -= 32;
 	else
 	    context->size = 0;
+	context->location += 32;	/* where the data starts */
     } else {
 	if (zio_lseek(context->zio,
 	    ((off_t) book->subbook_current->sound.start_page - 1)
@@ -992,6 +993,82 @@ eb_read_binary(book, binary_max_length, binary, binary_length)
 }
 
 
+/*
+ * Move to `offset' bytes from the start of the current binary data, as
+ * eb_read_binary() outputs it, without reading the data before.  The
+ * WAVE header composed by eb_set_binary_wave() counts in `offset'.
+ * Monochrome and gray scale graphics, converted line by line from the
+ * bottom, cannot be seeked.
+ */
+EB_Error_Code
+eb_seek_binary(EB_Book *book, off_t offset)
+{
+    EB_Error_Code error_code;
+    EB_Binary_Context *context;
+    off_t data_offset;
+
+    eb_lock(&book->lock);
+    LOG(("in: eb_seek_binary(book=%d, offset=%ld)", (int)book->code,
+	(long)offset));
+
+    context = &book->binary_context;
+    if (offset < 0) {
+	error_code = EB_ERR_FAIL_SEEK_BINARY;
+	goto failed;
+    }
+
+    switch (context->code) {
+    case EB_BINARY_COLOR_GRAPHIC:
+    case EB_BINARY_MPEG:
+	data_offset = offset;
+	break;
+    case EB_BINARY_WAVE:
+	/*
+	 * The header is kept in the cache buffer from the start.
+	 */
+	context->cache_length = 44;
+	if (offset < 44) {
+	    context->cache_offset = offset;
+	    data_offset = 0;
+	} else {
+	    context->cache_length = 0;
+	    context->cache_offset = 0;
+	    data_offset = offset - 44;
+	}
+	break;
+    case EB_BINARY_MONO_GRAPHIC:
+    case EB_BINARY_GRAY_GRAPHIC:
+	error_code = EB_ERR_FAIL_SEEK_BINARY;
+	goto failed;
+    default:
+	error_code = EB_ERR_NO_CUR_BINARY;
+	goto failed;
+    }
+
+    if (0 < context->size && context->size < data_offset)
+	data_offset = context->size;
+    if (zio_lseek(context->zio, context->location + data_offset, SEEK_SET)
+	< 0) {
+	error_code = EB_ERR_FAIL_SEEK_BINARY;
+	goto failed;
+    }
+    context->offset = data_offset;
+
+    LOG(("out: eb_seek_binary() = %s", eb_error_string(EB_SUCCESS)));
+    eb_unlock(&book->lock);
+
+    return EB_SUCCESS;
+
+    /*
+     * An error occurs...
+     */
+  failed:
+    LOG(("out: eb_seek_binary() = %s", eb_error_string(error_code)));
+    eb_unlock(&book->lock);
+    return error_code;
+}
+
+
 /*
  * Read generic binary data.
  * This function is used for reading JPEG or BMP picture, and data part
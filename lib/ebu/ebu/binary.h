@@ -56,6 +56,7 @@ EB_Error_Code eb_set_binary_color_graphic(EB_Book *book,
 EB_Error_Code eb_set_binary_mpeg(EB_Book *book, const unsigned int *argv);
 EB_Error_Code eb_read_binary(EB_Book *book, size_t binary_max_length,
     char *binary, ssize_t *binary_length);
+EB_Error_Code eb_seek_binary(EB_Book *book, off_t offset);
 void eb_unset_binary(EB_Book *book);
 
 /* filename.c */
@@ -38,10 +38,41 @@
 #include <zlib.h>
 #endif
 
+/*
+ * zlib compression level of PNG images.
+ */
+#ifndef PNG_COMPRESSION_LEVEL
+#define PNG_COMPRESSION_LEVEL	6
+#endif
+
+/*
+ * The compressor of PNG images, allocated by the first png_compress().
+ */
+#ifdef ENABLE_LIBDEFLATE
+static struct libdeflate_compressor *png_compressor = NULL;
+#else
+static z_stream png_z;
+static int png_z_initialized = 0;
+#endif
+
+/*
+ * Filtered lines of the image being compressed, grown as needed.
+ */
+static unsigned char *png_lines = NULL;
+static size_t png_lines_size = 0;
+
+/*
+ * Mutex for the compressor and `png_lines'.
+ */
+#ifdef ENABLE_PTHREAD
+static pthread_mutex_t png_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 /*
  * Unexported functions.
  */
 static unsigned long png_crc(const char *buf, size_t len);
+static size_t png_filter(const char *src, int width, int height);
 static int png_compress(const char *src, int width, int height, char *dest,
     size_t *dest_len);
 
@@ -1129,102 +1160,109 @@ png_crc(const char *buf, size_t len)
 }
 
 
-static int
-png_compress(const char *src, int width, int height, char *dest,
-    size_t *dest_len)
+/*
+ * Filter the lines of a bitmap for PNG into `png_lines', a filter type
+ * byte before each line.  All the lines take filter type none: with one
+ * bit per pixel, a byte holds 8 pixels and differences between bytes
+ * (sub, up, ...) do not predict them.  Choosing the filter of each line
+ * by the smallest sum of absolute differences, as for 8 bit images,
+ * made glyphs and graphics 2 to 4% larger.
+ */
+static size_t
+png_filter(const char *src, int width, int height)
 {
-#ifdef ENABLE_LIBDEFLATE
-    int line_size = (width  + 7) / 8;
-    char *in_buffer;
-    struct libdeflate_compressor *compressor;
+    int line_size = (width + 7) / 8;
+    size_t size = (size_t)(line_size + 1) * height;
+    unsigned char *out;
     int i;
-    size_t in_buffer_size = (line_size + 1) * height;
-    size_t result;
-
-    in_buffer = malloc (in_buffer_size);
-    if (in_buffer == NULL) goto failed;
-    compressor = libdeflate_alloc_compressor(1);
-    if (compressor == NULL) goto failed;
 
-    for (i = 0; i < height; i++) {
-	*(in_buffer + (line_size + 1) * i) = 0;
-	memcpy(in_buffer + (line_size + 1) * i + 1, src + line_size * i, line_size);
+    if (png_lines_size < size) {
+	free(png_lines);
+	png_lines = malloc(size);
+	if (png_lines == NULL) {
+	    png_lines_size = 0;
+	    return 0;
+	}
+	png_lines_size = size;
     }
 
-    result = libdeflate_zlib_compress(compressor, in_buffer, in_buffer_size,
-				      dest, (line_size + 1) * height + 12 + 256);
-    if (result == 0) goto failed;
-
-    *dest_len = result;
+    for (i = 0, out = png_lines; i < height; i++, out += line_size + 1) {
+	*out = 0;
+	memcpy(out + 1, src + (size_t)line_size * i, line_size);
+    }
 
-    free(in_buffer);
-    libdeflate_free_compressor(compressor);
-    return 0;
+    return size;
+}
 
-  failed:
-    if (in_buffer) free(in_buffer);
-    if (compressor) libdeflate_free_compressor(compressor);
-    return -1;
-#else
+/*
+ * Compress a bitmap into the zlib stream of a PNG IDAT chunk.
+ * The compressor is allocated once and reused.
+ */
+static int
+png_compress(const char *src, int width, int height, char *dest,
+    size_t *dest_len)
+{
     int line_size = (width  + 7) / 8;
-    z_stream z;
+    size_t in_size;
+#ifdef ENABLE_LIBDEFLATE
+    size_t result;
+#else
     int z_result;
-    unsigned char byte_zero = 0x00;
-    int i;
+#endif
 
-    z.zalloc = Z_NULL;
-    z.zfree = Z_NULL;
-    z.opaque = Z_NULL;
-    z_result = deflateInit(&z, Z_NO_COMPRESSION);
-    if (z_result != Z_OK)
-	return -1;
+    pthread_mutex_lock(&png_mutex);
 
-    /*
-     * Exactly to say, `z.avail_out' must be:
-     *     avail_out > (sizeof(src) + 12) * 1.001
-     * but we use an approximation here.
-     */
-    z.next_out = (unsigned char *)dest;
-    z.avail_out = (line_size + 1) * height + 12 + 256;
-    for (i = 0; i < height - 1; i++) {
-	z.next_in = &byte_zero;
-	z.avail_in = 1;
-	z_result = deflate(&z, Z_NO_FLUSH);
-	if (z_result != Z_OK || z.avail_in != 0)
-	    goto failed;
+    in_size = png_filter(src, width, height);
+    if (in_size == 0)
+	goto failed;
 
-	z.next_in = (unsigned char *)src + (line_size * i);
-	z.avail_in = line_size;
-	z_result = deflate(&z, Z_NO_FLUSH);
-	if (z_result != Z_OK || z.avail_in != 0)
+#ifdef ENABLE_LIBDEFLATE
+    if (png_compressor == NULL) {
+	png_compressor = libdeflate_alloc_compressor(PNG_COMPRESSION_LEVEL);
+	if (png_compressor == NULL)
 	    goto failed;
     }
-
-    z.next_in = &byte_zero;
-    z.avail_in = 1;
-    z_result = deflate(&z, Z_NO_FLUSH);
-    if (z_result != Z_OK || z.avail_in != 0)
+    result = libdeflate_zlib_compress(png_compressor, png_lines, in_size,
+	dest, (line_size + 1) * height + 12 + 256);
+    if (result == 0)
 	goto failed;
-
-    z.next_in = (unsigned char *)src + (line_size * i);
-    z.avail_in = line_size;
-    if (deflate(&z, Z_FINISH) != Z_STREAM_END)
+    *dest_len = result;
+#else
+    if (!png_z_initialized) {
+	png_z.zalloc = Z_NULL;
+	png_z.zfree = Z_NULL;
+	png_z.opaque = Z_NULL;
+	if (deflateInit(&png_z, PNG_COMPRESSION_LEVEL) != Z_OK)
+	    goto failed;
+	png_z_initialized = 1;
+    } else if (deflateReset(&png_z) != Z_OK) {
 	goto failed;
+    }
 
-    z_result = deflateEnd(&z);
-    if (z_result != Z_OK)
-	return -1;
+    /*
+     * Exactly to say, `png_z.avail_out' must be deflateBound(), but
+     * deflate falls back to stored blocks, so we use the size of the
+     * uncompressed stream plus some.
+     */
+    png_z.next_in = png_lines;
+    png_z.avail_in = in_size;
+    png_z.next_out = (unsigned char *)dest;
+    png_z.avail_out = (line_size + 1) * height + 12 + 256;
+    z_result = deflate(&png_z, Z_FINISH);
+    if (z_result != Z_STREAM_END)
+	goto failed;
+    *dest_len = (png_z.next_out - (unsigned char *)dest);
+#endif
 
-    *dest_len = (z.next_out - (unsigned char *)dest);
+    pthread_mutex_unlock(&png_mutex);
     return 0;
 
     /*
      * An error occurs...
      */
   failed:
-    deflateEnd(&z);
+    pthread_mutex_unlock(&png_mutex);
     return -1;
-#endif
 }
 
 
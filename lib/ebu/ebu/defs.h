@@ -977,6 +977,14 @@ struct EB_Hit_Struct {
     EB_Position text;
 };
 
+/*
+ * Callback of eb_walk_words(), called for each word index entry.
+ * `word' is the word as stored in the index (not null terminated).
+ * Returning non-zero stops the walk.
+ */
+typedef int (*EB_Word_Walker)(void *data, const char *word,
+    size_t word_length, const EB_Hit *hit);
+
 /*
  * A text hook.
  */
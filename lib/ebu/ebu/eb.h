@@ -132,6 +132,7 @@ EB_Error_Code eb_text(EB_Book *book, EB_Position *position);
 /* search.c */
 EB_Error_Code eb_hit_list(EB_Book *book, int max_hit_count, EB_Hit *hit_list,
     int *hit_count);
+EB_Error_Code eb_walk_words(EB_Book *book, EB_Word_Walker walker, void *data);
 
 /* subbook.c */
 EB_Error_Code eb_load_all_subbooks(EB_Book *book);
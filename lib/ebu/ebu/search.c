@@ -41,10 +41,22 @@
 #define PAGE_ID_HAVE_GROUP_ENTRY(page_id)	(((page_id) & 0x10) == 0x10)
 
 /*
- * The maximum number of hit entries for tomporary hit lists.
- * This is used in eb_hit_list().
+ * The number of hit entries read from a search context at a time by
+ * eb_hit_list(), in keyword, cross and multi search.
  */
-#define EB_TMP_MAX_HITS		64
+#define EB_TMP_MAX_HITS		256
+
+/*
+ * The hit list of a search context in keyword, cross and multi search,
+ * read a batch at a time.  Hits are in text position order.
+ */
+typedef struct {
+    EB_Search_Context *context;
+    EB_Search_Context batch_context;	/* `context' before the batch */
+    EB_Hit hits[EB_TMP_MAX_HITS];
+    int hit_count;
+    int hit_index;			/* the current hit */
+} EB_Hit_Cursor;
 
 /*
  * Book-code of the book in which you want to search a word.
@@ -61,6 +73,31 @@ static char cache_buffer[EB_SIZE_PAGE];
  */
 static int cache_page;
 
+/*
+ * The number of index pages kept by eb_read_index_page().
+ * Words searched one after another in sorted order descend through the
+ * same intermediate pages and often end on the same leaf page.
+ */
+#define EB_INDEX_CACHE_PAGES	32
+
+/*
+ * Recently read index pages.
+ * `page' is 0 if the entry is empty.
+ */
+typedef struct {
+    int zio_id;
+    int page;
+    unsigned int last_used;
+    char buffer[EB_SIZE_PAGE];
+} EB_Index_Cache_Entry;
+
+static EB_Index_Cache_Entry index_cache[EB_INDEX_CACHE_PAGES];
+
+/*
+ * Counter to find the least recently used entry of `index_cache'.
+ */
+static unsigned int index_cache_clock = 0;
+
 /*
  * Mutex for cache variables.
  */
@@ -71,6 +108,8 @@ static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
 /*
  * Unexported functions.
  */
+static EB_Error_Code eb_read_index_page(EB_Book *book, int page,
+    char *buffer);
 static EB_Error_Code eb_hit_list_word(EB_Book *book,
     EB_Search_Context *context, int max_hit_count, EB_Hit *hit_list,
     int *hit_count);
@@ -80,10 +119,12 @@ static EB_Error_Code eb_hit_list_keyword(EB_Book *book,
 static EB_Error_Code eb_hit_list_multi(EB_Book *book,
     EB_Search_Context *context, int max_hit_count, EB_Hit *hit_list,
     int *hit_count);
-static void eb_and_hit_lists(EB_Hit and_list[EB_TMP_MAX_HITS],
-    int *and_count, int max_and_count, int hit_list_count,
-    EB_Hit hit_lists[EB_NUMBER_OF_SEARCH_CONTEXTS][EB_TMP_MAX_HITS],
-    int hit_counts[EB_NUMBER_OF_SEARCH_CONTEXTS]);
+static EB_Error_Code eb_fill_hit_cursor(EB_Book *book,
+    EB_Hit_Cursor *cursor);
+static EB_Error_Code eb_seek_hit_cursor(EB_Book *book,
+    EB_Hit_Cursor *cursor, const EB_Position *position);
+static EB_Error_Code eb_and_hit_lists(EB_Book *book, int max_hit_count,
+    EB_Hit *hit_list, int *hit_count);
 
 
 /*
@@ -268,6 +309,65 @@ eb_finalize_searches(EB_Book *book)
 }
 
 
+/*
+ * Read an index page of the current subbook into `buffer'.
+ * Pages are served from `index_cache' if possible.
+ * The caller must lock `cache_mutex'.
+ */
+static EB_Error_Code
+eb_read_index_page(EB_Book *book, int page, char *buffer)
+{
+    EB_Error_Code error_code;
+    EB_Index_Cache_Entry *entry;
+    EB_Index_Cache_Entry *victim;
+    int zio_id;
+    int i;
+
+    LOG(("in: eb_read_index_page(book=%d, page=%d)", (int)book->code, page));
+
+    zio_id = book->subbook_current->text_zio.id;
+    victim = index_cache;
+    for (i = 0, entry = index_cache; i < EB_INDEX_CACHE_PAGES;
+	 i++, entry++) {
+	if (entry->page == page && entry->zio_id == zio_id) {
+	    entry->last_used = ++index_cache_clock;
+	    memcpy(buffer, entry->buffer, EB_SIZE_PAGE);
+	    goto succeeded;
+	}
+	if (entry->page == 0
+	    || (victim->page != 0 && entry->last_used < victim->last_used))
+	    victim = entry;
+    }
+
+    if (zio_lseek(&book->subbook_current->text_zio,
+	((off_t) page - 1) * EB_SIZE_PAGE, SEEK_SET) < 0) {
+	error_code = EB_ERR_FAIL_SEEK_TEXT;
+	goto failed;
+    }
+    if (zio_read(&book->subbook_current->text_zio, buffer, EB_SIZE_PAGE)
+	!= EB_SIZE_PAGE) {
+	error_code = EB_ERR_FAIL_READ_TEXT;
+	goto failed;
+    }
+
+    victim->zio_id = zio_id;
+    victim->page = page;
+    victim->last_used = ++index_cache_clock;
+    memcpy(victim->buffer, buffer, EB_SIZE_PAGE);
+
+  succeeded:
+    LOG(("out: eb_read_index_page() = %s", eb_error_string(EB_SUCCESS)));
+    return EB_SUCCESS;
+
+    /*
+     * An error occurs...
+     */
+  failed:
+    LOG(("out: eb_read_index_page() = %s", eb_error_string(error_code)));
+    return error_code;
+}
+
+
 /*
  * Pre-search for a word described in the current search context.
  * It descends intermediate indexes and reached to a leaf page that
@@ -300,16 +400,9 @@ eb_presearch_word(EB_Book *book, EB_Search_Context *context)
 	/*
 	 * Seek and read a page.
 	 */
-	if (zio_lseek(&book->subbook_current->text_zio,
-	    ((off_t) context->page - 1) * EB_SIZE_PAGE, SEEK_SET) < 0) {
-	    cache_book_code = EB_BOOK_NONE;
-	    error_code = EB_ERR_FAIL_SEEK_TEXT;
-	    goto failed;
-	}
-	if (zio_read(&book->subbook_current->text_zio, cache_buffer,
-	    EB_SIZE_PAGE) != EB_SIZE_PAGE) {
+	error_code = eb_read_index_page(book, context->page, cache_buffer);
+	if (error_code != EB_SUCCESS) {
 	    cache_book_code = EB_BOOK_NONE;
-	    error_code = EB_ERR_FAIL_READ_TEXT;
 	    goto failed;
 	}
 
@@ -401,11 +494,6 @@ EB_Error_Code
 eb_hit_list(EB_Book *book, int max_hit_count, EB_Hit *hit_list, int *hit_count)
 {
     EB_Error_Code error_code;
-    EB_Search_Context temporary_context;
-    EB_Hit temporary_hit_lists[EB_NUMBER_OF_SEARCH_CONTEXTS][EB_TMP_MAX_HITS];
-    int temporary_hit_counts[EB_NUMBER_OF_SEARCH_CONTEXTS];
-    int more_hit_count;
-    int i;
 
     /*
      * Lock cache data and the book.
@@ -446,95 +534,14 @@ eb_hit_list(EB_Book *book, int max_hit_count, EB_Hit *hit_list, int *hit_count)
 
     case EB_SEARCH_KEYWORD:
     case EB_SEARCH_CROSS:
-	/*
-	 * In case of keyword or cross search.
-	 */
-	for (;;) {
-	    int search_is_over = 0;
-
-	    for (i = 0; i < EB_MAX_KEYWORDS; i++) {
-		if (book->search_contexts[i].code != EB_SEARCH_KEYWORD
-		    && book->search_contexts[i].code != EB_SEARCH_CROSS)
-		    break;
-		memcpy(&temporary_context, book->search_contexts + i,
-		    sizeof(EB_Search_Context));
-		error_code = eb_hit_list_keyword(book, &temporary_context,
-		    EB_TMP_MAX_HITS, temporary_hit_lists[i],
-		    temporary_hit_counts + i);
-		if (error_code != EB_SUCCESS)
-		    goto failed;
-		if (temporary_hit_counts[i] == 0) {
-		    search_is_over = 1;
-		    break;
-		}
-	    }
-	    if (search_is_over)
-		break;
-
-	    eb_and_hit_lists(hit_list + *hit_count, &more_hit_count,
-		max_hit_count - *hit_count, i, temporary_hit_lists,
-		temporary_hit_counts);
-
-	    for (i = 0; i < EB_MAX_MULTI_ENTRIES; i++) {
-		if (book->search_contexts[i].code != EB_SEARCH_KEYWORD
-		    && book->search_contexts[i].code != EB_SEARCH_CROSS)
-		    break;
-		error_code = eb_hit_list_keyword(book,
-		    book->search_contexts + i, temporary_hit_counts[i],
-		    temporary_hit_lists[i], temporary_hit_counts + i);
-		if (error_code != EB_SUCCESS)
-		    goto failed;
-	    }
-
-	    *hit_count += more_hit_count;
-	    if (max_hit_count <= *hit_count)
-		break;
-	}
-	break;
-
     case EB_SEARCH_MULTI:
 	/*
-	 * In case of multi search.
+	 * In case of keyword, cross or multi search.
 	 */
-	for (;;) {
-	    int search_is_over = 0;
-
-	    for (i = 0; i < EB_MAX_MULTI_ENTRIES; i++) {
-		if (book->search_contexts[i].code != EB_SEARCH_MULTI)
-		    break;
-		memcpy(&temporary_context, book->search_contexts + i,
-		    sizeof(EB_Search_Context));
-		error_code = eb_hit_list_multi(book, &temporary_context,
-		    EB_TMP_MAX_HITS, temporary_hit_lists[i],
-		    temporary_hit_counts + i);
-		if (error_code != EB_SUCCESS)
-		    goto failed;
-		if (temporary_hit_counts[i] == 0) {
-		    search_is_over = 1;
-		    break;
-		}
-	    }
-	    if (search_is_over)
-		break;
-
-	    eb_and_hit_lists(hit_list + *hit_count, &more_hit_count,
-		max_hit_count - *hit_count, i, temporary_hit_lists,
-		temporary_hit_counts);
-
-	    for (i = 0; i < EB_MAX_MULTI_ENTRIES; i++) {
-		if (book->search_contexts[i].code != EB_SEARCH_MULTI)
-		    break;
-		error_code = eb_hit_list_multi(book,
-		    book->search_contexts + i, temporary_hit_counts[i],
-		    temporary_hit_lists[i], temporary_hit_counts + i);
-		if (error_code != EB_SUCCESS)
-		    goto failed;
-	    }
-
-	    *hit_count += more_hit_count;
-	    if (max_hit_count <= *hit_count)
-		break;
-	}
+	error_code = eb_and_hit_lists(book, max_hit_count, hit_list,
+	    hit_count);
+	if (error_code != EB_SUCCESS)
+	    goto failed;
 	break;
 
     default:
@@ -604,16 +611,10 @@ eb_hit_list_word(EB_Book *book, EB_Search_Context *context, int max_hit_count,
 	 * must not update the context!
 	 */
 	if (cache_book_code != book->code || cache_page != context->page) {
-	    if (zio_lseek(&book->subbook_current->text_zio,
-		((off_t) context->page - 1) * EB_SIZE_PAGE, SEEK_SET) < 0) {
-		error_code = EB_ERR_FAIL_SEEK_TEXT;
-		goto failed;
-	    }
-	    if (zio_read(&book->subbook_current->text_zio,
-		cache_buffer, EB_SIZE_PAGE) != EB_SIZE_PAGE) {
-		error_code = EB_ERR_FAIL_READ_TEXT;
+	    error_code = eb_read_index_page(book, context->page,
+		cache_buffer);
+	    if (error_code != EB_SUCCESS)
 		goto failed;
-	    }
 
 	    /*
 	     * Update search context.
@@ -876,6 +877,258 @@ entry_length=%d, entry_arrangement=%d, entry_count=%d)",
 }
 
 
+/*
+ * Call `walker' for every entry of the word index starting at `page'.
+ * It descends to the first leaf page, and reads the leaf layer through
+ * to its end.  `*stopped' is set if `walker' stops the walk.
+ */
+static EB_Error_Code
+eb_walk_word_index(EB_Book *book, int page, EB_Word_Walker walker,
+    void *data, int *stopped)
+{
+    EB_Error_Code error_code;
+    char buffer[EB_SIZE_PAGE];
+    char *buffer_p;
+    char *group_word = NULL;
+    size_t group_word_length = 0;
+    EB_Hit hit;
+    int page_id;
+    int entry_length;
+    int entry_count;
+    int index_depth;
+    int group_id;
+    int i;
+
+    LOG(("in: eb_walk_word_index(book=%d, page=%d)", (int)book->code, page));
+
+    /*
+     * The pages are read directly, not to flush `index_cache'.
+     */
+    for (index_depth = 0; ; index_depth++) {
+	if (EB_MAX_INDEX_DEPTH <= index_depth) {
+	    error_code = EB_ERR_UNEXP_TEXT;
+	    goto failed;
+	}
+	if (zio_lseek(&book->subbook_current->text_zio,
+	    ((off_t) page - 1) * EB_SIZE_PAGE, SEEK_SET) < 0) {
+	    error_code = EB_ERR_FAIL_SEEK_TEXT;
+	    goto failed;
+	}
+	if (zio_read(&book->subbook_current->text_zio, buffer, EB_SIZE_PAGE)
+	    != EB_SIZE_PAGE) {
+	    error_code = EB_ERR_FAIL_READ_TEXT;
+	    goto failed;
+	}
+	page_id = eb_uint1(buffer);
+	entry_length = eb_uint1(buffer + 1);
+	entry_count = eb_uint2(buffer + 2);
+	if (PAGE_ID_IS_LEAF_LAYER(page_id))
+	    break;
+
+	/*
+	 * Descend to the first page of the next level.
+	 */
+	if (entry_count == 0 || EB_SIZE_PAGE < 4 + entry_length + 4) {
+	    error_code = EB_ERR_UNEXP_TEXT;
+	    goto failed;
+	}
+	page = eb_uint4(buffer + 4 + entry_length);
+    }
+
+    for (;;) {
+	buffer_p = buffer + 4;
+
+	if (!PAGE_ID_HAVE_GROUP_ENTRY(page_id) && entry_length != 0) {
+	    for (i = 0; i < entry_count; i++) {
+		if (buffer + EB_SIZE_PAGE < buffer_p + entry_length + 12) {
+		    error_code = EB_ERR_UNEXP_TEXT;
+		    goto failed;
+		}
+		hit.text.page = eb_uint4(buffer_p + entry_length);
+		hit.text.offset = eb_uint2(buffer_p + entry_length + 4);
+		hit.heading.page = eb_uint4(buffer_p + entry_length + 6);
+		hit.heading.offset = eb_uint2(buffer_p + entry_length + 10);
+		if (walker(data, buffer_p, strnlen(buffer_p, entry_length),
+		    &hit) != 0)
+		    goto stopped;
+		buffer_p += entry_length + 12;
+	    }
+
+	} else if (!PAGE_ID_HAVE_GROUP_ENTRY(page_id)) {
+	    for (i = 0; i < entry_count; i++) {
+		if (buffer + EB_SIZE_PAGE < buffer_p + 1) {
+		    error_code = EB_ERR_UNEXP_TEXT;
+		    goto failed;
+		}
+		entry_length = eb_uint1(buffer_p);
+		if (buffer + EB_SIZE_PAGE < buffer_p + entry_length + 13) {
+		    error_code = EB_ERR_UNEXP_TEXT;
+		    goto failed;
+		}
+		hit.text.page = eb_uint4(buffer_p + entry_length + 1);
+		hit.text.offset = eb_uint2(buffer_p + entry_length + 5);
+		hit.heading.page = eb_uint4(buffer_p + entry_length + 7);
+		hit.heading.offset = eb_uint2(buffer_p + entry_length + 11);
+		if (walker(data, buffer_p + 1,
+		    strnlen(buffer_p + 1, entry_length), &hit) != 0)
+		    goto stopped;
+		buffer_p += entry_length + 13;
+	    }
+	    entry_length = 0;
+
+	} else {
+	    for (i = 0; i < entry_count; i++) {
+		if (buffer + EB_SIZE_PAGE < buffer_p + 2) {
+		    error_code = EB_ERR_UNEXP_TEXT;
+		    goto failed;
+		}
+		group_id = eb_uint1(buffer_p);
+		entry_length = eb_uint1(buffer_p + 1);
+
+		if (group_id == 0x00 || group_id == 0xc0) {
+		    /*
+		     * 0x00 -- Single entry, 0xc0 -- Element of a group entry.
+		     */
+		    if (buffer + EB_SIZE_PAGE < buffer_p + entry_length + 14) {
+			error_code = EB_ERR_UNEXP_TEXT;
+			goto failed;
+		    }
+		    hit.text.page = eb_uint4(buffer_p + entry_length + 2);
+		    hit.text.offset = eb_uint2(buffer_p + entry_length + 6);
+		    hit.heading.page = eb_uint4(buffer_p + entry_length + 8);
+		    hit.heading.offset = eb_uint2(buffer_p + entry_length + 12);
+		    if (group_id == 0xc0 && group_word != NULL
+			&& entry_length == 0) {
+			/*
+			 * An element without its own word has the group word.
+			 */
+			if (walker(data, group_word, group_word_length,
+			    &hit) != 0)
+			    goto stopped;
+		    } else if (walker(data, buffer_p + 2,
+			strnlen(buffer_p + 2, entry_length), &hit) != 0) {
+			goto stopped;
+		    }
+		    if (group_id == 0x00)
+			group_word = NULL;
+		    buffer_p += entry_length + 14;
+
+		} else if (group_id == 0x80) {
+		    /*
+		     * 0x80 -- Start of group entry.
+		     */
+		    if (buffer + EB_SIZE_PAGE < buffer_p + entry_length + 4) {
+			error_code = EB_ERR_UNEXP_TEXT;
+			goto failed;
+		    }
+		    group_word = buffer_p + 4;
+		    group_word_length = strnlen(group_word, entry_length);
+		    buffer_p += entry_length + 4;
+
+		} else {
+		    error_code = EB_ERR_UNEXP_TEXT;
+		    goto failed;
+		}
+	    }
+	    /*
+	     * The group word lives in `buffer', which is about to be reused.
+	     */
+	    group_word = NULL;
+	}
+
+	if (PAGE_ID_IS_LAYER_END(page_id))
+	    break;
+
+	page++;
+	if (zio_lseek(&book->subbook_current->text_zio,
+	    ((off_t) page - 1) * EB_SIZE_PAGE, SEEK_SET) < 0) {
+	    error_code = EB_ERR_FAIL_SEEK_TEXT;
+	    goto failed;
+	}
+	if (zio_read(&book->subbook_current->text_zio, buffer, EB_SIZE_PAGE)
+	    != EB_SIZE_PAGE) {
+	    error_code = EB_ERR_FAIL_READ_TEXT;
+	    goto failed;
+	}
+	page_id = eb_uint1(buffer);
+	entry_length = eb_uint1(buffer + 1);
+	entry_count = eb_uint2(buffer + 2);
+	if (!PAGE_ID_IS_LEAF_LAYER(page_id)) {
+	    error_code = EB_ERR_UNEXP_TEXT;
+	    goto failed;
+	}
+    }
+
+    LOG(("out: eb_walk_word_index() = %s", eb_error_string(EB_SUCCESS)));
+    return EB_SUCCESS;
+
+  stopped:
+    *stopped = 1;
+    LOG(("out: eb_walk_word_index() = %s", eb_error_string(EB_SUCCESS)));
+    return EB_SUCCESS;
+
+    /*
+     * An error occurs...
+     */
+  failed:
+    LOG(("out: eb_walk_word_index() = %s", eb_error_string(error_code)));
+    return error_code;
+}
+
+
+/*
+ * Call `walker' for every entry of the word indexes (as-is, alphabet
+ * and kana) of the current subbook, in index order.
+ * The same entry may be reported from more than one index.
+ */
+EB_Error_Code
+eb_walk_words(EB_Book *book, EB_Word_Walker walker, void *data)
+{
+    EB_Error_Code error_code;
+    EB_Subbook *subbook;
+    int pages[3];
+    int stopped = 0;
+    int i;
+
+    eb_lock(&book->lock);
+    LOG(("in: eb_walk_words(book=%d)", (int)book->code));
+
+    subbook = book->subbook_current;
+    if (subbook == NULL) {
+	error_code = EB_ERR_NO_CUR_SUB;
+	goto failed;
+    }
+    pages[0] = subbook->word_asis.start_page;
+    pages[1] = subbook->word_alphabet.start_page;
+    pages[2] = subbook->word_kana.start_page;
+    if (pages[0] == 0 && pages[1] == 0 && pages[2] == 0) {
+	error_code = EB_ERR_NO_SUCH_SEARCH;
+	goto failed;
+    }
+
+    for (i = 0; i < 3 && !stopped; i++) {
+	if (pages[i] == 0)
+	    continue;
+	error_code = eb_walk_word_index(book, pages[i], walker, data,
+	    &stopped);
+	if (error_code != EB_SUCCESS)
+	    goto failed;
+    }
+
+    LOG(("out: eb_walk_words() = %s", eb_error_string(EB_SUCCESS)));
+    eb_unlock(&book->lock);
+    return EB_SUCCESS;
+
+    /*
+     * An error occurs...
+     */
+  failed:
+    LOG(("out: eb_walk_words() = %s", eb_error_string(error_code)));
+    eb_unlock(&book->lock);
+    return error_code;
+}
+
+
 /*
  * Get hit entries of a submitted keyword search request.
  */
@@ -930,16 +1183,10 @@ eb_hit_list_keyword(EB_Book *book, EB_Search_Context *context,
 	 * must not update the context!
 	 */
 	if (cache_book_code != book->code || cache_page != context->page) {
-	    if (zio_lseek(&book->subbook_current->text_zio,
-		((off_t) context->page - 1) * EB_SIZE_PAGE, SEEK_SET) < 0) {
-		error_code = EB_ERR_FAIL_SEEK_TEXT;
-		goto failed;
-	    }
-	    if (zio_read(&book->subbook_current->text_zio, cache_buffer,
-		EB_SIZE_PAGE) != EB_SIZE_PAGE) {
-		error_code = EB_ERR_FAIL_READ_TEXT;
+	    error_code = eb_read_index_page(book, context->page,
+		cache_buffer);
+	    if (error_code != EB_SUCCESS)
 		goto failed;
-	    }
 
 	    /*
 	     * Update search context.
@@ -1262,16 +1509,10 @@ eb_hit_list_multi(EB_Book *book, EB_Search_Context *context, int max_hit_count,
 	 * must not update the context!
 	 */
 	if (cache_book_code != book->code || cache_page != context->page) {
-	    if (zio_lseek(&book->subbook_current->text_zio,
-		((off_t) context->page - 1) * EB_SIZE_PAGE, SEEK_SET) < 0) {
-		error_code = EB_ERR_FAIL_SEEK_TEXT;
-		goto failed;
-	    }
-	    if (zio_read(&book->subbook_current->text_zio, cache_buffer,
-		EB_SIZE_PAGE) != EB_SIZE_PAGE) {
-		error_code = EB_ERR_FAIL_READ_TEXT;
+	    error_code = eb_read_index_page(book, context->page,
+		cache_buffer);
+	    if (error_code != EB_SUCCESS)
 		goto failed;
-	    }
 
 	    /*
 	     * Update search context.
@@ -1527,130 +1768,194 @@ entry_length=%d, entry_arrangement=%d, entry_count=%d)",
 
 
 /*
- * Do AND operation of hit lists.
- * and_list = hit_lists[0] AND hit_lists[1] AND ...
+ * Read the next batch of hits of `cursor->context'.
+ * `cursor->hit_count' is 0 if all the hits have been read.
  */
-static void
-eb_and_hit_lists(EB_Hit and_list[EB_TMP_MAX_HITS], int *and_count,
-    int max_and_count, int hit_list_count,
-    EB_Hit hit_lists[EB_NUMBER_OF_SEARCH_CONTEXTS][EB_TMP_MAX_HITS],
-    int hit_counts[EB_NUMBER_OF_SEARCH_CONTEXTS])
+static EB_Error_Code
+eb_fill_hit_cursor(EB_Book *book, EB_Hit_Cursor *cursor)
 {
-    int hit_indexes[EB_NUMBER_OF_SEARCH_CONTEXTS];
-    int greatest_list;
-    int greatest_page;
-    int greatest_offset;
-    int current_page;
-    int current_offset;
-    int equal_count;
-    int increment_count;
-    int i;
+    EB_Error_Code error_code;
 
-    LOG(("in: eb_and_hit_lists(max_and_count=%d, hit_list_count=%d)",
-	max_and_count, hit_list_count));
+    memcpy(&cursor->batch_context, cursor->context,
+	sizeof(EB_Search_Context));
+    if (cursor->context->code == EB_SEARCH_MULTI) {
+	error_code = eb_hit_list_multi(book, cursor->context,
+	    EB_TMP_MAX_HITS, cursor->hits, &cursor->hit_count);
+    } else {
+	error_code = eb_hit_list_keyword(book, cursor->context,
+	    EB_TMP_MAX_HITS, cursor->hits, &cursor->hit_count);
+    }
+    cursor->hit_index = 0;
+    return error_code;
+}
 
-    /*
-     * Initialize indexes for the hit_lists[].
-     */
-    for (i = 0; i < hit_list_count; i++)
-	hit_indexes[i] = 0;
+/*
+ * Compare text positions of hits.
+ */
+static int
+eb_compare_hit_positions(const EB_Position *position1,
+    const EB_Position *position2)
+{
+    if (position1->page != position2->page)
+	return (position1->page < position2->page) ? -1 : 1;
+    if (position1->offset != position2->offset)
+	return (position1->offset < position2->offset) ? -1 : 1;
+    return 0;
+}
+
+/*
+ * Skip the hits of `cursor' before `position'.
+ * A batch whose last hit is before `position' is dropped as a whole,
+ * otherwise the hit is found by galloping from the current one.
+ * `cursor->hit_count' is 0 if there is no more hit.
+ */
+static EB_Error_Code
+eb_seek_hit_cursor(EB_Book *book, EB_Hit_Cursor *cursor,
+    const EB_Position *position)
+{
+    EB_Error_Code error_code;
+    EB_Hit *hits = cursor->hits;
+    int low;
+    int high;
+    int middle;
+    int step;
+
+    for (;;) {
+	if (cursor->hit_index < cursor->hit_count
+	    && 0 <= eb_compare_hit_positions(&hits[cursor->hit_count - 1].text,
+		position))
+	    break;
+	error_code = eb_fill_hit_cursor(book, cursor);
+	if (error_code != EB_SUCCESS)
+	    return error_code;
+	if (cursor->hit_count == 0)
+	    return EB_SUCCESS;
+    }
+
+    low = cursor->hit_index;
+    if (0 <= eb_compare_hit_positions(&hits[low].text, position))
+	return EB_SUCCESS;
 
     /*
-     * Generate the new list `and_list'.
+     * hits[low] is before `position' and the last hit is not.
      */
-    *and_count = 0;
-    while (*and_count < max_and_count) {
-	/*
-	 * Initialize variables.
-	 */
-	greatest_list = -1;
-	greatest_page = 0;
-	greatest_offset = 0;
-	current_page = 0;
-	current_offset = 0;
-	equal_count = 0;
+    step = 1;
+    while (low + step < cursor->hit_count - 1
+	&& eb_compare_hit_positions(&hits[low + step].text, position) < 0) {
+	low += step;
+	step *= 2;
+    }
+    high = low + step;
+    if (cursor->hit_count - 1 < high)
+	high = cursor->hit_count - 1;
+    while (1 < high - low) {
+	middle = low + (high - low) / 2;
+	if (eb_compare_hit_positions(&hits[middle].text, position) < 0)
+	    low = middle;
+	else
+	    high = middle;
+    }
+    cursor->hit_index = high;
 
-	/*
-	 * Compare the current elements of the lists.
-	 */
-	for (i = 0; i < hit_list_count; i++) {
-	    /*
-	     * If we have been reached to the tail of the hit_lists[i],
-	     * skip the list.
-	     */
-	    if (hit_counts[i] <= hit_indexes[i])
-		continue;
+    return EB_SUCCESS;
+}
 
-	    /*
-	     * Compare {current_page, current_offset} and {greatest_page,
-	     * greatest_offset}.
-	     */
-	    current_page = hit_lists[i][hit_indexes[i]].text.page;
-	    current_offset = hit_lists[i][hit_indexes[i]].text.offset;
-
-	    if (greatest_list == -1) {
-		greatest_page = current_page;
-		greatest_offset = current_offset;
-		greatest_list = i;
-		equal_count++;
-	    } else if (greatest_page < current_page) {
-		greatest_page = current_page;
-		greatest_offset = current_offset;
-		greatest_list = i;
-	    } else if (current_page == greatest_page
-		&& greatest_offset < current_offset) {
-		greatest_page = current_page;
-		greatest_offset = current_offset;
-		greatest_list = i;
-	    } else if (current_page == greatest_page
-		&& current_offset == greatest_offset) {
-		equal_count++;
+/*
+ * Do AND operation of the hit lists of the search contexts, in keyword,
+ * cross and multi search.
+ * The hit lists are sorted by text position.  Each cursor in turn skips
+ * to the greatest position seen, until all of them agree on it.  Hits
+ * are read from the contexts a batch at a time, so the lists are not
+ * limited in length.  The contexts are left just after the last hit
+ * of the result, for the next call.
+ */
+static EB_Error_Code
+eb_and_hit_lists(EB_Book *book, int max_hit_count, EB_Hit *hit_list,
+    int *hit_count)
+{
+    EB_Error_Code error_code;
+    EB_Hit_Cursor cursors[EB_NUMBER_OF_SEARCH_CONTEXTS];
+    EB_Position position;
+    EB_Hit_Cursor *cursor;
+    int cursor_count;
+    int agreed_count;
+    int i;
+
+    LOG(("in: eb_and_hit_lists(max_hit_count=%d)", max_hit_count));
+
+    *hit_count = 0;
+    for (i = 0; i < EB_NUMBER_OF_SEARCH_CONTEXTS; i++) {
+	if (book->search_contexts[i].code != EB_SEARCH_KEYWORD
+	    && book->search_contexts[i].code != EB_SEARCH_CROSS
+	    && book->search_contexts[i].code != EB_SEARCH_MULTI)
+	    break;
+	cursors[i].context = book->search_contexts + i;
+	cursors[i].hit_count = 0;
+	cursors[i].hit_index = 0;
+    }
+    cursor_count = i;
+    if (cursor_count == 0)
+	goto succeeded;
+
+    position.page = 0;
+    position.offset = 0;
+    while (*hit_count < max_hit_count) {
+	agreed_count = 0;
+	for (i = 0; agreed_count < cursor_count; i = (i + 1) % cursor_count) {
+	    cursor = cursors + i;
+	    error_code = eb_seek_hit_cursor(book, cursor, &position);
+	    if (error_code != EB_SUCCESS)
+		goto failed;
+	    if (cursor->hit_count == 0)
+		goto succeeded;
+	    if (eb_compare_hit_positions(&cursor->hits[cursor->hit_index].text,
+		&position) == 0) {
+		agreed_count++;
+	    } else {
+		position = cursor->hits[cursor->hit_index].text;
+		agreed_count = 1;
 	    }
 	}
 
-	if (equal_count == hit_list_count) {
-	    /*
-	     * All the current elements of the lists point to the same
-	     * position.  This is hit element.  Increase indexes of all
-	     * lists.
-	     */
-	    memcpy(and_list + *and_count, hit_lists[0] + hit_indexes[0],
-		sizeof(EB_Hit));
-	    *and_count += 1;
-	    for (i = 0; i < hit_list_count; i++) {
-		if (hit_counts[i] <= hit_indexes[i])
-		    continue;
-		hit_indexes[i]++;
-	    }
+	memcpy(hit_list + *hit_count, cursors[0].hits + cursors[0].hit_index,
+	    sizeof(EB_Hit));
+	*hit_count += 1;
+	for (i = 0; i < cursor_count; i++)
+	    cursors[i].hit_index++;
+    }
+
+    /*
+     * Put back the hits read but not used: read the batch again, only
+     * up to the current hit.
+     */
+  succeeded:
+    for (i = 0; i < cursor_count; i++) {
+	cursor = cursors + i;
+	if (cursor->hit_count <= cursor->hit_index)
+	    continue;
+	memcpy(cursor->context, &cursor->batch_context,
+	    sizeof(EB_Search_Context));
+	if (cursor->hit_index == 0)
+	    continue;
+	if (cursor->context->code == EB_SEARCH_MULTI) {
+	    error_code = eb_hit_list_multi(book, cursor->context,
+		cursor->hit_index, cursor->hits, &cursor->hit_count);
 	} else {
-	    /*
-	     * This is not hit element.  Increase indexes of all lists
-	     * except for greatest element(s).  If there is no list
-	     * whose index is incremented, our job has been completed.
-	     */
-	    increment_count = 0;
-	    for (i = 0; i < hit_list_count; i++) {
-		if (hit_counts[i] <= hit_indexes[i])
-		    continue;
-		current_page = hit_lists[i][hit_indexes[i]].text.page;
-		current_offset = hit_lists[i][hit_indexes[i]].text.offset;
-		if (current_page != greatest_page
-		    || current_offset != greatest_offset) {
-		    hit_indexes[i]++;
-		    increment_count++;
-		}
-	    }
-	    if (increment_count == 0)
-		break;
+	    error_code = eb_hit_list_keyword(book, cursor->context,
+		cursor->hit_index, cursor->hits, &cursor->hit_count);
 	}
+	if (error_code != EB_SUCCESS)
+	    goto failed;
     }
+    LOG(("out: eb_and_hit_lists(hit_count=%d) = %s", *hit_count,
+	eb_error_string(EB_SUCCESS)));
+    return EB_SUCCESS;
 
     /*
-     * Update hit_counts[].
-     * The hit counts of the lists are set to the current indexes.
+     * An error occurs...
      */
-    for (i = 0; i < hit_list_count; i++)
-	hit_counts[i] = hit_indexes[i];
-
-    LOG(("out: eb_and_hit_lists(and_count=%d)", *and_count));
+  failed:
+    *hit_count = 0;
+    LOG(("out: eb_and_hit_lists() = %s", eb_error_string(error_code)));
+    return error_code;
 }
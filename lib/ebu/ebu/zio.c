@@ -39,7 +39,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 
-#ifdef ENABLE_PTHREAD
+#if defined(ENABLE_PTHREAD) || defined(ENABLE_IO_URING)
 #include <pthread.h>
 #endif
 
@@ -49,6 +49,23 @@
 #include <zlib.h>
 #endif
 
+#if defined(ENABLE_IO_URING) || defined(ENABLE_SHARED_CACHE) \
+    || defined(HAVE_MMAP)
+#include <sys/mman.h>
+#endif
+
+#include <sys/stat.h>
+
+#ifdef ENABLE_SHARED_CACHE
+#include <time.h>
+#endif
+
+#ifdef ENABLE_IO_URING
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
 #include "zio.h"
 #ifdef ENABLE_EBNET
 #include "ebnet.h"
@@ -149,6 +166,16 @@ extern void eb_log(const char *, ...);
  */
 static char *cache_buffer = NULL;
 
+/*
+ * Function called on every read of zio_pread(), if any.
+ */
+static Zio_Trace_Function trace_function = NULL;
+
+/*
+ * Directory of the uncompressed mirrors of compressed files, if any.
+ */
+static char *mirror_directory = NULL;
+
 /*
  * Zio ID which caches data in `cache_buffer'.
  */
@@ -164,6 +191,150 @@ static off_t cache_location;
  */
 static int zio_counter = 0;
 
+/*
+ * Number of reads in a row, each starting where the last one ended,
+ * after which zio_read() reads ahead.
+ */
+#define ZIO_SEQUENTIAL_READS		3
+
+/*
+ * Length read ahead: slices uncompressed ahead of a sequential reader
+ * of a compressed file, and bytes of a plain file the kernel is asked
+ * to read ahead.
+ */
+#define ZIO_READAHEAD_SLICES		8
+#define ZIO_READAHEAD_PLAIN_LENGTH	(256 * 1024)
+
+#ifdef ENABLE_PTHREAD
+/*
+ * A slice uncompressed by the readahead thread.
+ */
+typedef struct {
+    int zio_id;			/* ZIO_ID_NONE if the slot is free */
+    off_t location;
+    int ready;			/* 0 while it is being uncompressed */
+    char *buffer;
+} Zio_Readahead_Slot;
+
+static Zio_Readahead_Slot readahead_slots[ZIO_READAHEAD_SLICES];
+
+/*
+ * The zio read ahead, and the slices to uncompress: those which start
+ * from `readahead_next' up to `readahead_end'.
+ */
+static Zio *readahead_zio = NULL;
+static off_t readahead_next;
+static off_t readahead_end;
+
+/*
+ * The zio of the slice the readahead thread is uncompressing, if any.
+ */
+static Zio *readahead_busy_zio = NULL;
+
+/*
+ * State of the readahead thread: 0 not started, 1 running, 2 asked to
+ * stop, -1 it can't be started.
+ */
+static int readahead_state = 0;
+static int readahead_atfork = 0;	/* fork handlers are registered */
+static pthread_t readahead_thread;
+static pthread_mutex_t readahead_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t readahead_cond = PTHREAD_COND_INITIALIZER;
+#endif
+
+#ifdef ENABLE_SHARED_CACHE
+/*
+ * Magic of a shared slice cache file.
+ */
+#define ZIO_SHARED_MAGIC		"EBZSHC02"
+
+/*
+ * Number of entries an uncompressed page may be cached in: those
+ * following the one its key hashes to.
+ */
+#define ZIO_SHARED_WAYS			4
+
+/*
+ * Seconds an entry may stay odd before a writer takes it over: its
+ * writer has died midway.
+ */
+#define ZIO_SHARED_STALE_SECONDS	10
+
+/*
+ * Header of a shared slice cache file.  It is followed by the entries,
+ * then by the pages they hold, ZIO_SIZE_PAGE bytes each.
+ */
+typedef struct {
+    char magic[8];
+    unsigned int page_size;
+    unsigned int entry_count;
+} Zio_Shared_Header;
+
+/*
+ * An entry of a shared slice cache.
+ * `sequence' is odd while the entry is being written: a reader copies
+ * the page, then checks that `sequence' has not changed meanwhile, and
+ * that the page matches `checksum', in case a writer taken over as
+ * stale wrote it at the same time.
+ */
+typedef struct {
+    unsigned int sequence;
+    unsigned int checksum;
+    unsigned long long key;	/* 0 if the entry is free */
+    unsigned long long location;
+    unsigned long long claimed;	/* time the entry was last written */
+} Zio_Shared_Entry;
+
+/*
+ * The shared slice cache mapped, if any.
+ */
+static Zio_Shared_Header *shared_header = NULL;
+static size_t shared_size = 0;
+static Zio_Shared_Entry *shared_entries = NULL;
+static char *shared_pages = NULL;
+#endif
+
+#ifdef ENABLE_IO_URING
+/*
+ * Number of prefetch reads in flight at most, and size of a read.
+ */
+#define ZIO_PREFETCH_QUEUE_DEPTH	64
+#define ZIO_PREFETCH_READ_SIZE		65536
+
+/*
+ * io_uring instance for prefetch reads.
+ * `file' is -1 until it is set up, and -2 if the kernel can't give one.
+ */
+typedef struct {
+    int file;
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    unsigned queued;		/* filled in, not submitted yet */
+    unsigned in_flight;		/* submitted, not completed yet */
+} Zio_Ring;
+
+static Zio_Ring prefetch_ring = {-1};
+static int ring_atfork = 0;	/* fork handler is registered */
+
+/*
+ * Prefetch reads only bring data into the page cache, so they all read
+ * into this buffer, whose contents are never used.
+ */
+static char *prefetch_buffer = NULL;
+static struct iovec prefetch_iovec;
+#endif
+
 /*
  * Mutex for cache variables.
  */
@@ -186,20 +357,61 @@ static int zio_open_ebzip(Zio *zio, const char *file_name);
 static int zio_open_epwing(Zio *zio, const char *file_name);
 static int zio_open_epwing6(Zio *zio, const char *file_name);
 static int zio_make_epwing_huffman_tree(Zio *zio, int leaf_count);
-static ssize_t zio_read_ebzip(Zio *zio, char *buffer, size_t length);
-static ssize_t zio_read_epwing(Zio *zio, char *buffer, size_t length);
-static ssize_t zio_read_sebxa(Zio *zio, char *buffer, size_t length);
-static int zio_unzip_slice_ebzip1(Zio *zio, char *out_buffer,
-    size_t zipped_slice_size);
-inline static int zio_unzip_slice_ebzip1_internal(Zio *zio,
+static ssize_t zio_read_ebzip(Zio *zio, off_t location, char *buffer,
+    size_t length);
+static ssize_t zio_read_epwing(Zio *zio, off_t location, char *buffer,
+    size_t length);
+static ssize_t zio_read_sebxa(Zio *zio, off_t location, char *buffer,
+    size_t length);
+static int zio_ebzip_slice_range(Zio *zio, off_t first_slice,
+    off_t last_slice, off_t *start, off_t *end);
+static int zio_uncompress_slice(Zio *zio, off_t location, char *out_buffer);
+static int zio_unzip_slice_ebzip1(Zio *zio, off_t location,
     char *out_buffer, size_t zipped_slice_size);
-static int zio_unzip_slice_epwing(Zio *zio, char *out_buffer);
-static int zio_unzip_slice_epwing6(Zio *zio, char *out_buffer);
-static int zio_unzip_slice_sebxa(Zio *zio, char *out_buffer);
+inline static int zio_unzip_slice_ebzip1_internal(Zio *zio, off_t location,
+    char *out_buffer, size_t zipped_slice_size);
+static int zio_unzip_slice_epwing(Zio *zio, off_t location,
+    char *out_buffer);
+static int zio_unzip_slice_epwing6(Zio *zio, off_t location,
+    char *out_buffer);
+static int zio_unzip_slice_sebxa(Zio *zio, off_t location,
+    char *out_buffer);
 static int zio_open_raw(Zio *zio, const char *file_name);
 static void zio_close_raw(Zio *zio);
 static off_t zio_lseek_raw(Zio *zio, off_t offset, int whence);
-static ssize_t zio_read_raw(Zio *zio, void *buffer, size_t length);
+static ssize_t zio_read_raw(Zio *zio, off_t *location, void *buffer,
+    size_t length);
+static int zio_unzip_slice(Zio *zio, off_t location, char *out_buffer);
+static int zio_mirror_path(Zio *zio, const struct stat *source_status,
+    char *path);
+static int zio_open_mirror(Zio *zio);
+#ifdef ENABLE_SHARED_CACHE
+static void zio_identify_shared(Zio *zio);
+static int zio_get_shared_slice(Zio *zio, off_t location, char *out_buffer);
+static int zio_claim_shared_entry(Zio_Shared_Entry *entry,
+    unsigned int *sequence);
+static unsigned int zio_shared_checksum(const char *page);
+static void zio_put_shared_slice(Zio *zio, off_t location,
+    const char *in_buffer);
+#endif
+static void zio_follow_stream(Zio *zio, off_t location, size_t length);
+static int zio_take_readahead(Zio *zio, off_t location);
+#ifdef ENABLE_PTHREAD
+static void zio_request_readahead(Zio *zio, off_t start, off_t end);
+static void zio_cancel_readahead(Zio *zio);
+static void zio_stop_readahead(void);
+static void *zio_readahead_main(void *argument);
+static void zio_prepare_fork(void);
+static void zio_parent_fork(void);
+static void zio_child_fork(void);
+#endif
+#ifdef ENABLE_IO_URING
+static int zio_setup_ring(void);
+static void zio_close_ring(void);
+static void zio_child_fork_ring(void);
+static int zio_enter_ring(unsigned min_complete);
+static int zio_queue_read(int file, off_t location, size_t length);
+#endif
 
 
 /*
@@ -247,6 +459,16 @@ zio_finalize_library(void)
 	free(cache_buffer);
     cache_buffer = NULL;
     cache_zio_id = ZIO_ID_NONE;
+#ifdef ENABLE_PTHREAD
+    zio_stop_readahead();
+#endif
+#ifdef ENABLE_IO_URING
+    zio_close_ring();
+#endif
+    zio_close_shared_cache();
+    if (mirror_directory != NULL)
+	free(mirror_directory);
+    mirror_directory = NULL;
 
     LOG(("out: zio_finalize_library()"));
     pthread_mutex_unlock(&zio_mutex);
@@ -268,6 +490,15 @@ zio_initialize(Zio *zio)
     zio->code = ZIO_INVALID;
     zio->file_size = 0;
     zio->is_ebnet = 0;
+    zio->shared_key = 0;
+    zio->map = NULL;
+    zio->map_size = 0;
+    zio->mirror_code = ZIO_INVALID;
+    zio->source_size = 0;
+    zio->source_mtime = 0;
+    zio->sequential_location = -1;
+    zio->sequential_count = 0;
+    zio->readahead_location = 0;
 
     LOG(("out: zio_initialize()"));
 }
@@ -346,6 +577,8 @@ zio_open(Zio *zio, const char *file_name, Zio_Code zio_code)
 	zio_finalize(zio);
 	zio_initialize(zio);
     }
+    if (zio_code != ZIO_REOPEN)
+	zio->mirror_code = ZIO_INVALID;
 
     switch (zio_code) {
     case ZIO_REOPEN:
@@ -370,6 +603,16 @@ zio_open(Zio *zio, const char *file_name, Zio_Code zio_code)
 	result = -1;
     }
 
+    if (0 <= result && zio_code != ZIO_REOPEN)
+	result = zio_open_mirror(zio);
+#ifdef ENABLE_SHARED_CACHE
+    if (0 <= result)
+	zio_identify_shared(zio);
+#endif
+    zio->sequential_location = -1;
+    zio->sequential_count = 0;
+    zio->readahead_location = 0;
+
   succeeded:
     LOG(("out: zio_open() = %d", result));
     return result;
@@ -387,11 +630,21 @@ zio_reopen(Zio *zio, const char *file_name)
     if (zio->code == ZIO_INVALID)
 	goto failed;
 
+    /*
+     * A mirrored file is opened compressed, then its mirror again, if
+     * it is still there.
+     */
+    if (zio->mirror_code != ZIO_INVALID) {
+	zio->code = zio->mirror_code;
+	zio->mirror_code = ZIO_INVALID;
+    }
     if (zio_open_raw(zio, file_name) < 0) {
 	zio->code = ZIO_INVALID;
 	goto failed;
     }
     zio->location = 0;
+    if (zio_open_mirror(zio) < 0)
+	goto failed;
 
     LOG(("out: zio_reopen() = %d", zio->file));
     return zio->file;
@@ -419,8 +672,9 @@ zio_open_plain(Zio *zio, const char *file_name)
     zio->code = ZIO_PLAIN;
     zio->slice_size = ZIO_SIZE_PAGE;
     zio->file_size = zio_lseek_raw(zio, 0, SEEK_END);
-    if (zio->file_size < 0 || zio_lseek_raw(zio, 0, SEEK_SET) < 0)
+    if (zio->file_size < 0)
 	goto failed;
+    zio->location = 0;
 
     /*
      * Assign ID.
@@ -454,6 +708,7 @@ zio_open_ebzip(Zio *zio, const char *file_name)
 {
     char header[ZIO_SIZE_EBZIP_HEADER];
     int ebzip_mode;
+    off_t raw_location = 0;
 
     LOG(("in: zio_open_ebzip(zio=%d, file_name=%s)", (int)zio->id, file_name));
 
@@ -466,7 +721,7 @@ zio_open_ebzip(Zio *zio, const char *file_name)
     /*
      * Read header part of the ebzip'ped file.
      */
-    if (zio_read_raw(zio, header, ZIO_SIZE_EBZIP_HEADER)
+    if (zio_read_raw(zio, &raw_location, header, ZIO_SIZE_EBZIP_HEADER)
 	!= ZIO_SIZE_EBZIP_HEADER)
 	goto failed;
     ebzip_mode = zio_uint1(header + 5) >> 4;
@@ -543,6 +798,7 @@ zio_open_epwing(Zio *zio, const char *file_name)
     ssize_t read_length;
     Zio_Huffman_Node *tail_node_p;
     int i;
+    off_t raw_location = 0;
 
     LOG(("in: zio_open_epwing(zio=%d, file_name=%s)", (int)zio->id,
 	file_name));
@@ -561,7 +817,7 @@ zio_open_epwing(Zio *zio, const char *file_name)
      * When `frequencies_length' is shorter than 512, we assumes the
      * file is broken.
      */
-    if (zio_read_raw(zio, buffer, 32) != 32)
+    if (zio_read_raw(zio, &raw_location, buffer, 32) != 32)
 	goto failed;
     zio->location = 0;
     zio->slice_size = ZIO_SIZE_PAGE;
@@ -581,10 +837,9 @@ zio_open_epwing(Zio *zio, const char *file_name)
      * is 0x0000, we assumes the data corresponding with the index
      * doesn't exist.
      */
-    if (zio_lseek_raw(zio, zio->index_location
-	    + ((off_t) zio->index_length - 36) / 36 * 36, SEEK_SET) < 0)
-	goto failed;
-    if (zio_read_raw(zio, buffer, 36) != 36)
+    raw_location = zio->index_location
+	    + ((off_t) zio->index_length - 36) / 36 * 36;
+    if (zio_read_raw(zio, &raw_location, buffer, 36) != 36)
 	goto failed;
     zio->file_size = ((off_t) zio->index_length / 36) * (ZIO_SIZE_PAGE * 16);
     for (i = 1, buffer_p = buffer + 4 + 2; i < 16; i++, buffer_p += 2) {
@@ -606,15 +861,16 @@ zio_open_epwing(Zio *zio, const char *file_name)
      * Make leafs for 16bit character.
      */
     read_length = ZIO_EPWING_BUFFER_SIZE - (ZIO_EPWING_BUFFER_SIZE % 4);
-    if (zio_lseek_raw(zio, zio->frequencies_location, SEEK_SET) < 0)
-	goto failed;
-    if (zio_read_raw(zio, buffer, read_length) != read_length)
+    raw_location = zio->frequencies_location;
+    if (zio_read_raw(zio, &raw_location, buffer, read_length)
+	!= read_length)
 	goto failed;
 
     buffer_p = buffer;
     for (i = 0; i < leaf16_count; i++) {
 	if (buffer + read_length <= buffer_p) {
-	    if (zio_read_raw(zio, buffer, read_length) != read_length)
+	    if (zio_read_raw(zio, &raw_location, buffer, read_length)
+		!= read_length)
 		goto failed;
 	    buffer_p = buffer;
 	}
@@ -630,10 +886,8 @@ zio_open_epwing(Zio *zio, const char *file_name)
     /*
      * Make leafs for 8bit character.
      */
-    if (zio_lseek_raw(zio, zio->frequencies_location + leaf16_count * 4,
-	SEEK_SET) < 0)
-	goto failed;
-    if (zio_read_raw(zio, buffer, 512) != 512)
+    raw_location = zio->frequencies_location + leaf16_count * 4;
+    if (zio_read_raw(zio, &raw_location, buffer, 512) != 512)
 	goto failed;
 
     buffer_p = buffer;
@@ -703,6 +957,7 @@ zio_open_epwing6(Zio *zio, const char *file_name)
     ssize_t read_length;
     Zio_Huffman_Node *tail_node_p;
     int i;
+    off_t raw_location = 0;
 
     LOG(("in: zio_open_epwing6(zio=%d, file_name=%s)", (int)zio->id,
 	file_name));
@@ -721,7 +976,7 @@ zio_open_epwing6(Zio *zio, const char *file_name)
      * When `frequencies_length' is shorter than 512, we assumes the
      * file is broken.
      */
-    if (zio_read_raw(zio, buffer, 48) != 48)
+    if (zio_read_raw(zio, &raw_location, buffer, 48) != 48)
 	goto failed;
     zio->location = 0;
     zio->slice_size = ZIO_SIZE_PAGE;
@@ -743,10 +998,9 @@ zio_open_epwing6(Zio *zio, const char *file_name)
      * is 0x0000, we assumes the data corresponding with the index
      * doesn't exist.
      */
-    if (zio_lseek_raw(zio, zio->index_location
-	+ ((off_t) zio->index_length - 36) / 36 * 36, SEEK_SET) < 0)
-	goto failed;
-    if (zio_read_raw(zio, buffer, 36) != 36)
+    raw_location = zio->index_location
+	+ ((off_t) zio->index_length - 36) / 36 * 36;
+    if (zio_read_raw(zio, &raw_location, buffer, 36) != 36)
 	goto failed;
     zio->file_size = ((off_t) zio->index_length / 36) * (ZIO_SIZE_PAGE * 16);
     for (i = 1, buffer_p = buffer + 4 + 2; i < 16; i++, buffer_p += 2) {
@@ -768,15 +1022,16 @@ zio_open_epwing6(Zio *zio, const char *file_name)
      * Make leafs for 32bit character.
      */
     read_length = ZIO_EPWING_BUFFER_SIZE - (ZIO_EPWING_BUFFER_SIZE % 6);
-    if (zio_lseek_raw(zio, zio->frequencies_location, SEEK_SET) < 0)
-	goto failed;
-    if (zio_read_raw(zio, buffer, read_length) != read_length)
+    raw_location = zio->frequencies_location;
+    if (zio_read_raw(zio, &raw_location, buffer, read_length)
+	!= read_length)
 	goto failed;
 
     buffer_p = buffer;
     for (i = 0; i < leaf32_count; i++) {
 	if (buffer + read_length <= buffer_p) {
-	    if (zio_read_raw(zio, buffer, read_length) != read_length)
+	    if (zio_read_raw(zio, &raw_location, buffer, read_length)
+		!= read_length)
 		goto failed;
 	    buffer_p = buffer;
 	}
@@ -793,16 +1048,16 @@ zio_open_epwing6(Zio *zio, const char *file_name)
      * Make leafs for 16bit character.
      */
     read_length = ZIO_EPWING_BUFFER_SIZE - (ZIO_EPWING_BUFFER_SIZE % 4);
-    if (zio_lseek_raw(zio, zio->frequencies_location + leaf32_count * 6,
-	SEEK_SET) < 0)
-	goto failed;
-    if (zio_read_raw(zio, buffer, read_length) != read_length)
+    raw_location = zio->frequencies_location + leaf32_count * 6;
+    if (zio_read_raw(zio, &raw_location, buffer, read_length)
+	!= read_length)
 	goto failed;
 
     buffer_p = buffer;
     for (i = 0; i < leaf16_count; i++) {
 	if (buffer + read_length <= buffer_p) {
-	    if (zio_read_raw(zio, buffer, read_length) != read_length)
+	    if (zio_read_raw(zio, &raw_location, buffer, read_length)
+		!= read_length)
 		goto failed;
 	    buffer_p = buffer;
 	}
@@ -818,10 +1073,9 @@ zio_open_epwing6(Zio *zio, const char *file_name)
     /*
      * Make leafs for 8bit character.
      */
-    if (zio_lseek_raw(zio, zio->frequencies_location + leaf32_count * 6
-	+ leaf16_count * 4, SEEK_SET) < 0)
-	goto failed;
-    if (zio_read_raw(zio, buffer, 512) != 512)
+    raw_location = zio->frequencies_location + leaf32_count * 6
+	+ leaf16_count * 4;
+    if (zio_read_raw(zio, &raw_location, buffer, 512) != 512)
 	goto failed;
 
     buffer_p = buffer;
@@ -1005,6 +1259,15 @@ zio_close(Zio *zio)
     /*
      * If contents of the file is cached, clear the cache.
      */
+#ifdef ENABLE_PTHREAD
+    zio_cancel_readahead(zio);
+#endif
+#ifdef HAVE_MMAP
+    if (zio->map != NULL)
+	munmap(zio->map, zio->map_size);
+#endif
+    zio->map = NULL;
+    zio->map_size = 0;
     if (0 <= zio->file)
 	zio_close_raw(zio);
     zio->file = -1;
@@ -1027,19 +1290,68 @@ zio_file(Zio *zio)
 
 
 /*
- * Return compression mode of `zio'.
+ * Return compression mode of `zio'.  When `zio' reads the mirror of a
+ * compressed file, it is the mode of the compressed file, since other
+ * files of the subbook are opened in the same mode.
  */
 Zio_Code
 zio_mode(Zio *zio)
 {
-    LOG(("in+out: zio_mode(zio=%d) = %d", (int)zio->id, zio->code));
+    Zio_Code code;
+
+    code = (zio->mirror_code != ZIO_INVALID) ? zio->mirror_code : zio->code;
+    LOG(("in+out: zio_mode(zio=%d) = %d", (int)zio->id, code));
+
+    return code;
+}
+
+
+/*
+ * Compute the location `location' bytes from `whence' of `zio', where
+ * `current' is the current location, as lseek() does.  The location is
+ * kept within the file.
+ */
+static off_t
+zio_seek_location(Zio *zio, off_t current, off_t location, int whence)
+{
+    off_t result;
+
+    switch (whence) {
+    case SEEK_SET:
+	result = location;
+	break;
+    case SEEK_CUR:
+	result = current + location;
+	break;
+    case SEEK_END:
+	if (zio->code == ZIO_PLAIN)
+	    result = zio->file_size + location;
+	else
+	    result = zio->file_size - location;
+	break;
+    default:
+#ifdef EINVAL
+	errno = EINVAL;
+#endif
+	return -1;
+    }
+
+    if (result < 0)
+	result = 0;
+    if (zio->file_size < result)
+	result = zio->file_size;
 
-    return zio->code;
+    return result;
 }
 
 
 /*
  * Seek `zio'.
+ *
+ * `zio' has a location of its own, for the callers which read it in
+ * turn.  The file offset of `zio->file' is never moved: use a cursor
+ * (zio_cursor_*()) or zio_pread() to read `zio' at another location,
+ * from other threads for instance.
  */
 off_t
 zio_lseek(Zio *zio, off_t location, int whence)
@@ -1052,46 +1364,10 @@ zio_lseek(Zio *zio, off_t location, int whence)
     if (zio->file < 0)
 	goto failed;
 
-    if (zio->code == ZIO_PLAIN) {
-	/*
-	 * If `zio' is not compressed, simply call lseek().
-	 */
-	result = zio_lseek_raw(zio, location, whence);
-    } else {
-	/*
-	 * Calculate new location according with `whence'.
-	 */
-	switch (whence) {
-	case SEEK_SET:
-	    zio->location = location;
-	    break;
-	case SEEK_CUR:
-	    zio->location = zio->location + location;
-	    break;
-	case SEEK_END:
-	    zio->location = zio->file_size - location;
-	    break;
-	default:
-#ifdef EINVAL
-	    errno = EINVAL;
-#endif
-	    goto failed;
-	}
-
-	/*
-	 * Adjust location.
-	 */
-	if (zio->location < 0)
-	    zio->location = 0;
-	if (zio->file_size < zio->location)
-	    zio->location = zio->file_size;
-
-	/*
-	 * Update `zio->location'.
-	 * (We don't actually seek the file.)
-	 */
-	result = zio->location;
-    }
+    result = zio_seek_location(zio, zio->location, location, whence);
+    if (result < 0)
+	goto failed;
+    zio->location = result;
 
     LOG(("out: zio_lseek() = %ld", (long)result));
     return result;
@@ -1106,66 +1382,247 @@ zio_lseek(Zio *zio, off_t location, int whence)
 
 
 /*
- * Read data from `zio' file.
+ * Read data from `zio' file, at the location of `zio'.
+ * When `zio' is read sequentially, the data which follows is read
+ * ahead.
  */
 ssize_t
 zio_read(Zio *zio, char *buffer, size_t length)
 {
     ssize_t read_length;
 
-    pthread_mutex_lock(&zio_mutex);
     LOG(("in: zio_read(zio=%d, length=%ld)", (int)zio->id, (long)length));
 
-    /*
-     * If the zio `file' is not compressed, call read() and return.
-     */
-    if (zio->file < 0)
+    read_length = zio_pread(zio, buffer, length, zio->location);
+    if (0 < read_length) {
+	zio_follow_stream(zio, zio->location, read_length);
+	zio->location += read_length;
+    }
+
+    LOG(("out: zio_read() = %ld", (long)read_length));
+    return read_length;
+}
+
+
+/*
+ * Read `length' bytes of `zio' file from `location', without moving
+ * the location of `zio'.
+ *
+ * A plain file is read with pread() only, so any number of threads may
+ * read it at once, each at its own location, with no lock.  Compressed
+ * files share the cache of the last slice uncompressed, and are read
+ * one thread at a time.
+ */
+ssize_t
+zio_pread(Zio *zio, char *buffer, size_t length, off_t location)
+{
+    ssize_t read_length;
+
+    LOG(("in: zio_pread(zio=%d, length=%ld, location=%ld)", (int)zio->id,
+	(long)length, (long)location));
+
+    if (zio->file < 0 || location < 0)
 	goto failed;
 
+    if (trace_function != NULL)
+	trace_function(zio, location, length);
+    if (zio->map != NULL) {
+	if (zio->file_size <= location)
+	    read_length = 0;
+	else if (zio->file_size - location < length)
+	    read_length = zio->file_size - location;
+	else
+	    read_length = length;
+	memcpy(buffer, zio->map + location, read_length);
+	goto succeeded;
+    }
+    if (zio->code == ZIO_PLAIN && !zio->is_ebnet) {
+	read_length = zio_read_raw(zio, &location, buffer, length);
+	goto succeeded;
+    }
+
+    pthread_mutex_lock(&zio_mutex);
     switch (zio->code) {
     case ZIO_PLAIN:
-	read_length = zio_read_raw(zio, buffer, length);
+	read_length = zio_read_raw(zio, &location, buffer, length);
 	break;
     case ZIO_EBZIP1:
-	read_length = zio_read_ebzip(zio, buffer, length);
+	read_length = zio_read_ebzip(zio, location, buffer, length);
 	break;
     case ZIO_EPWING:
     case ZIO_EPWING6:
-	read_length = zio_read_epwing(zio, buffer, length);
+	read_length = zio_read_epwing(zio, location, buffer, length);
 	break;
     case ZIO_SEBXA:
-	read_length = zio_read_sebxa(zio, buffer, length);
+	read_length = zio_read_sebxa(zio, location, buffer, length);
 	break;
     default:
-	goto failed;
+	read_length = -1;
     }
-
-    LOG(("out: zio_read() = %ld", (long)read_length));
     pthread_mutex_unlock(&zio_mutex);
 
+  succeeded:
+    LOG(("out: zio_pread() = %ld", (long)read_length));
     return read_length;
 
     /*
      * An error occurs...
      */
   failed:
-    LOG(("out: zio_read() = %ld", (long)-1));
+    LOG(("out: zio_pread() = %ld", (long)-1));
     return -1;
 }
 
 
+/*
+ * Set the function called with the location and the length of every
+ * read (zio_read(), zio_pread() and zio_cursor_read()), or none if
+ * `function' is NULL.  It is called before the data is read.
+ */
+void
+zio_set_trace_function(Zio_Trace_Function function)
+{
+    LOG(("in+out: zio_set_trace_function()"));
+
+    trace_function = function;
+}
+
+
+/*
+ * Initialize `cursor', a location in `zio' of a reader of its own.
+ * Any number of cursors may read a `zio' at once.
+ */
+void
+zio_cursor_initialize(Zio_Cursor *cursor, Zio *zio)
+{
+    cursor->zio = zio;
+    cursor->location = 0;
+}
+
+
+/*
+ * Seek `cursor', as lseek() does.
+ */
+off_t
+zio_cursor_lseek(Zio_Cursor *cursor, off_t location, int whence)
+{
+    off_t result;
+
+    if (cursor->zio->file < 0)
+	return -1;
+    result = zio_seek_location(cursor->zio, cursor->location, location,
+	whence);
+    if (0 <= result)
+	cursor->location = result;
+    return result;
+}
+
+
+/*
+ * Read data at `cursor', and advance it, as read() does.
+ */
+ssize_t
+zio_cursor_read(Zio_Cursor *cursor, char *buffer, size_t length)
+{
+    ssize_t read_length;
+
+    read_length = zio_pread(cursor->zio, buffer, length, cursor->location);
+    if (0 < read_length)
+	cursor->location += read_length;
+    return read_length;
+}
+
+
+/*
+ * Queue a read of `length' bytes of `zio' from `location', which the
+ * caller will ask for soon.  The file data (the compressed slices in
+ * ebzip files) is read into the page cache, so that the reads queued
+ * for many locations are served by the disk at once rather than one
+ * after another.  Call zio_submit_prefetch() when all are queued.
+ *
+ * It is only a hint: it does nothing if the library is built without
+ * io_uring or the kernel doesn't provide it, and the data is then read
+ * when asked for, as ever.  EPWING and S-EBXA compressed files are not
+ * prefetched.
+ */
+void
+zio_prefetch(Zio *zio, off_t location, size_t length)
+{
+#ifdef ENABLE_IO_URING
+    off_t slice_location;
+    off_t next_slice_location;
+
+    pthread_mutex_lock(&zio_mutex);
+    LOG(("in: zio_prefetch(zio=%d, location=%ld, length=%ld)",
+	(int)zio->id, (long)location, (long)length));
+
+    if (zio->file < 0 || zio->is_ebnet || length == 0
+	|| zio->file_size <= location || zio_setup_ring() < 0)
+	goto succeeded;
+    if (zio->file_size - location < length)
+	length = zio->file_size - location;
+
+    switch (zio->code) {
+    case ZIO_PLAIN:
+	zio_queue_read(zio->file, location, length);
+	break;
+    case ZIO_EBZIP1:
+	/*
+	 * The slices are stored in order: the compressed bytes from the
+	 * first slice to the last one.
+	 */
+	if (zio_ebzip_slice_range(zio, location / zio->slice_size,
+	    (location + length - 1) / zio->slice_size, &slice_location,
+	    &next_slice_location) < 0)
+	    goto succeeded;
+	zio_queue_read(zio->file, slice_location,
+	    next_slice_location - slice_location);
+	break;
+    default:
+	break;
+    }
+
+  succeeded:
+    LOG(("out: zio_prefetch()"));
+    pthread_mutex_unlock(&zio_mutex);
+#endif
+}
+
+
+/*
+ * Submit the reads queued by zio_prefetch().  If `wait' is not 0, wait
+ * until all the reads in flight complete.  Otherwise return at once: a
+ * read of the data waits for the prefetch of it anyway, in the kernel.
+ */
+void
+zio_submit_prefetch(int wait)
+{
+#ifdef ENABLE_IO_URING
+    pthread_mutex_lock(&zio_mutex);
+    LOG(("in: zio_submit_prefetch(wait=%d)", wait));
+
+    if (0 <= prefetch_ring.file) {
+	zio_enter_ring(0);
+	while (wait && 0 < prefetch_ring.in_flight) {
+	    if (zio_enter_ring(prefetch_ring.in_flight) < 0)
+		break;
+	}
+    }
+
+    LOG(("out: zio_submit_prefetch()"));
+    pthread_mutex_unlock(&zio_mutex);
+#endif
+}
+
+
 /*
  * Read data from the `zio' file compressed with the ebzip compression
  * format.
  */
 static ssize_t
-zio_read_ebzip(Zio *zio, char *buffer, size_t length)
+zio_read_ebzip(Zio *zio, off_t location, char *buffer, size_t length)
 {
-    char temporary_buffer[8];
     ssize_t read_length = 0;
-    size_t zipped_slice_size;
-    off_t slice_location;
-    off_t next_slice_location;
     int n;
 
     LOG(("in: zio_read_ebzip(zio=%d, length=%ld)", (int)zio->id,
@@ -1175,7 +1632,7 @@ zio_read_ebzip(Zio *zio, char *buffer, size_t length)
      * Read data.
      */
     while (read_length < length) {
-	if (zio->file_size <= zio->location)
+	if (zio->file_size <= location)
 	    goto succeeded;
 
 	/*
@@ -1183,74 +1640,35 @@ zio_read_ebzip(Zio *zio, char *buffer, size_t length)
 	 * `zio->file'.
 	 */
 	if (cache_zio_id != zio->id
-	    || zio->location < cache_location
-	    || cache_location + zio->slice_size <= zio->location) {
+	    || location < cache_location
+	    || cache_location + zio->slice_size <= location) {
 
 	    cache_zio_id = ZIO_ID_NONE;
-	    cache_location = zio->location - (zio->location % zio->slice_size);
+	    cache_location = location - (location % zio->slice_size);
 
 	    /*
-	     * Get buffer location and size from index table in `zio->file'.
+	     * Take the slice if it has been read ahead, otherwise read and
+	     * uncompress it.
 	     */
-	    if (zio_lseek_raw(zio, zio->location / zio->slice_size
-		* zio->index_width + ZIO_SIZE_EBZIP_HEADER, SEEK_SET) < 0)
-		goto failed;
-	    if (zio_read_raw(zio, temporary_buffer, zio->index_width * 2)
-		!= zio->index_width * 2)
-		goto failed;
-
-	    switch (zio->index_width) {
-	    case 2:
-		slice_location = zio_uint2(temporary_buffer);
-		next_slice_location = zio_uint2(temporary_buffer + 2);
-		break;
-	    case 3:
-		slice_location = zio_uint3(temporary_buffer);
-		next_slice_location = zio_uint3(temporary_buffer + 3);
-		break;
-	    case 4:
-		slice_location = zio_uint4(temporary_buffer);
-		next_slice_location = zio_uint4(temporary_buffer + 4);
-		break;
-	    case 5:
-		slice_location = zio_uint5(temporary_buffer);
-		next_slice_location = zio_uint5(temporary_buffer + 5);
-		break;
-	    default:
+	    if (!zio_take_readahead(zio, cache_location)
+		&& zio_uncompress_slice(zio, cache_location, cache_buffer) < 0)
 		goto failed;
-	    }
-	    zipped_slice_size = next_slice_location - slice_location;
 
-	    if (next_slice_location <= slice_location
-		|| zio->slice_size < zipped_slice_size)
-		goto failed;
-
-	    /*
-	     * Read a compressed slice from `zio->file' and uncompress it.
-	     * The data is not compressed if its size is equals to
-	     * slice size.
-	     */
-	    if (zio_lseek_raw(zio, slice_location, SEEK_SET) < 0)
-		goto failed;
-	    if (zio_unzip_slice_ebzip1(zio, cache_buffer, zipped_slice_size)
-		< 0)
-		goto failed;
-
-	    cache_zio_id = zio->id;
-	}
+	    cache_zio_id = zio->id;
+	}
 
 	/*
 	 * Copy data from `cache_buffer' to `buffer'.
 	 */
-	n = zio->slice_size - (zio->location % zio->slice_size);
+	n = zio->slice_size - (location % zio->slice_size);
 	if (length - read_length < n)
 	    n = length - read_length;
-	if (zio->file_size - zio->location < n)
-	    n = zio->file_size - zio->location;
+	if (zio->file_size - location < n)
+	    n = zio->file_size - location;
 	memcpy(buffer + read_length,
-	    cache_buffer + (zio->location % zio->slice_size), n);
+	    cache_buffer + (location % zio->slice_size), n);
 	read_length += n;
-	zio->location += n;
+	location += n;
     }
 
   succeeded:
@@ -1271,11 +1689,9 @@ zio_read_ebzip(Zio *zio, char *buffer, size_t length)
  * compression format.
  */
 static ssize_t
-zio_read_epwing(Zio *zio, char *buffer, size_t length)
+zio_read_epwing(Zio *zio, off_t location, char *buffer, size_t length)
 {
-    char temporary_buffer[36];
     ssize_t read_length = 0;
-    off_t page_location;
     int n;
 
     LOG(("in: zio_read_epwing(zio=%d, length=%ld)", (int)zio->id,
@@ -1285,7 +1701,7 @@ zio_read_epwing(Zio *zio, char *buffer, size_t length)
      * Read data.
      */
     while (read_length < length) {
-	if (zio->file_size <= zio->location)
+	if (zio->file_size <= location)
 	    goto succeeded;
 
 	/*
@@ -1293,35 +1709,18 @@ zio_read_epwing(Zio *zio, char *buffer, size_t length)
 	 * file.
 	 */
 	if (cache_zio_id != zio->id
-	    || zio->location < cache_location
-	    || cache_location + zio->slice_size <= zio->location) {
+	    || location < cache_location
+	    || cache_location + zio->slice_size <= location) {
 	    cache_zio_id = ZIO_ID_NONE;
-	    cache_location = zio->location - (zio->location % zio->slice_size);
-
-	    /*
-	     * Get page location from index table in `zio->file'.
-	     */
-	    if (zio_lseek_raw(zio, zio->index_location
-		+ zio->location / (ZIO_SIZE_PAGE * 16) * 36, SEEK_SET) < 0)
-		goto failed;
-	    if (zio_read_raw(zio, temporary_buffer, 36) != 36)
-		goto failed;
-	    page_location = zio_uint4(temporary_buffer)
-		+ zio_uint2(temporary_buffer + 4
-		    + (zio->location / ZIO_SIZE_PAGE % 16) * 2);
+	    cache_location = location - (location % zio->slice_size);
 
 	    /*
-	     * Read a compressed page from `zio->file' and uncompress it.
+	     * Take the page if it has been read ahead, otherwise read and
+	     * uncompress it.
 	     */
-	    if (zio_lseek_raw(zio, page_location, SEEK_SET) < 0)
+	    if (!zio_take_readahead(zio, cache_location)
+		&& zio_uncompress_slice(zio, cache_location, cache_buffer) < 0)
 		goto failed;
-	    if (zio->code == ZIO_EPWING) {
-		if (zio_unzip_slice_epwing(zio, cache_buffer) < 0)
-		    goto failed;
-	    } else {
-		if (zio_unzip_slice_epwing6(zio, cache_buffer) < 0)
-		    goto failed;
-	    }
 
 	    cache_zio_id = zio->id;
 	}
@@ -1329,15 +1728,15 @@ zio_read_epwing(Zio *zio, char *buffer, size_t length)
 	/*
 	 * Copy data from `cache_buffer' to `buffer'.
 	 */
-	n = ZIO_SIZE_PAGE - (zio->location % ZIO_SIZE_PAGE);
+	n = ZIO_SIZE_PAGE - (location % ZIO_SIZE_PAGE);
 	if (length - read_length < n)
 	    n = length - read_length;
-	if (zio->file_size - zio->location < n)
-	    n = zio->file_size - zio->location;
+	if (zio->file_size - location < n)
+	    n = zio->file_size - location;
 	memcpy(buffer + read_length,
-	    cache_buffer + (zio->location - cache_location), n);
+	    cache_buffer + (location - cache_location), n);
 	read_length += n;
-	zio->location += n;
+	location += n;
     }
 
   succeeded:
@@ -1360,10 +1759,11 @@ zio_read_epwing(Zio *zio, char *buffer, size_t length)
  * format.
  */
 static ssize_t
-zio_read_sebxa(Zio *zio, char *buffer, size_t length)
+zio_read_sebxa(Zio *zio, off_t location, char *buffer, size_t length)
 {
     char temporary_buffer[4];
     ssize_t read_length = 0;
+    off_t raw_location;
     off_t slice_location;
     ssize_t n;
     int slice_index;
@@ -1375,33 +1775,35 @@ zio_read_sebxa(Zio *zio, char *buffer, size_t length)
      * Read data.
      */
     while (read_length < length) {
-	if (zio->file_size <= zio->location)
+	if (zio->file_size <= location)
 	    goto succeeded;
 
-	if (zio->location < zio->zio_start_location) {
+	if (location < zio->zio_start_location) {
 	    /*
 	     * Data is located in front of compressed text.
 	     */
-	    if (zio->zio_start_location - zio->location < length - read_length)
-		n = zio->zio_start_location - zio->location;
+	    if (zio->zio_start_location - location < length - read_length)
+		n = zio->zio_start_location - location;
 	    else
 		n = length - read_length;
-	    if (zio_lseek_raw(zio, zio->location, SEEK_SET) < 0)
-		goto failed;
-	    if (zio_read_raw(zio, buffer, n) != n)
+	    raw_location = location;
+	    if (zio_read_raw(zio, &raw_location, buffer + read_length, n)
+		!= n)
 		goto failed;
 	    read_length += n;
+	    location += n;
 
-	} else if (zio->zio_end_location <= zio->location) {
+	} else if (zio->zio_end_location <= location) {
 	    /*
 	     * Data is located behind compressed text.
 	     */
-	    if (zio_lseek_raw(zio, zio->location, SEEK_SET) < 0)
-		goto failed;
-	    if (zio_read_raw(zio, buffer, length - read_length)
-		!= length - read_length)
+	    n = length - read_length;
+	    raw_location = location;
+	    if (zio_read_raw(zio, &raw_location, buffer + read_length, n)
+		!= n)
 		goto failed;
-	    read_length = length;
+	    read_length += n;
+	    location += n;
 
 	} else {
 	    /*
@@ -1411,25 +1813,25 @@ zio_read_sebxa(Zio *zio, char *buffer, size_t length)
 	     * `file'.
 	     */
 	    if (cache_zio_id != zio->id
-		|| zio->location < cache_location
-		|| cache_location + ZIO_SEBXA_SLICE_LENGTH <= zio->location) {
+		|| location < cache_location
+		|| cache_location + ZIO_SEBXA_SLICE_LENGTH <= location) {
 
 		cache_zio_id = ZIO_ID_NONE;
-		cache_location = zio->location
-		    - (zio->location % ZIO_SEBXA_SLICE_LENGTH);
+		cache_location = location
+		    - (location % ZIO_SEBXA_SLICE_LENGTH);
 
 		/*
 		 * Get buffer location and size.
 		 */
-		slice_index = (zio->location - zio->zio_start_location)
+		slice_index = (location - zio->zio_start_location)
 		    / ZIO_SEBXA_SLICE_LENGTH;
 		if (slice_index == 0)
 		    slice_location = zio->index_base;
 		else {
-		    if (zio_lseek_raw(zio, ((off_t) slice_index - 1) * 4
-			+ zio->index_location, SEEK_SET) < 0)
-			goto failed;
-		    if (zio_read_raw(zio, temporary_buffer, 4) != 4)
+		    raw_location = ((off_t) slice_index - 1) * 4
+			+ zio->index_location;
+		    if (zio_read_raw(zio, &raw_location, temporary_buffer, 4)
+			!= 4)
 			goto failed;
 		    slice_location = zio->index_base
 			+ zio_uint4(temporary_buffer);
@@ -1438,9 +1840,8 @@ zio_read_sebxa(Zio *zio, char *buffer, size_t length)
 		/*
 		 * Read a compressed slice from `zio->file' and uncompress it.
 		 */
-		if (zio_lseek_raw(zio, slice_location, SEEK_SET) < 0)
-		    goto failed;
-		if (zio_unzip_slice_sebxa(zio, cache_buffer) < 0)
+		if (zio_unzip_slice_sebxa(zio, slice_location, cache_buffer)
+		    < 0)
 		    goto failed;
 
 		cache_zio_id = zio->id;
@@ -1450,15 +1851,15 @@ zio_read_sebxa(Zio *zio, char *buffer, size_t length)
 	     * Copy data from `cache_buffer' to `buffer'.
 	     */
 	    n = ZIO_SEBXA_SLICE_LENGTH
-		- (zio->location % ZIO_SEBXA_SLICE_LENGTH);
+		- (location % ZIO_SEBXA_SLICE_LENGTH);
 	    if (length - read_length < n)
 		n = length - read_length;
-	    if (zio->file_size - zio->location < n)
-		n = zio->file_size - zio->location;
+	    if (zio->file_size - location < n)
+		n = zio->file_size - location;
 	    memcpy(buffer + read_length,
-		cache_buffer + (zio->location - cache_location), n);
+		cache_buffer + (location - cache_location), n);
 	    read_length += n;
-	    zio->location += n;
+	    location += n;
 	}
     }
 
@@ -1475,13 +1876,155 @@ zio_read_sebxa(Zio *zio, char *buffer, size_t length)
 }
 
 
+/*
+ * Get the location in `zio->file' of the compressed slices numbered
+ * `first_slice' to `last_slice' of the ebzip'ped `zio', from the index
+ * table: `*start' is where the first one starts and `*end' where the
+ * last one ends (the slices are stored in order).
+ *
+ * If it succeeds, 0 is returned.  Otherwise, -1 is returned.
+ */
+static int
+zio_ebzip_slice_range(Zio *zio, off_t first_slice, off_t last_slice,
+    off_t *start, off_t *end)
+{
+    char buffer[10];
+    off_t raw_location;
+    int width = zio->index_width;
+
+    raw_location = first_slice * width + ZIO_SIZE_EBZIP_HEADER;
+    if (first_slice == last_slice) {
+	if (zio_read_raw(zio, &raw_location, buffer, width * 2) != width * 2)
+	    return -1;
+    } else {
+	if (zio_read_raw(zio, &raw_location, buffer, width) != width)
+	    return -1;
+	raw_location = (last_slice + 1) * width + ZIO_SIZE_EBZIP_HEADER;
+	if (zio_read_raw(zio, &raw_location, buffer + width, width) != width)
+	    return -1;
+    }
+
+    switch (width) {
+    case 2:
+	*start = zio_uint2(buffer);
+	*end = zio_uint2(buffer + 2);
+	break;
+    case 3:
+	*start = zio_uint3(buffer);
+	*end = zio_uint3(buffer + 3);
+	break;
+    case 4:
+	*start = zio_uint4(buffer);
+	*end = zio_uint4(buffer + 4);
+	break;
+    case 5:
+	*start = zio_uint5(buffer);
+	*end = zio_uint5(buffer + 5);
+	break;
+    default:
+	return -1;
+    }
+    if (*end <= *start)
+	return -1;
+
+    return 0;
+}
+
+
+/*
+ * Read the slice of the ebzip or EPWING compressed `zio' which starts
+ * at `location', and uncompress it into `out_buffer'.  The slice is
+ * taken from the shared slice cache if it is there, and put there
+ * otherwise.
+ * It uses no global data, so the readahead thread may call it.
+ *
+ * If it succeeds, 0 is returned.  Otherwise, -1 is returned.
+ */
+static int
+zio_uncompress_slice(Zio *zio, off_t location, char *out_buffer)
+{
+#ifdef ENABLE_SHARED_CACHE
+    if (zio_get_shared_slice(zio, location, out_buffer))
+	return 0;
+    if (zio_unzip_slice(zio, location, out_buffer) < 0)
+	return -1;
+    zio_put_shared_slice(zio, location, out_buffer);
+    return 0;
+#else
+    return zio_unzip_slice(zio, location, out_buffer);
+#endif
+}
+
+
+/*
+ * Read the compressed slice which holds `location' from `zio->file',
+ * and uncompress it into `out_buffer'.
+ *
+ * If it succeeds, 0 is returned.  Otherwise, -1 is returned.
+ */
+static int
+zio_unzip_slice(Zio *zio, off_t location, char *out_buffer)
+{
+    char temporary_buffer[36];
+    off_t raw_location;
+    off_t slice_location;
+    off_t next_slice_location;
+    off_t page_location;
+
+    switch (zio->code) {
+    case ZIO_EBZIP1:
+	/*
+	 * Get buffer location and size from index table in `zio->file'.
+	 */
+	if (zio_ebzip_slice_range(zio, location / zio->slice_size,
+	    location / zio->slice_size, &slice_location,
+	    &next_slice_location) < 0)
+	    return -1;
+	if (zio->slice_size < next_slice_location - slice_location)
+	    return -1;
+
+	/*
+	 * Read a compressed slice from `zio->file' and uncompress it.
+	 * The data is not compressed if its size is equals to
+	 * slice size.
+	 */
+	return zio_unzip_slice_ebzip1(zio, slice_location, out_buffer,
+	    next_slice_location - slice_location);
+
+    case ZIO_EPWING:
+    case ZIO_EPWING6:
+	/*
+	 * Get page location from index table in `zio->file'.
+	 */
+	raw_location = zio->index_location
+	    + location / (ZIO_SIZE_PAGE * 16) * 36;
+	if (zio_read_raw(zio, &raw_location, temporary_buffer, 36) != 36)
+	    return -1;
+	page_location = zio_uint4(temporary_buffer)
+	    + zio_uint2(temporary_buffer + 4
+		+ (location / ZIO_SIZE_PAGE % 16) * 2);
+
+	/*
+	 * Read a compressed page from `zio->file' and uncompress it.
+	 */
+	if (zio->code == ZIO_EPWING)
+	    return zio_unzip_slice_epwing(zio, page_location, out_buffer);
+	return zio_unzip_slice_epwing6(zio, page_location, out_buffer);
+
+    default:
+	return -1;
+    }
+}
+
+
 /*
  * Uncompress an ebzip'ped slice.
  *
  * If it succeeds, 0 is returned.  Otherwise, -1 is returned.
  */
 static int
-zio_unzip_slice_ebzip1(Zio *zio, char *out_buffer, size_t zipped_slice_size)
+zio_unzip_slice_ebzip1(Zio *zio, off_t location, char *out_buffer,
+    size_t zipped_slice_size)
 {
     LOG(("in: zio_unzip_slice_ebzip1(zio=%d, zipped_slice_size=%ld)",
 	 (int)zio->id, (long)zipped_slice_size));
@@ -1491,7 +2034,7 @@ zio_unzip_slice_ebzip1(Zio *zio, char *out_buffer, size_t zipped_slice_size)
 	 * The input slice is not compressed.
 	 * Read the target page in the slice.
 	 */
-	if (zio_read_raw(zio, out_buffer, zipped_slice_size) !=
+	if (zio_read_raw(zio, &location, out_buffer, zipped_slice_size) !=
 	    zipped_slice_size)
 	    goto failed;
 
@@ -1501,7 +2044,7 @@ zio_unzip_slice_ebzip1(Zio *zio, char *out_buffer, size_t zipped_slice_size)
 	 * Read and uncompress the target page in the slice.
 	 */
 	if (zio_unzip_slice_ebzip1_internal
-	    (zio, out_buffer, zipped_slice_size) != 0)
+	    (zio, location, out_buffer, zipped_slice_size) != 0)
 	    goto failed;
     }
 
@@ -1518,7 +2061,7 @@ zio_unzip_slice_ebzip1(Zio *zio, char *out_buffer, size_t zipped_slice_size)
 
 inline static int
 zio_unzip_slice_ebzip1_internal
-(Zio *zio, char *out_buffer, size_t zipped_slice_size)
+(Zio *zio, off_t location, char *out_buffer, size_t zipped_slice_size)
 {
 #ifdef ENABLE_LIBDEFLATE
     char *in_buffer = NULL;
@@ -1534,7 +2077,7 @@ zio_unzip_slice_ebzip1_internal
     in_buffer = malloc(zipped_slice_size);
     if (!in_buffer) goto failed;
 
-    if (zio_read_raw(zio, in_buffer, zipped_slice_size) !=
+    if (zio_read_raw(zio, &location, in_buffer, zipped_slice_size) !=
 	zipped_slice_size)
 	goto failed;
 
@@ -1590,7 +2133,7 @@ zio_unzip_slice_ebzip1_internal
 	    read_length = ZIO_SIZE_PAGE - stream.avail_in;
 	}
 
-	if (zio_read_raw(zio, in_buffer + stream.avail_in,
+	if (zio_read_raw(zio, &location, in_buffer + stream.avail_in,
 	    read_length) != read_length)
 	    goto failed;
 
@@ -1630,7 +2173,7 @@ zio_unzip_slice_ebzip1_internal
  * If it succeeds, 0 is returned.  Otherwise, -1 is returned.
  */
 static int
-zio_unzip_slice_epwing(Zio *zio, char *out_buffer)
+zio_unzip_slice_epwing(Zio *zio, off_t location, char *out_buffer)
 {
     Zio_Huffman_Node *node_p;
     int bit;
@@ -1660,7 +2203,8 @@ zio_unzip_slice_epwing(Zio *zio, char *out_buffer)
 	     * If no data is left in the input buffer, read next chunk.
 	     */
 	    if ((unsigned char *)in_buffer + in_read_length <= in_buffer_p) {
-		in_read_length = zio_read_raw(zio, in_buffer, ZIO_SIZE_PAGE);
+		in_read_length = zio_read_raw(zio, &location, in_buffer,
+		    ZIO_SIZE_PAGE);
 		if (in_read_length <= 0)
 		    goto failed;
 		in_buffer_p = (unsigned char *)in_buffer;
@@ -1744,7 +2288,7 @@ zio_unzip_slice_epwing(Zio *zio, char *out_buffer)
  * If it succeeds, 0 is returned.  Otherwise, -1 is returned.
  */
 static int
-zio_unzip_slice_epwing6(Zio *zio, char *out_buffer)
+zio_unzip_slice_epwing6(Zio *zio, off_t location, char *out_buffer)
 {
     Zio_Huffman_Node *node_p;
     int bit;
@@ -1767,7 +2311,7 @@ zio_unzip_slice_epwing6(Zio *zio, char *out_buffer)
     /*
      * Get compression type.
      */
-    if (zio_read_raw(zio, in_buffer, 1) != 1)
+    if (zio_read_raw(zio, &location, in_buffer, 1) != 1)
 	goto failed;
     compression_type = zio_uint1(in_buffer);
 
@@ -1775,7 +2319,8 @@ zio_unzip_slice_epwing6(Zio *zio, char *out_buffer)
      * If compression type is not 0, this page is not compressed.
      */
     if (compression_type != 0) {
-	if (zio_read_raw(zio, out_buffer, ZIO_SIZE_PAGE) != ZIO_SIZE_PAGE)
+	if (zio_read_raw(zio, &location, out_buffer, ZIO_SIZE_PAGE)
+	    != ZIO_SIZE_PAGE)
 	    goto failed;
 	goto succeeded;
     }
@@ -1791,7 +2336,8 @@ zio_unzip_slice_epwing6(Zio *zio, char *out_buffer)
 	     * If no data is left in the input buffer, read next chunk.
 	     */
 	    if ((unsigned char *)in_buffer + in_read_length <= in_buffer_p) {
-		in_read_length = zio_read_raw(zio, in_buffer, ZIO_SIZE_PAGE);
+		in_read_length = zio_read_raw(zio, &location, in_buffer,
+		    ZIO_SIZE_PAGE);
 		if (in_read_length <= 0)
 		    goto failed;
 		in_buffer_p = (unsigned char *)in_buffer;
@@ -1892,7 +2438,7 @@ zio_unzip_slice_epwing6(Zio *zio, char *out_buffer)
  * If it succeeds, 0 is returned.  Otherwise, -1 is returned.
  */
 static int
-zio_unzip_slice_sebxa(Zio *zio, char *out_buffer)
+zio_unzip_slice_sebxa(Zio *zio, off_t location, char *out_buffer)
 {
     char in_buffer[ZIO_SEBXA_SLICE_LENGTH];
     unsigned char *in_buffer_p;
@@ -1916,7 +2462,7 @@ zio_unzip_slice_sebxa(Zio *zio, char *out_buffer)
 	 * If no data is left in the input buffer, read next chunk.
 	 */
 	if (in_read_rest <= 0) {
-	    in_read_rest = zio_read_raw(zio, in_buffer,
+	    in_read_rest = zio_read_raw(zio, &location, in_buffer,
 		ZIO_SEBXA_SLICE_LENGTH);
 	    if (in_read_rest <= 0)
 		goto failed;
@@ -2096,24 +2642,31 @@ zio_lseek_raw(Zio *zio, off_t offset, int whence)
 
 /*
  * Low-level read function.
+ * Read from `*location' of `zio->file', and advance `*location' by the
+ * length read.  The file offset of `zio->file' is not used.
  *
- * If `zio->file' is socket, it calls ebnet_read().  Otherwise it calls
- * the read() system call.
+ * If `zio->file' is socket, it calls ebnet_lseek() and ebnet_read().
+ * Otherwise it calls the pread() system call.
  */
 static ssize_t
-zio_read_raw(Zio *zio, void *buffer, size_t length)
+zio_read_raw(Zio *zio, off_t *location, void *buffer, size_t length)
 {
     char *buffer_p = buffer;
     ssize_t result;
 
-    LOG(("in: zio_read_raw(file=%d, length=%ld)", zio->file, (long)length));
+    LOG(("in: zio_read_raw(file=%d, location=%ld, length=%ld)", zio->file,
+	(long)*location, (long)length));
 
     if (zio->is_ebnet) {
 	/*
 	 * Read from a remote server.
 	 */
 #ifdef ENABLE_EBNET
+	if (ebnet_lseek(zio->file, *location, SEEK_SET) < 0)
+	    goto failed;
 	result = ebnet_read(&zio->file, buffer, length);
+	if (0 < result)
+	    *location += result;
 #else
 	result = -1;
 #endif
@@ -2126,7 +2679,7 @@ zio_read_raw(Zio *zio, void *buffer, size_t length)
 
 	while (0 < rest_length) {
 	    errno = 0;
-	    n = read(zio->file, buffer_p, rest_length);
+	    n = pread(zio->file, buffer_p, rest_length, *location);
 	    if (n < 0) {
 		if (errno == EINTR)
 		    continue;
@@ -2136,6 +2689,7 @@ zio_read_raw(Zio *zio, void *buffer, size_t length)
 	    else {
 		rest_length -= n;
 		buffer_p += n;
+		*location += n;
 	    }
 	}
 
@@ -2154,3 +2708,1085 @@ zio_read_raw(Zio *zio, void *buffer, size_t length)
 }
 
 
+
+
+#ifdef ENABLE_IO_URING
+/*
+ * Set up the prefetch io_uring, unless done already.
+ * Return 0 if it can be used, -1 otherwise.
+ */
+static int
+zio_setup_ring(void)
+{
+    struct io_uring_params params;
+    Zio_Ring *ring = &prefetch_ring;
+    int file;
+
+    if (ring->file != -1)
+	return (0 <= ring->file) ? 0 : -1;
+
+    ring->file = -2;
+    if (!ring_atfork) {
+	if (pthread_atfork(NULL, NULL, zio_child_fork_ring) != 0)
+	    return -1;
+	ring_atfork = 1;
+    }
+    if (prefetch_buffer == NULL) {
+	prefetch_buffer = (char *) malloc(ZIO_PREFETCH_READ_SIZE);
+	if (prefetch_buffer == NULL)
+	    return -1;
+	prefetch_iovec.iov_base = prefetch_buffer;
+	prefetch_iovec.iov_len = ZIO_PREFETCH_READ_SIZE;
+    }
+
+    memset(&params, 0, sizeof(params));
+    file = syscall(__NR_io_uring_setup, ZIO_PREFETCH_QUEUE_DEPTH, &params);
+    if (file < 0)
+	return -1;
+
+    ring->sq_map_size = params.sq_off.array
+	+ params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes
+	+ params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+	if (ring->sq_map_size < ring->cq_map_size)
+	    ring->sq_map_size = ring->cq_map_size;
+	ring->cq_map_size = ring->sq_map_size;
+    }
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE,
+	MAP_SHARED | MAP_POPULATE, file, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED)
+	goto failed;
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+	ring->cq_map = ring->sq_map;
+    } else {
+	ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, file, IORING_OFF_CQ_RING);
+	if (ring->cq_map == MAP_FAILED) {
+	    munmap(ring->sq_map, ring->sq_map_size);
+	    goto failed;
+	}
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *) mmap(NULL, ring->sqes_size,
+	PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, file,
+	IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+	if (ring->cq_map != ring->sq_map)
+	    munmap(ring->cq_map, ring->cq_map_size);
+	munmap(ring->sq_map, ring->sq_map_size);
+	goto failed;
+    }
+
+    ring->sq_head = (unsigned *) ((char *) ring->sq_map + params.sq_off.head);
+    ring->sq_tail = (unsigned *) ((char *) ring->sq_map + params.sq_off.tail);
+    ring->sq_mask = (unsigned *) ((char *) ring->sq_map
+	+ params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) ((char *) ring->sq_map
+	+ params.sq_off.array);
+    ring->cq_head = (unsigned *) ((char *) ring->cq_map + params.cq_off.head);
+    ring->cq_tail = (unsigned *) ((char *) ring->cq_map + params.cq_off.tail);
+    ring->cq_mask = (unsigned *) ((char *) ring->cq_map
+	+ params.cq_off.ring_mask);
+    ring->queued = 0;
+    ring->in_flight = 0;
+    ring->file = file;
+    return 0;
+
+    /*
+     * An error occurs...
+     */
+  failed:
+    close(file);
+    return -1;
+}
+
+
+/*
+ * Wait for the reads in flight of the prefetch io_uring, and close it.
+ */
+static void
+zio_close_ring(void)
+{
+    Zio_Ring *ring = &prefetch_ring;
+
+    if (0 <= ring->file) {
+	while (0 < ring->in_flight) {
+	    if (zio_enter_ring(ring->in_flight) < 0)
+		break;
+	}
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_map != ring->sq_map)
+	    munmap(ring->cq_map, ring->cq_map_size);
+	munmap(ring->sq_map, ring->sq_map_size);
+	close(ring->file);
+    }
+    ring->file = -1;
+    if (prefetch_buffer != NULL)
+	free(prefetch_buffer);
+    prefetch_buffer = NULL;
+}
+
+
+/*
+ * Fork handler.  The child shares the rings of the parent's io_uring,
+ * mapped shared: it forgets the ring, without unmapping or closing it,
+ * and sets up one of its own if it prefetches.
+ */
+static void
+zio_child_fork_ring(void)
+{
+    if (0 <= prefetch_ring.file) {
+	prefetch_ring.file = -1;
+	prefetch_ring.queued = 0;
+	prefetch_ring.in_flight = 0;
+    }
+}
+
+
+/*
+ * Submit the queued reads of the prefetch io_uring, wait until
+ * `min_complete' reads are complete, and reap the completions.
+ * Return 0 on success, -1 if the ring is unusable.
+ */
+static int
+zio_enter_ring(unsigned min_complete)
+{
+    Zio_Ring *ring = &prefetch_ring;
+    unsigned head;
+    int submitted;
+
+    for (;;) {
+	submitted = syscall(__NR_io_uring_enter, ring->file, ring->queued,
+	    min_complete, (0 < min_complete) ? IORING_ENTER_GETEVENTS : 0,
+	    NULL, 0);
+	if (0 <= submitted)
+	    break;
+	if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+	    return -1;
+    }
+    ring->queued -= submitted;
+    ring->in_flight += submitted;
+
+    /*
+     * The results don't matter: a failed read is done again when the
+     * data is asked for.
+     */
+    head = *ring->cq_head;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+	head++;
+	ring->in_flight--;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+
+/*
+ * Queue reads of `length' bytes of `file' from `location' in the
+ * prefetch io_uring.  When it is full, the reads queued are submitted
+ * and one completion is waited for.
+ */
+static int
+zio_queue_read(int file, off_t location, size_t length)
+{
+    Zio_Ring *ring = &prefetch_ring;
+    struct io_uring_sqe *sqe;
+    unsigned tail;
+
+    while (0 < length) {
+	if (ZIO_PREFETCH_QUEUE_DEPTH <= ring->queued + ring->in_flight) {
+	    if (zio_enter_ring(1) < 0)
+		return -1;
+	    continue;
+	}
+	tail = *ring->sq_tail;
+	sqe = ring->sqes + (tail & *ring->sq_mask);
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = file;
+	sqe->off = location;
+	sqe->addr = (unsigned long) &prefetch_iovec;
+	sqe->len = 1;
+	ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->queued++;
+
+	if (length <= ZIO_PREFETCH_READ_SIZE)
+	    break;
+	location += ZIO_PREFETCH_READ_SIZE;
+	length -= ZIO_PREFETCH_READ_SIZE;
+    }
+
+    return 0;
+}
+#endif
+
+
+/*
+ * Follow the reads of zio_read() on `zio', `length' bytes from
+ * `location' this time.  After ZIO_SEQUENTIAL_READS reads in a row,
+ * each starting where the last one ended, the data which follows is
+ * read ahead, half a window before the reader gets there: the kernel
+ * is asked to read a plain file, and compressed slices are
+ * uncompressed by the readahead thread.  Without pthread, only the
+ * compressed slices of an ebzip file are asked to the kernel.
+ */
+static void
+zio_follow_stream(Zio *zio, off_t location, size_t length)
+{
+    off_t next = location + length;
+    off_t window;
+    off_t start;
+    off_t end;
+#ifndef ENABLE_PTHREAD
+    off_t slice_location;
+    off_t next_slice_location;
+#endif
+
+    if (location == zio->sequential_location)
+	zio->sequential_count++;
+    else
+	zio->sequential_count = 0;
+    zio->sequential_location = next;
+    if (zio->sequential_count < ZIO_SEQUENTIAL_READS || zio->is_ebnet)
+	return;
+
+    if (zio->code == ZIO_PLAIN)
+	window = ZIO_READAHEAD_PLAIN_LENGTH;
+    else
+	window = (off_t) zio->slice_size * ZIO_READAHEAD_SLICES;
+    if (next + window / 2 <= zio->readahead_location)
+	return;
+    start = (next < zio->readahead_location) ? zio->readahead_location : next;
+    end = next + window;
+    if (zio->file_size < end)
+	end = zio->file_size;
+    zio->readahead_location = end;
+    if (end <= start)
+	return;
+
+    switch (zio->code) {
+    case ZIO_PLAIN:
+#ifdef POSIX_FADV_WILLNEED
+	posix_fadvise(zio->file, start, end - start, POSIX_FADV_WILLNEED);
+#endif
+	break;
+    case ZIO_EBZIP1:
+    case ZIO_EPWING:
+    case ZIO_EPWING6:
+#ifdef ENABLE_PTHREAD
+	zio_request_readahead(zio, start, end);
+#elif defined(POSIX_FADV_WILLNEED)
+	if (zio->code == ZIO_EBZIP1
+	    && zio_ebzip_slice_range(zio, start / zio->slice_size,
+		(end - 1) / zio->slice_size, &slice_location,
+		&next_slice_location) == 0) {
+	    posix_fadvise(zio->file, slice_location,
+		next_slice_location - slice_location, POSIX_FADV_WILLNEED);
+	}
+#endif
+	break;
+    default:
+	break;
+    }
+}
+
+
+/*
+ * If the slice of `zio' at `location' has been read ahead, make it the
+ * one in `cache_buffer' and return 1.  If it is being uncompressed,
+ * wait for it.  Otherwise return 0.
+ */
+static int
+zio_take_readahead(Zio *zio, off_t location)
+{
+#ifdef ENABLE_PTHREAD
+    Zio_Readahead_Slot *slot = NULL;
+    char *buffer;
+    int i;
+
+    pthread_mutex_lock(&readahead_mutex);
+    while (readahead_state == 1) {
+	for (i = 0; i < ZIO_READAHEAD_SLICES; i++) {
+	    if (readahead_slots[i].zio_id == zio->id
+		&& readahead_slots[i].location == location)
+		break;
+	}
+	if (i == ZIO_READAHEAD_SLICES)
+	    break;
+	if (readahead_slots[i].ready) {
+	    slot = readahead_slots + i;
+	    break;
+	}
+	pthread_cond_wait(&readahead_cond, &readahead_mutex);
+    }
+    if (slot != NULL) {
+	buffer = cache_buffer;
+	cache_buffer = slot->buffer;
+	slot->buffer = buffer;
+	slot->zio_id = ZIO_ID_NONE;
+    }
+    pthread_mutex_unlock(&readahead_mutex);
+
+    return slot != NULL;
+#else
+    return 0;
+#endif
+}
+
+
+#ifdef ENABLE_PTHREAD
+/*
+ * Ask the readahead thread to uncompress the slices of `zio' which
+ * start from `start' up to `end', starting the thread if needed.
+ */
+static void
+zio_request_readahead(Zio *zio, off_t start, off_t end)
+{
+    off_t first;
+    int i;
+
+    pthread_mutex_lock(&readahead_mutex);
+
+    if (readahead_state == 0) {
+	for (i = 0; i < ZIO_READAHEAD_SLICES; i++) {
+	    readahead_slots[i].zio_id = ZIO_ID_NONE;
+	    readahead_slots[i].buffer = (char *) malloc(ZIO_CACHE_BUFFER_SIZE);
+	    if (readahead_slots[i].buffer == NULL)
+		break;
+	}
+	if (!readahead_atfork && i == ZIO_READAHEAD_SLICES
+	    && pthread_atfork(zio_prepare_fork, zio_parent_fork,
+		zio_child_fork) == 0)
+	    readahead_atfork = 1;
+	if (readahead_atfork && i == ZIO_READAHEAD_SLICES
+	    && pthread_create(&readahead_thread, NULL, zio_readahead_main,
+		NULL) == 0) {
+	    readahead_state = 1;
+	} else {
+	    while (0 < i)
+		free(readahead_slots[--i].buffer);
+	    readahead_state = -1;
+	}
+    }
+
+    if (readahead_state == 1) {
+	/*
+	 * The slice holding `start' is being read already.  Slices
+	 * of an earlier request not uncompressed yet are kept.
+	 */
+	first = (start + zio->slice_size - 1) / zio->slice_size
+	    * zio->slice_size;
+	if (readahead_zio != zio || readahead_next < zio->sequential_location
+	    || first < readahead_next)
+	    readahead_next = first;
+	readahead_zio = zio;
+	readahead_end = end;
+	pthread_cond_broadcast(&readahead_cond);
+    }
+
+    pthread_mutex_unlock(&readahead_mutex);
+}
+
+
+/*
+ * Stop reading `zio' ahead, and drop its slices read ahead.  It is
+ * called before `zio' is closed.
+ */
+static void
+zio_cancel_readahead(Zio *zio)
+{
+    int i;
+
+    pthread_mutex_lock(&readahead_mutex);
+    if (readahead_zio == zio)
+	readahead_zio = NULL;
+    while (readahead_busy_zio == zio)
+	pthread_cond_wait(&readahead_cond, &readahead_mutex);
+    for (i = 0; i < ZIO_READAHEAD_SLICES; i++) {
+	if (readahead_slots[i].zio_id == zio->id)
+	    readahead_slots[i].zio_id = ZIO_ID_NONE;
+    }
+    pthread_mutex_unlock(&readahead_mutex);
+}
+
+
+/*
+ * Stop the readahead thread, and free its slices.
+ */
+static void
+zio_stop_readahead(void)
+{
+    int i;
+
+    pthread_mutex_lock(&readahead_mutex);
+    if (readahead_state != 1) {
+	pthread_mutex_unlock(&readahead_mutex);
+	return;
+    }
+    readahead_state = 2;
+    pthread_cond_broadcast(&readahead_cond);
+    pthread_mutex_unlock(&readahead_mutex);
+
+    pthread_join(readahead_thread, NULL);
+    for (i = 0; i < ZIO_READAHEAD_SLICES; i++)
+	free(readahead_slots[i].buffer);
+    readahead_zio = NULL;
+    readahead_state = 0;
+}
+
+
+/*
+ * Fork handlers.  The readahead thread is not in the child: the child
+ * drops the slices read ahead, finished or not, and starts a thread of
+ * its own if it reads ahead.
+ */
+static void
+zio_prepare_fork(void)
+{
+    pthread_mutex_lock(&readahead_mutex);
+}
+
+static void
+zio_parent_fork(void)
+{
+    pthread_mutex_unlock(&readahead_mutex);
+}
+
+static void
+zio_child_fork(void)
+{
+    int i;
+
+    if (readahead_state == 1) {
+	for (i = 0; i < ZIO_READAHEAD_SLICES; i++)
+	    free(readahead_slots[i].buffer);
+	readahead_state = 0;
+    }
+    readahead_zio = NULL;
+    readahead_busy_zio = NULL;
+    pthread_cond_init(&readahead_cond, NULL);
+    pthread_mutex_unlock(&readahead_mutex);
+}
+
+
+/*
+ * The readahead thread: uncompress the slices asked for, in order, into
+ * the free slots, or else the slot filled the longest ago.
+ */
+static void *
+zio_readahead_main(void *argument)
+{
+    Zio_Readahead_Slot *slot;
+    Zio *zio;
+    off_t location;
+    int victim = 0;
+    int result;
+    int i;
+
+    pthread_mutex_lock(&readahead_mutex);
+    for (;;) {
+	while (readahead_state == 1
+	    && (readahead_zio == NULL || readahead_end <= readahead_next))
+	    pthread_cond_wait(&readahead_cond, &readahead_mutex);
+	if (readahead_state != 1)
+	    break;
+
+	zio = readahead_zio;
+	location = readahead_next;
+	readahead_next += zio->slice_size;
+	if (zio->file_size <= location)
+	    continue;
+	for (i = 0; i < ZIO_READAHEAD_SLICES; i++) {
+	    if (readahead_slots[i].zio_id == zio->id
+		&& readahead_slots[i].location == location)
+		break;
+	}
+	if (i < ZIO_READAHEAD_SLICES)
+	    continue;
+
+	slot = NULL;
+	for (i = 0; i < ZIO_READAHEAD_SLICES; i++) {
+	    if (readahead_slots[i].zio_id == ZIO_ID_NONE) {
+		slot = readahead_slots + i;
+		break;
+	    }
+	}
+	if (slot == NULL) {
+	    slot = readahead_slots + victim;
+	    victim = (victim + 1) % ZIO_READAHEAD_SLICES;
+	}
+	slot->zio_id = zio->id;
+	slot->location = location;
+	slot->ready = 0;
+	readahead_busy_zio = zio;
+
+	/*
+	 * zio_uncompress_slice() reads with pread() and uses no global
+	 * data, so it runs beside the reader.
+	 */
+	pthread_mutex_unlock(&readahead_mutex);
+	result = zio_uncompress_slice(zio, location, slot->buffer);
+	pthread_mutex_lock(&readahead_mutex);
+
+	readahead_busy_zio = NULL;
+	if (result < 0)
+	    slot->zio_id = ZIO_ID_NONE;
+	else
+	    slot->ready = 1;
+	pthread_cond_broadcast(&readahead_cond);
+    }
+    pthread_mutex_unlock(&readahead_mutex);
+
+    return NULL;
+}
+#endif
+
+
+/*
+ * Map the shared slice cache file `file_name', creating it `size' bytes
+ * long if it doesn't exist (an existing file keeps its size).  Slices
+ * uncompressed by every process which maps the same file are cached
+ * there, so that the others need not uncompress them again.  Put the
+ * file on a memory file system such as /dev/shm.
+ *
+ * If it succeeds, 0 is returned.  Otherwise, -1 is returned, and
+ * slices are not shared.
+ */
+int
+zio_open_shared_cache(const char *file_name, size_t size)
+{
+#ifdef ENABLE_SHARED_CACHE
+    struct stat st;
+    size_t entry_count;
+    void *map;
+    int file;
+
+    LOG(("in: zio_open_shared_cache(file_name=%s, size=%ld)", file_name,
+	(long)size));
+
+    zio_close_shared_cache();
+
+    file = open(file_name, O_RDWR | O_CREAT | O_BINARY, 0600);
+    if (file < 0)
+	goto failed;
+    if (fstat(file, &st) < 0) {
+	close(file);
+	goto failed;
+    }
+    if (0 < st.st_size)
+	size = st.st_size;
+    else if (ftruncate(file, size) < 0) {
+	close(file);
+	goto failed;
+    }
+    if (size < sizeof(Zio_Shared_Header)
+	+ ZIO_SHARED_WAYS * (sizeof(Zio_Shared_Entry) + ZIO_SIZE_PAGE)) {
+	close(file);
+	goto failed;
+    }
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    close(file);
+    if (map == MAP_FAILED)
+	goto failed;
+
+    /*
+     * The number of entries follows from the size, so that processes
+     * creating the file at the same time agree on the header.
+     */
+    entry_count = (size - sizeof(Zio_Shared_Header))
+	/ (sizeof(Zio_Shared_Entry) + ZIO_SIZE_PAGE);
+    shared_header = (Zio_Shared_Header *) map;
+    if (memcmp(shared_header->magic, ZIO_SHARED_MAGIC, 8) != 0) {
+	memset(shared_header + 1, 0, entry_count * sizeof(Zio_Shared_Entry));
+	shared_header->page_size = ZIO_SIZE_PAGE;
+	shared_header->entry_count = entry_count;
+	memcpy(shared_header->magic, ZIO_SHARED_MAGIC, 8);
+    } else if (shared_header->page_size != ZIO_SIZE_PAGE
+	|| shared_header->entry_count != entry_count) {
+	munmap(map, size);
+	shared_header = NULL;
+	goto failed;
+    }
+    shared_size = size;
+    shared_entries = (Zio_Shared_Entry *) (shared_header + 1);
+    shared_pages = (char *) (shared_entries + entry_count);
+
+    LOG(("out: zio_open_shared_cache(entry_count=%ld) = %d",
+	(long)entry_count, 0));
+    return 0;
+
+    /*
+     * An error occurs...
+     */
+  failed:
+    LOG(("out: zio_open_shared_cache() = %d", -1));
+    return -1;
+#else
+    return -1;
+#endif
+}
+
+
+/*
+ * Unmap the shared slice cache.  The file is left for other processes.
+ */
+void
+zio_close_shared_cache(void)
+{
+#ifdef ENABLE_SHARED_CACHE
+    if (shared_header != NULL)
+	munmap(shared_header, shared_size);
+    shared_header = NULL;
+    shared_entries = NULL;
+    shared_pages = NULL;
+    shared_size = 0;
+#endif
+}
+
+
+#ifdef ENABLE_SHARED_CACHE
+/*
+ * Set the key of `zio' in the shared slice cache, from the identity of
+ * its file (device, inode, size and modification time) and the way it
+ * is compressed.  Plain files and S-EBXA files are not cached.
+ */
+static void
+zio_identify_shared(Zio *zio)
+{
+    struct stat st;
+    unsigned long long key;
+
+    zio->shared_key = 0;
+    if (zio->is_ebnet || fstat(zio->file, &st) < 0)
+	return;
+    if (zio->code != ZIO_EBZIP1 && zio->code != ZIO_EPWING
+	&& zio->code != ZIO_EPWING6)
+	return;
+
+    /*
+     * FNV-1a over the fields.
+     */
+    key = 14695981039346656037ULL;
+    key = (key ^ (unsigned long long) st.st_dev) * 1099511628211ULL;
+    key = (key ^ (unsigned long long) st.st_ino) * 1099511628211ULL;
+    key = (key ^ (unsigned long long) st.st_size) * 1099511628211ULL;
+    key = (key ^ (unsigned long long) st.st_mtime) * 1099511628211ULL;
+    key = (key ^ (unsigned long long) zio->code) * 1099511628211ULL;
+    key = (key ^ (unsigned long long) zio->slice_size) * 1099511628211ULL;
+    zio->shared_key = (key == 0) ? 1 : key;
+}
+
+
+/*
+ * The first entry of the shared slice cache the page of `key' at
+ * `location' may be in.
+ */
+static size_t
+zio_shared_bucket(unsigned long long key, off_t location)
+{
+    unsigned long long hash;
+
+    hash = (key ^ ((unsigned long long) location / ZIO_SIZE_PAGE))
+	* 0x9e3779b97f4a7c15ULL;
+    return (size_t) ((hash >> 16) % (shared_header->entry_count
+	- ZIO_SHARED_WAYS + 1));
+}
+
+
+/*
+ * Copy the slice of `zio' at `location' from the shared slice cache to
+ * `out_buffer'.  The cache is read without locks: a page being written
+ * meanwhile counts as a miss.
+ *
+ * It returns 1 if every page of the slice is cached, 0 otherwise.
+ */
+static int
+zio_get_shared_slice(Zio *zio, off_t location, char *out_buffer)
+{
+    Zio_Shared_Entry *entry;
+    off_t page_location;
+    unsigned int sequence;
+    unsigned int checksum;
+    size_t bucket;
+    int i;
+
+    if (shared_header == NULL || zio->shared_key == 0)
+	return 0;
+
+    for (page_location = location;
+	 page_location < location + zio->slice_size;
+	 page_location += ZIO_SIZE_PAGE) {
+	bucket = zio_shared_bucket(zio->shared_key, page_location);
+	for (i = 0; i < ZIO_SHARED_WAYS; i++) {
+	    entry = shared_entries + bucket + i;
+	    sequence = __atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE);
+	    if (sequence % 2 != 0
+		|| __atomic_load_n(&entry->key, __ATOMIC_RELAXED)
+		!= zio->shared_key
+		|| __atomic_load_n(&entry->location, __ATOMIC_RELAXED)
+		!= (unsigned long long) page_location)
+		continue;
+	    checksum = __atomic_load_n(&entry->checksum, __ATOMIC_RELAXED);
+	    memcpy(out_buffer + (page_location - location),
+		shared_pages + (bucket + i) * ZIO_SIZE_PAGE, ZIO_SIZE_PAGE);
+	    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+	    if (__atomic_load_n(&entry->sequence, __ATOMIC_RELAXED) == sequence
+		&& zio_shared_checksum(out_buffer + (page_location - location))
+		== checksum)
+		break;
+	}
+	if (i == ZIO_SHARED_WAYS)
+	    return 0;
+    }
+
+    return 1;
+}
+
+
+/*
+ * Put the slice of `zio' at `location', in `in_buffer', into the shared
+ * slice cache.  Each page goes into a free entry of its bucket, or else
+ * replaces one.  A page whose entries are all being written is not
+ * cached.
+ */
+static void
+zio_put_shared_slice(Zio *zio, off_t location, const char *in_buffer)
+{
+    Zio_Shared_Entry *entry;
+    const char *page;
+    off_t page_location;
+    unsigned int sequence;
+    unsigned int expected;
+    size_t bucket;
+    int victim;
+    int i;
+
+    if (shared_header == NULL || zio->shared_key == 0)
+	return;
+
+    for (page_location = location;
+	 page_location < location + zio->slice_size;
+	 page_location += ZIO_SIZE_PAGE) {
+	bucket = zio_shared_bucket(zio->shared_key, page_location);
+	victim = (int) ((page_location / ZIO_SIZE_PAGE) % ZIO_SHARED_WAYS);
+	for (i = 0; i < ZIO_SHARED_WAYS; i++) {
+	    entry = shared_entries + bucket + i;
+	    if (__atomic_load_n(&entry->key, __ATOMIC_RELAXED) == 0) {
+		victim = i;
+		break;
+	    }
+	}
+
+	/*
+	 * The free or victim entry first, then the other ways, until
+	 * one is not being written.
+	 */
+	for (i = 0; i < ZIO_SHARED_WAYS; i++) {
+	    entry = shared_entries + bucket + (victim + i) % ZIO_SHARED_WAYS;
+	    if (zio_claim_shared_entry(entry, &sequence))
+		break;
+	}
+	if (i == ZIO_SHARED_WAYS)
+	    continue;
+	page = in_buffer + (page_location - location);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&entry->claimed, (unsigned long long) time(NULL),
+	    __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->key, zio->shared_key, __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->location, (unsigned long long) page_location,
+	    __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->checksum, zio_shared_checksum(page),
+	    __ATOMIC_RELAXED);
+	memcpy(shared_pages + (entry - shared_entries) * ZIO_SIZE_PAGE, page,
+	    ZIO_SIZE_PAGE);
+
+	/*
+	 * If the entry has been taken over meanwhile, it is the other
+	 * writer's to release.
+	 */
+	expected = sequence + 1;
+	__atomic_compare_exchange_n(&entry->sequence, &expected, sequence + 2,
+	    0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+}
+
+
+/*
+ * Start writing `entry' of the shared slice cache: make its sequence
+ * odd, and put the even sequence it had in `sequence'.  An entry odd for
+ * ZIO_SHARED_STALE_SECONDS, left so by a writer that died, is taken
+ * over.
+ *
+ * It returns 1 if the entry is claimed, 0 if another writer has it.
+ */
+static int
+zio_claim_shared_entry(Zio_Shared_Entry *entry, unsigned int *sequence)
+{
+    unsigned int current;
+
+    current = __atomic_load_n(&entry->sequence, __ATOMIC_RELAXED);
+    if (current % 2 != 0) {
+	if ((unsigned long long) time(NULL)
+	    < __atomic_load_n(&entry->claimed, __ATOMIC_RELAXED)
+	    + ZIO_SHARED_STALE_SECONDS)
+	    return 0;
+	if (!__atomic_compare_exchange_n(&entry->sequence, &current,
+	    current + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	    return 0;
+	current++;
+    }
+    if (!__atomic_compare_exchange_n(&entry->sequence, &current,
+	current + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	return 0;
+    *sequence = current;
+    return 1;
+}
+
+
+/*
+ * Checksum of a page of the shared slice cache (FNV-1a over 32-bit
+ * words).
+ */
+static unsigned int
+zio_shared_checksum(const char *page)
+{
+    unsigned int checksum = 2166136261u;
+    unsigned int word;
+    int i;
+
+    for (i = 0; i < ZIO_SIZE_PAGE; i += sizeof(word)) {
+	memcpy(&word, page + i, sizeof(word));
+	checksum = (checksum ^ word) * 16777619u;
+    }
+    return checksum;
+}
+#endif
+
+
+/*
+ * Set the directory of uncompressed mirrors of compressed files, or
+ * none if `directory' is NULL.  A compressed (ebzip or EPWING) file
+ * opened afterwards is read from its mirror there, as a plain file, if
+ * zio_write_mirror() has written one for the file as it is now.
+ *
+ * If it succeeds, 0 is returned.  Otherwise, -1 is returned.
+ */
+int
+zio_set_mirror_directory(const char *directory)
+{
+    LOG(("in: zio_set_mirror_directory(directory=%s)",
+	(directory != NULL) ? directory : "(null)"));
+
+    if (mirror_directory != NULL)
+	free(mirror_directory);
+    mirror_directory = NULL;
+    if (directory != NULL) {
+	mirror_directory = (char *) malloc(strlen(directory) + 1);
+	if (mirror_directory == NULL)
+	    goto failed;
+	strcpy(mirror_directory, directory);
+    }
+
+    LOG(("out: zio_set_mirror_directory() = %d", 0));
+    return 0;
+
+    /*
+     * An error occurs...
+     */
+  failed:
+    LOG(("out: zio_set_mirror_directory() = %d", -1));
+    return -1;
+}
+
+
+/*
+ * Write the uncompressed mirror of `zio', a compressed file, to the
+ * mirror directory, then read `zio' from it.  Nothing is written if the
+ * mirror is there already.
+ *
+ * If it succeeds, 0 is returned.  Otherwise, -1 is returned, and
+ * `zio' is read as before.
+ */
+int
+zio_write_mirror(Zio *zio)
+{
+    char path[PATH_MAX + 1];
+    char temporary_path[PATH_MAX + 8];
+    char buffer[ZIO_CACHE_BUFFER_SIZE];
+    struct stat st;
+    off_t location;
+    ssize_t read_length;
+    int file = -1;
+
+    LOG(("in: zio_write_mirror(zio=%d)", (int)zio->id));
+
+    if (zio->mirror_code != ZIO_INVALID)
+	goto succeeded;
+    if (zio->file < 0 || zio->is_ebnet || mirror_directory == NULL)
+	goto failed;
+    if (zio->code != ZIO_EBZIP1 && zio->code != ZIO_EPWING
+	&& zio->code != ZIO_EPWING6)
+	goto failed;
+    zio_open_mirror(zio);
+    if (zio->mirror_code != ZIO_INVALID)
+	goto succeeded;
+    if (fstat(zio->file, &st) < 0 || zio_mirror_path(zio, &st, path) < 0)
+	goto failed;
+
+    /*
+     * Each writer has a temporary file of its own, so that processes
+     * mirroring the same file at once don't write over one another.
+     */
+    sprintf(temporary_path, "%s.XXXXXX", path);
+    file = mkstemp(temporary_path);
+    if (file < 0)
+	goto failed;
+    if (fchmod(file, 0644) < 0)
+	goto failed;
+    for (location = 0; location < zio->file_size; location += read_length) {
+	read_length = zio_pread(zio, buffer, sizeof(buffer), location);
+	if (read_length <= 0)
+	    goto failed;
+	if (write(file, buffer, read_length) != read_length)
+	    goto failed;
+    }
+    if (close(file) < 0) {
+	file = -1;
+	unlink(temporary_path);
+	goto failed;
+    }
+    file = -1;
+    if (rename(temporary_path, path) < 0) {
+	unlink(temporary_path);
+	goto failed;
+    }
+
+    if (zio_open_mirror(zio) < 0 || zio->mirror_code == ZIO_INVALID)
+	goto failed;
+
+  succeeded:
+    LOG(("out: zio_write_mirror() = %d", 0));
+    return 0;
+
+    /*
+     * An error occurs...
+     */
+  failed:
+    if (0 <= file) {
+	close(file);
+	unlink(temporary_path);
+    }
+    LOG(("out: zio_write_mirror() = %d", -1));
+    return -1;
+}
+
+
+/*
+ * Get the size and the modification time of the file `zio' has opened,
+ * in `st->st_size' and `st->st_mtime'.  They are those of the
+ * compressed file when `zio' reads its mirror.
+ *
+ * If it succeeds, 0 is returned.  Otherwise, -1 is returned.
+ */
+int
+zio_source_status(Zio *zio, struct stat *st)
+{
+    if (zio->file < 0 || zio->is_ebnet || fstat(zio->file, st) < 0)
+	return -1;
+    if (zio->mirror_code != ZIO_INVALID) {
+	st->st_size = zio->source_size;
+	st->st_mtime = zio->source_mtime;
+    }
+    return 0;
+}
+
+
+/*
+ * Put the path of the mirror of `zio' into `path'.  The name stands for
+ * the compressed file as `source_status' gives it (device, inode, size
+ * and modification time), so that a changed file has no mirror.
+ *
+ * If it succeeds, 0 is returned.  Otherwise, -1 is returned.
+ */
+static int
+zio_mirror_path(Zio *zio, const struct stat *source_status, char *path)
+{
+    char name[80];
+
+    sprintf(name, "%llx-%llx-%llx-%llx-%d",
+	(unsigned long long) source_status->st_dev,
+	(unsigned long long) source_status->st_ino,
+	(unsigned long long) source_status->st_size,
+	(unsigned long long) source_status->st_mtime, (int)zio->code);
+    if (PATH_MAX < strlen(mirror_directory) + 1 + strlen(name))
+	return -1;
+    sprintf(path, "%s/%s", mirror_directory, name);
+    return 0;
+}
+
+
+/*
+ * If `zio', just opened, is a compressed file whose mirror is in the
+ * mirror directory, read it from the mirror instead: the compressed
+ * file is closed, and the mirror is mapped (or read with pread() if it
+ * can't be) as a plain file.  A mirror whose size is not the size of
+ * the uncompressed file is ignored.
+ *
+ * It returns the file descriptor of `zio'.
+ */
+static int
+zio_open_mirror(Zio *zio)
+{
+    char path[PATH_MAX + 1];
+    struct stat source_status;
+    struct stat st;
+    int file;
+
+    if (mirror_directory == NULL || zio->is_ebnet)
+	return zio->file;
+    if (zio->code != ZIO_EBZIP1 && zio->code != ZIO_EPWING
+	&& zio->code != ZIO_EPWING6)
+	return zio->file;
+    if (fstat(zio->file, &source_status) < 0
+	|| zio_mirror_path(zio, &source_status, path) < 0)
+	return zio->file;
+
+    file = open(path, O_RDONLY | O_BINARY);
+    if (file < 0)
+	return zio->file;
+    if (fstat(file, &st) < 0 || st.st_size != zio->file_size) {
+	close(file);
+	return zio->file;
+    }
+
+    LOG(("aux: zio_open_mirror(zio=%d, path=%s)", (int)zio->id, path));
+    pthread_mutex_lock(&zio_mutex);
+#ifdef ENABLE_PTHREAD
+    zio_cancel_readahead(zio);
+#endif
+    if (cache_zio_id == zio->id)
+	cache_zio_id = ZIO_ID_NONE;
+    zio_close_raw(zio);
+    zio->file = file;
+    zio->mirror_code = zio->code;
+    zio->code = ZIO_PLAIN;
+    zio->source_size = source_status.st_size;
+    zio->source_mtime = source_status.st_mtime;
+    zio->shared_key = 0;
+#ifdef HAVE_MMAP
+    if (0 < zio->file_size) {
+	zio->map = (char *) mmap(NULL, zio->file_size, PROT_READ, MAP_SHARED,
+	    file, 0);
+	if (zio->map == (char *) MAP_FAILED)
+	    zio->map = NULL;
+	else
+	    zio->map_size = zio->file_size;
+    }
+#endif
+    pthread_mutex_unlock(&zio_mutex);
+
+    return zio->file;
+}
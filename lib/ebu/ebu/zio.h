@@ -34,6 +34,7 @@ extern "C" {
 #endif
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <time.h>
 
 /*
@@ -132,7 +133,8 @@ struct Zio_Struct {
     int file;
 
     /*
-     * Current location.
+     * Current location of zio_lseek() and zio_read(). (Not the file
+     * offset of `file', which zio never moves)
      */
     off_t location;
 
@@ -211,8 +213,58 @@ struct Zio_Struct {
      * ebnet mode flag.
      */
     int is_ebnet;
+
+    /*
+     * Key of the file in the shared slice cache (0 if not cached there).
+     */
+    unsigned long long shared_key;
+
+    /*
+     * The file mapped, and the length mapped.  (Uncompressed mirrors
+     * only)
+     */
+    char *map;
+    size_t map_size;
+
+    /*
+     * Compression of the file mirrored (ZIO_INVALID if `zio' doesn't
+     * read a mirror), and its size and modification time.
+     */
+    Zio_Code mirror_code;
+    off_t source_size;
+    time_t source_mtime;
+
+    /*
+     * End of the last read of zio_read(), number of reads in a row
+     * which started there, and end of the data read ahead.
+     */
+    off_t sequential_location;
+    int sequential_count;
+    off_t readahead_location;
+};
+
+/*
+ * A reader of a zio, at a location of its own.
+ */
+typedef struct Zio_Cursor_Struct Zio_Cursor;
+
+struct Zio_Cursor_Struct {
+    /*
+     * Zio read.
+     */
+    Zio *zio;
+
+    /*
+     * Current location.
+     */
+    off_t location;
 };
 
+/*
+ * Function called on reads of zio files.
+ */
+typedef void (*Zio_Trace_Function)(Zio *zio, off_t location, size_t length);
+
 /*
  * Function declarations.
  */
@@ -229,6 +281,18 @@ int zio_file(Zio *zio);
 Zio_Code zio_mode(Zio *zio);
 off_t zio_lseek(Zio *zio, off_t offset, int whence);
 ssize_t zio_read(Zio *zio, char *buffer, size_t length);
+ssize_t zio_pread(Zio *zio, char *buffer, size_t length, off_t location);
+void zio_set_trace_function(Zio_Trace_Function function);
+void zio_cursor_initialize(Zio_Cursor *cursor, Zio *zio);
+off_t zio_cursor_lseek(Zio_Cursor *cursor, off_t location, int whence);
+ssize_t zio_cursor_read(Zio_Cursor *cursor, char *buffer, size_t length);
+void zio_prefetch(Zio *zio, off_t location, size_t length);
+void zio_submit_prefetch(int wait);
+int zio_open_shared_cache(const char *file_name, size_t size);
+void zio_close_shared_cache(void);
+int zio_set_mirror_directory(const char *directory);
+int zio_write_mirror(Zio *zio);
+int zio_source_status(Zio *zio, struct stat *st);
 
 #ifdef __cplusplus
 }
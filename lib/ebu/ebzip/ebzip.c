@@ -46,7 +46,7 @@ const char *invoked_name;
 /*
  * Command line options.
  */
-static const char *short_options = "fhikl:no:qs:S:tT:uvw:zr:";
+static const char *short_options = "fhikl:no:p:qs:S:tT:uvw:zr:";
 static struct option long_options[] = {
     {"force-overwrite",   no_argument,       NULL, 'f'},
     {"help",              no_argument,       NULL, 'h'},
@@ -55,6 +55,7 @@ static struct option long_options[] = {
     {"level",             required_argument, NULL, 'l'},
     {"no-overwrite",      no_argument,       NULL, 'n'},
     {"output-directory",  required_argument, NULL, 'o'},
+    {"profile",           required_argument, NULL, 'p'},
     {"quiet",             no_argument,       NULL, 'q'},
     {"silent",            no_argument,       NULL, 'q'},
     {"skip-content",      required_argument, NULL, 's'},
@@ -106,6 +107,11 @@ int ebzip_skip_flag_sound   = EBZIP_DEFAULT_SKIP_SOUND;
  */
 int ebzip_slice_number = EBZIP_DEFAULT_SLICE_NUMBER;
 
+/*
+ * Access profile which gives the regions not to compress, if any.
+ */
+const char *ebzip_profile_file_name = NULL;
+
 /*
  * List of files to be unlinked.
  */
@@ -299,6 +305,14 @@ main(int argc, char *argv[])
 	    }
 	    break;
 
+        case 'p':
+            /*
+             * Option `-p'.  Leave the regions the access profile FILE
+             * lists uncompressed.
+             */
+	    ebzip_profile_file_name = optarg;
+	    break;
+
         case 'q':
             /*
              * Option `-q'.  Set quiet flag.
@@ -587,6 +601,9 @@ output_help(void)
     printf(_("                             ouput files under DIRECTORY\n"));
     printf(_("                             (default: %s)\n"),
 	EBZIP_DEFAULT_OUTPUT_DIRECTORY);
+    printf(_("  -p FILE  --profile FILE    leave the regions read most often, listed in\n"));
+    printf(_("                             the access profile FILE, uncompressed, and\n"));
+    printf(_("                             compress the others at the best level\n"));
     printf(_("  -q  --quiet  --silence     suppress all warnings\n"));
     printf(_("  -s TYPE[,TYPE]  --skip-content TYPE[,TYPE...]\n"));
     printf(_("                             skip content; font, graphic, sound or movie\n"));
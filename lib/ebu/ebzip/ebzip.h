@@ -188,6 +188,12 @@ typedef struct {
 typedef struct {
     int region_count;
     Zip_Speedup_Region regions[EBZIP_MAX_SPEEDUP_REGION_COUNT];
+
+    /*
+     * Regions read most often, given by the access profile.
+     */
+    int hot_region_count;
+    Zip_Speedup_Region *hot_regions;
 } Zip_Speedup;
 
 
@@ -211,6 +217,8 @@ extern int ebzip_skip_flag_sound;
 
 extern int ebzip_slice_number;
 
+extern const char *ebzip_profile_file_name;
+
 extern String_List unlinking_files;
 
 /*
@@ -268,6 +276,8 @@ void ebzip_initialize_zip_speedup(Zip_Speedup *speedup);
 void ebzip_finalize_zip_speedup(Zip_Speedup *speedup);
 int ebzip_set_zip_speedup(Zip_Speedup *speedup, const char *file_name,
     Zio_Code zio_code, int index_page);
+int ebzip_add_profile_speedup(Zip_Speedup *speedup, const char *book_path,
+    const char *subbook_directory);
 int ebzip_is_speedup_slice(Zip_Speedup *speedup, int slice, int zip_level);
 
 /* unlinkfile.c */
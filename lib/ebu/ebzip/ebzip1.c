@@ -67,8 +67,9 @@ ebzip1_slice(char *out_buffer, size_t *out_byte_length, char *in_buffer,
     stream.zfree = Z_NULL;
     stream.opaque = Z_NULL;
 
-    if (deflateInit(&stream, ebzip_level > 3
-		    ? Z_BEST_COMPRESSION : Z_DEFAULT_COMPRESSION) != Z_OK)
+    if (deflateInit(&stream,
+	    ebzip_level > 3 || ebzip_profile_file_name != NULL
+	    ? Z_BEST_COMPRESSION : Z_DEFAULT_COMPRESSION) != Z_OK)
 	return -1;
 
     stream.next_in = (Bytef *) in_buffer;
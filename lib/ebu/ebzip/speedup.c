@@ -42,6 +42,8 @@ void
 ebzip_initialize_zip_speedup(Zip_Speedup *speedup)
 {
     speedup->region_count = 0;
+    speedup->hot_region_count = 0;
+    speedup->hot_regions = NULL;
 }
 
 
@@ -52,6 +54,10 @@ void
 ebzip_finalize_zip_speedup(Zip_Speedup *speedup)
 {
     speedup->region_count = 0;
+    if (speedup->hot_regions != NULL)
+	free(speedup->hot_regions);
+    speedup->hot_region_count = 0;
+    speedup->hot_regions = NULL;
 }
 
 
@@ -147,20 +153,128 @@ ebzip_set_zip_speedup(Zip_Speedup *speedup, const char *file_name,
 
 
 /*
- * Check if `slice' is lain in/over/across a speedup region.
+ * Compare start pages of regions, for qsort().
+ */
+static int
+ebzip_compare_regions(const void *region1, const void *region2)
+{
+    const Zip_Speedup_Region *r1 = (const Zip_Speedup_Region *) region1;
+    const Zip_Speedup_Region *r2 = (const Zip_Speedup_Region *) region2;
+
+    if (r1->start_page != r2->start_page)
+	return (r1->start_page < r2->start_page) ? -1 : 1;
+    return 0;
+}
+
+
+/*
+ * Add the regions of the subbook `subbook_directory' of the book at
+ * `book_path' which the access profile lists, if any, to `speedup'.
+ * Each line of the profile is
+ *
+ *     <book directory name> <subbook directory name> <start page> <end page>
+ *
+ * as ebclient writes it.  Lines starting with `#' are ignored.
+ *
+ * If it succeeds, 0 is returned.  Otherwise -1 is returned.
  */
 int
-ebzip_is_speedup_slice(Zip_Speedup *speedup, int slice, int ebzip_level)
+ebzip_add_profile_speedup(Zip_Speedup *speedup, const char *book_path,
+    const char *subbook_directory)
 {
-    Zip_Speedup_Region *p;
+    char line[PATH_MAX + 64];
+    char book_name[PATH_MAX + 1];
+    char subbook_name[PATH_MAX + 1];
+    const char *base_name;
+    Zip_Speedup_Region *regions;
     int start_page;
     int end_page;
+    int region_max;
     int i;
+    FILE *file;
 
-    start_page = slice * (1 << ebzip_level) + 1;
-    end_page = (slice + 1) * (1 << ebzip_level);
+    if (ebzip_profile_file_name == NULL)
+	return 0;
+    region_max = speedup->hot_region_count;
+
+    base_name = strrchr(book_path, '/');
+    base_name = (base_name == NULL) ? book_path : base_name + 1;
+
+    file = fopen(ebzip_profile_file_name, "r");
+    if (file == NULL) {
+	fprintf(stderr, _("%s: failed to open the file: %s\n"),
+	    invoked_name, ebzip_profile_file_name);
+	return -1;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+	if (line[0] == '#')
+	    continue;
+	if (sscanf(line, "%s %s %d %d", book_name, subbook_name, &start_page,
+	    &end_page) != 4)
+	    continue;
+	if (strcasecmp(book_name, base_name) != 0
+	    || strcasecmp(subbook_name, subbook_directory) != 0
+	    || start_page <= 0 || end_page < start_page)
+	    continue;
+	if (region_max <= speedup->hot_region_count) {
+	    region_max = (region_max == 0) ? 64 : region_max * 2;
+	    regions = (Zip_Speedup_Region *) realloc(speedup->hot_regions,
+		sizeof(Zip_Speedup_Region) * region_max);
+	    if (regions == NULL) {
+		fprintf(stderr, _("%s: memory exhausted\n"), invoked_name);
+		fclose(file);
+		return -1;
+	    }
+	    speedup->hot_regions = regions;
+	}
+	speedup->hot_regions[speedup->hot_region_count].start_page
+	    = start_page;
+	speedup->hot_regions[speedup->hot_region_count].end_page = end_page;
+	speedup->hot_region_count++;
+    }
+    fclose(file);
+
+    /*
+     * Sort the regions and merge those which overlap or touch, so that
+     * ebzip_is_speedup_slice() may search them.
+     */
+    if (0 < speedup->hot_region_count) {
+	qsort(speedup->hot_regions, speedup->hot_region_count,
+	    sizeof(Zip_Speedup_Region), ebzip_compare_regions);
+	regions = speedup->hot_regions;
+	region_max = 1;
+	for (i = 1; i < speedup->hot_region_count; i++) {
+	    if (regions[i].start_page <= regions[region_max - 1].end_page + 1) {
+		if (regions[region_max - 1].end_page < regions[i].end_page)
+		    regions[region_max - 1].end_page = regions[i].end_page;
+	    } else {
+		regions[region_max++] = regions[i];
+	    }
+	}
+	speedup->hot_region_count = region_max;
+    }
+
+    if (!ebzip_quiet_flag && 0 < speedup->hot_region_count) {
+	fprintf(stderr, _("%d regions of the profile are not compressed\n"),
+	    speedup->hot_region_count);
+	fflush(stderr);
+    }
 
-    for (i = 0, p = speedup->regions; i < speedup->region_count; i++, p++) {
+    return 0;
+}
+
+
+/*
+ * Check if the pages from `start_page' to `end_page' are lain
+ * in/over/across one of `regions'.
+ */
+static int
+ebzip_is_region_pages(Zip_Speedup_Region *regions, int region_count,
+    int start_page, int end_page)
+{
+    int i;
+
+    for (i = 0; i < region_count; i++) {
 	/*
 	 *          speedup region
 	 *        +================+
@@ -168,8 +282,8 @@ ebzip_is_speedup_slice(Zip_Speedup *speedup, int slice, int ebzip_level)
 	 *  or  o-----------------------o
 	 *     
 	 */
-	if (start_page <= speedup->regions[i].start_page
-	    && speedup->regions[i].start_page <= end_page)
+	if (start_page <= regions[i].start_page
+	    && regions[i].start_page <= end_page)
 	    return 1;
 
 	/*
@@ -178,8 +292,8 @@ ebzip_is_speedup_slice(Zip_Speedup *speedup, int slice, int ebzip_level)
 	 *                    o------o
 	 *  or  o--------------------o
 	 */
-	if (start_page <= speedup->regions[i].end_page
-	    && speedup->regions[i].end_page <= end_page)
+	if (start_page <= regions[i].end_page
+	    && regions[i].end_page <= end_page)
 	    return 1;
 
 	/*
@@ -187,10 +301,47 @@ ebzip_is_speedup_slice(Zip_Speedup *speedup, int slice, int ebzip_level)
 	 *        +================+
 	 *            o--------o
 	 */
-	if (speedup->regions[i].start_page <= start_page
-	    && end_page <= speedup->regions[i].end_page)
+	if (regions[i].start_page <= start_page
+	    && end_page <= regions[i].end_page)
 	    return 1;
     }
 
     return 0;
 }
+
+
+/*
+ * Check if `slice' is lain in/over/across a speedup region, or a region
+ * of the access profile.
+ */
+int
+ebzip_is_speedup_slice(Zip_Speedup *speedup, int slice, int ebzip_level)
+{
+    int start_page;
+    int end_page;
+    int low;
+    int high;
+    int middle;
+
+    start_page = slice * (1 << ebzip_level) + 1;
+    end_page = (slice + 1) * (1 << ebzip_level);
+
+    if (ebzip_is_region_pages(speedup->regions, speedup->region_count,
+	start_page, end_page))
+	return 1;
+
+    /*
+     * The profile regions are sorted and don't overlap: only the last
+     * one starting before `end_page' may reach the slice.
+     */
+    low = 0;
+    high = speedup->hot_region_count;
+    while (low < high) {
+	middle = low + (high - low) / 2;
+	if (speedup->hot_regions[middle].start_page <= end_page)
+	    low = middle + 1;
+	else
+	    high = middle;
+    }
+    return 0 < low && start_page <= speedup->hot_regions[low - 1].end_page;
+}
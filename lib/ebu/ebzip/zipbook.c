@@ -193,6 +193,9 @@ ebzip_zip_book_eb(EB_Book *book, const char *out_top_path,
 	    if (ebzip_set_zip_speedup(&speedup, in_path_name, in_zio_code,
 		subbook->index_page) < 0)
 		goto failed;
+	    if (ebzip_add_profile_speedup(&speedup, book->path,
+		subbook->directory_name) < 0)
+		goto failed;
 	    if (ebzip_zip_start_file(out_path_name, in_path_name, in_zio_code,
 		subbook->index_page, &speedup) < 0)
 		goto failed;
@@ -327,6 +330,9 @@ ebzip_zip_book_epwing(EB_Book *book, const char *out_top_path,
 	    if (ebzip_set_zip_speedup(&speedup, in_path_name, in_zio_code,
 		subbook->index_page) < 0)
 		goto failed;
+	    if (ebzip_add_profile_speedup(&speedup, book->path,
+		subbook->directory_name) < 0)
+		goto failed;
 	    if (ebzip_zip_file(out_path_name, in_path_name, in_zio_code,
 		&speedup) < 0)
 		goto failed;
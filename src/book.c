@@ -1,13 +1,41 @@
 
 #include <stdio.h>
+#include <unistd.h>
+#include <time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/inotify.h>
 #include <dirent.h>
 #include <linux/limits.h>
+#include <ebu/binary.h>
 
 #include "book.h"
 #include "conv.h"
+#include "entries.h"
+#include "fulltext.h"
+#include "fuzzy.h"
+#include "suffix.h"
 
 #define MAX_HITS 100
+#define MAX_QUERY_HITS 10000 // hits output by one book_query, read MAX_HITS at a time
+#define PREFETCH_TEXT_SIZE 4096 // bytes of the text of a hit read ahead
+#define PREFETCH_HEADING_SIZE 256 // bytes of the heading of a hit read ahead
+#define MAX_SEARCH_WORD 255 // bytes of a word of keyword / cross / multi search
+#define MAX_BATCH_WORDS 1024
+#define MAX_BATCH_POSITIONS 1024
+#define MAX_REFERENCES 256 // references collected from one entry
+#define REFERENCE_CACHE_SIZE 4096 // slots of the reference target heading cache
+#define ENTRY_LINK_CACHE_SIZE 16384 // slots of the entry neighbor cache
+#define MAX_NEIGHBORS 100 // entries before / after a position
+#define GAIJI_CACHE_SIZE 4096 // slots of the gaiji png cache
+#define MAX_ATLAS_GLYPHS 8192 // glyphs of a gaiji atlas
+#define ATLAS_COLUMNS 32 // glyphs per row of a gaiji atlas
+#define PROBE_SIZE 65536 // bytes of a color graphic read to find its dimensions
+#define MAX_FULLTEXT_QUERY 256 // chars of a full text query
+#define FULLTEXT_BATCH 256 // candidates verified at a time
+#define MAX_SEGMENT_CHARS 256 // chars of the text to segment
+#define MAX_SEGMENT_WORD_CHARS 32 // longest headword tried at a position
 #define MAXLEN_HEADING 255
 #define MAXLEN_TEXT 65535
 
@@ -15,10 +43,22 @@ typedef struct book_node {
   book_t* book;
   char* title;
   int subbook_index;
-  struct book_node_t* next;
+  entry_index_t* entries; // NULL if there is no usable sidecar
+  int entries_opened; // whether the sidecar was looked for
+  heading_index_t* headings; // same for the text -> heading index
+  int headings_opened;
+  fulltext_index_t* fulltext; // same for the full text index
+  int fulltext_opened;
+  suffix_index_t* suffixes; // same as entries, for the headword suffix array
+  int suffixes_opened;
+  fuzzy_trie_t* words; // same, for the trie of the headwords searched by book_fuzzy
+  int words_opened;
+  uint64_t key; // see node_key, 0 until computed
+  struct book_node* next;
 } book_node_t;
 
 book_t* current_bookw;
+book_node_t* current_node;
 EB_Hookset hookset;
 EB_Hookset hookset_header;
 char xpath[32] = {0};
@@ -28,16 +68,20 @@ char text[MAXLEN_TEXT+1];
 char buf[128]; // general temp buf
 char buf_color[EB_MAX_COLOR_VALUE_LENGTH + 1];
 char buf_gaiji[10];
-char buf_gaiji_narrow_bitmap[EB_SIZE_NARROW_FONT_16];
-char buf_gaiji_wide_bitmap[EB_SIZE_WIDE_FONT_16];
 char buf_binary[1024*1024*16]; // 32MB max
 int hit_count;
 ssize_t heading_length;
 ssize_t text_length;
 EB_Hit hits[MAX_HITS];
-int hits_index_sorted[MAX_HITS];
+unsigned int normalized[MAXLEN_TEXT + 1]; // code points of a text, for full text search
+EB_Position references[MAX_REFERENCES]; // targets of references in the entry being rendered
+int reference_count;
+int collect_references = 0;
 book_node_t* books = NULL;
 size_t books_count = 0;
+char books_rootpath[PATH_MAX] = {0};
+int books_watch_fd = -1;
+char entries_dir[PATH_MAX] = {0}; // where entry index sidecars live, empty if disabled
 char in[3] = {0};
 
 #define EUC_TO_ASCII_TABLE_START        0xa0
@@ -84,7 +128,7 @@ EB_Book* select_book(int index) {
       current = current->next;
     index--;
   }
-  if( current == NULL )
+  if( current == NULL || current->book == NULL ) // out of range or retired
     return NULL;
 
   bookw = current->book;
@@ -99,6 +143,7 @@ EB_Book* select_book(int index) {
   }
 
   current_bookw = bookw;
+  current_node = current;
   return book;
 }
 
@@ -114,6 +159,23 @@ char* convert_from_internal_encoding(EB_Book* book, char* s) {
   return s;
 }
 
+// utf-8 of a word as stored in a word index (not null terminated). JIS X 0208 books store JIS
+// codes, i.e. EUC without the high bits
+char* index_word_to_utf8(EB_Book* book, const char* word, size_t length) {
+  static char s[MAXLEN_HEADING + 1];
+  size_t i;
+
+  if( length > MAXLEN_HEADING )
+    length = MAXLEN_HEADING;
+  memcpy(s, word, length);
+  s[length] = '\0';
+  if( book->character_code == EB_CHARCODE_JISX0208 ) {
+    for( i = 0; i < length; i++ )
+      s[i] |= 0x80;
+  }
+  return convert_from_internal_encoding(book, s);
+}
+
 EB_Error_Code hook_iso8859(EB_Book *book, EB_Appendix *appendix, void *container,
   EB_Hook_Code hook_code, int argc, const unsigned int *argv) {
   in[0] = argv[0];
@@ -252,6 +314,12 @@ EB_Error_Code hook_general(EB_Book *book, EB_Appendix *appendix, void *container
     case 0x1f62:
       sprintf(buf, "[/reference page=%d,offset=%d]", argv[1], argv[2]);
       eb_write_text_string(book, buf);
+      if( collect_references && reference_count < MAX_REFERENCES ) {
+        // headings are resolved after the entry, reading them here would break the text context
+        references[reference_count].page = argv[1];
+        references[reference_count].offset = argv[2];
+        reference_count++;
+      }
       break;
     default:
       break;
@@ -324,10 +392,6 @@ EB_Error_Code hook_wav(EB_Book *book, EB_Appendix *appendix, void *container,
 }
 
 void books_init(const char* rootpath) {
-  DIR *dp;
-  struct dirent *ep;     
-  char path[PATH_MAX] = {0};
-
   eb_initialize_library();
   eb_initialize_hookset(&hookset);
   eb_initialize_hookset(&hookset_header);
@@ -375,31 +439,432 @@ void books_init(const char* rootpath) {
   hookset_header.hooks[EB_HOOK_BEGIN_EMPHASIS].function= hook_general;
   hookset_header.hooks[EB_HOOK_END_EMPHASIS].function= hook_general;
 
-  dp = opendir(rootpath);
+  strncpy(books_rootpath, rootpath, sizeof(books_rootpath) - 1);
+  srandom(time(NULL) ^ getpid());
+  books_scan();
+}
+
+// whether a live book is bound from path
+int book_is_loaded(const char* path) {
+  book_node_t* current;
+  for( current = books; current != NULL; current = current->next ) {
+    if( current->book != NULL && strcmp(current->book->path, path) == 0 )
+      return 1;
+  }
+  return 0;
+}
+
+// bind every book dir under the root that is not loaded yet. new subbooks are appended
+// to the list so the indexes of the others never change
+void books_scan() {
+  DIR *dp;
+  struct dirent *ep;
+  char path[PATH_MAX] = {0};
+
+  dp = opendir(books_rootpath);
   if (dp != NULL) {
 
     while (ep = readdir(dp)) {
       if( ep->d_type != DT_DIR || ep->d_name[0] == '.')
         continue;
-      if( rootpath[strlen(rootpath)-1] == '/' )
-        sprintf(path, "%s%s", rootpath, ep->d_name);
-      else
-        sprintf(path, "%s/%s", rootpath, ep->d_name);
-      book_load(path);
+      if( snprintf(path, sizeof(path), books_rootpath[strlen(books_rootpath)-1] == '/' ? "%s%s" : "%s/%s",
+            books_rootpath, ep->d_name) >= (int)sizeof(path) )
+        continue; // too long a path to open
+      if( !book_is_loaded(path) )
+        book_load(path);
     }
 
     closedir (dp);
   }
 }
 
+// unbind a book. its subbook slots stay in the list (as null titles) and are never reused
+void book_retire(book_t* bookw) {
+  book_node_t* current;
+  for( current = books; current != NULL; current = current->next ) {
+    if( current->book == bookw ) {
+      current->book = NULL;
+      free(current->title);
+      current->title = NULL;
+      entry_index_close(current->entries);
+      current->entries = NULL;
+      heading_index_close(current->headings);
+      current->headings = NULL;
+      fulltext_close(current->fulltext);
+      current->fulltext = NULL;
+      fuzzy_trie_free(current->words);
+      current->words = NULL;
+      suffix_index_close(current->suffixes);
+      current->suffixes = NULL;
+    }
+  }
+  if( current_bookw == bookw ) {
+    current_bookw = NULL;
+    current_node = NULL;
+  }
+  fprintf(stderr, "retired the book: %s\n", bookw->path);
+  book_unload(bookw);
+}
+
+// retire books whose dir is gone or was replaced, then bind new ones.
+// requests are served one by one, so this never runs in the middle of one
+JSON_Value* books_reload() {
+  book_node_t* current;
+  struct stat st;
+
+  current = books;
+  while( current != NULL ) {
+    book_t* bookw = current->book;
+    current = current->next;
+    if( bookw == NULL )
+      continue;
+    if( stat(bookw->path, &st) != 0 || !S_ISDIR(st.st_mode) || st.st_dev != bookw->dev || st.st_ino != bookw->ino ) {
+      book_retire(bookw);
+    }
+  }
+  // look for sidecars built since
+  for( current = books; current != NULL; current = current->next ) {
+    if( current->entries == NULL )
+      current->entries_opened = 0;
+    if( current->headings == NULL )
+      current->headings_opened = 0;
+    if( current->fulltext == NULL )
+      current->fulltext_opened = 0;
+    if( current->suffixes == NULL )
+      current->suffixes_opened = 0;
+    if( current->words == NULL )
+      current->words_opened = 0;
+  }
+  books_scan();
+  return book_list();
+}
+
+// watch the root dir for added / removed books. returns -1 if inotify is unavailable
+int books_watch() {
+  books_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if( books_watch_fd < 0 )
+    return -1;
+  if( inotify_add_watch(books_watch_fd, books_rootpath, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR) < 0 ) {
+    close(books_watch_fd);
+    books_watch_fd = -1;
+    return -1;
+  }
+  return 0;
+}
+
+// drain pending inotify events and reload if there were any. returns 1 if reloaded
+int books_poll_watch() {
+  char events[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  int changed = 0;
+
+  if( books_watch_fd < 0 )
+    return 0;
+  while( read(books_watch_fd, events, sizeof(events)) > 0 )
+    changed = 1;
+  if( changed )
+    json_value_free(books_reload());
+  return changed;
+}
+
+void books_entries_dir(const char* dir) {
+  strncpy(entries_dir, dir, sizeof(entries_dir) - 1);
+}
+
+// sidecar path of the current subbook of node's book: <entries_dir>/<book dir name>-<subbook dir name>.<suffix>.
+// returns -1 if it doesn't fit in PATH_MAX, else 0
+static int entries_path(book_node_t* node, const char* suffix, char* path) {
+  char name[PATH_MAX];
+  char* slash;
+
+  strcpy(name, node->book->path);
+  while( strlen(name) > 1 && name[strlen(name)-1] == '/' )
+    name[strlen(name)-1] = '\0';
+  slash = strrchr(name, '/');
+  if( snprintf(path, PATH_MAX, "%s/%s-%s.%s", entries_dir, slash == NULL ? name : slash + 1,
+        node->book->book.subbook_current->directory_name, suffix) >= PATH_MAX )
+    return -1;
+  return 0;
+}
+
+// identity of the subbook of node, the same across restarts: a hash of its dict dir name and subbook
+// dir name, as the sidecar file names
+static uint64_t node_key(book_node_t* node) {
+  char name[PATH_MAX];
+  char directory[EB_MAX_DIRECTORY_NAME_LENGTH + 1];
+  const unsigned char* p;
+  char* slash;
+  uint64_t hash = 14695981039346656037ull; // fnv-1a
+
+  if( node->key != 0 )
+    return node->key;
+  if( eb_subbook_directory2(&node->book->book, node->book->subbook_list[node->subbook_index], directory) != EB_SUCCESS )
+    return 0;
+  strcpy(name, node->book->path);
+  while( strlen(name) > 1 && name[strlen(name)-1] == '/' )
+    name[strlen(name)-1] = '\0';
+  slash = strrchr(name, '/');
+  for( p = (const unsigned char*)(slash == NULL ? name : slash + 1); *p; p++ )
+    hash = (hash ^ *p) * 1099511628211ull;
+  hash = (hash ^ '/') * 1099511628211ull;
+  for( p = (const unsigned char*)directory; *p; p++ )
+    hash = (hash ^ *p) * 1099511628211ull;
+  node->key = hash != 0 ? hash : 1;
+  return node->key;
+}
+
+// identity of the subbook last selected by select_book (see node_key), 0 if there is none
+uint64_t book_current_key() {
+  if( current_node == NULL || current_node->book == NULL )
+    return 0;
+  return node_key(current_node);
+}
+
+// dict dir name (PATH_MAX) and subbook dir name (EB_MAX_DIRECTORY_NAME_LENGTH + 1) of the subbook last
+// selected by select_book, as in the sidecar file names. returns 0, or -1 if there is none
+int book_current_names(char* book_name, char* subbook_name) {
+  char name[PATH_MAX];
+  char* slash;
+
+  if( current_node == NULL || current_node->book == NULL || current_node->book->book.subbook_current == NULL )
+    return -1;
+  strcpy(name, current_node->book->path);
+  while( strlen(name) > 1 && name[strlen(name)-1] == '/' )
+    name[strlen(name)-1] = '\0';
+  slash = strrchr(name, '/');
+  strcpy(book_name, slash == NULL ? name : slash + 1);
+  strcpy(subbook_name, current_node->book->book.subbook_current->directory_name);
+  return 0;
+}
+
+// index of the subbook of a key given by book_current_key, -1 if it is not there (any more)
+int book_index_of_key(uint64_t key) {
+  book_node_t* current;
+  int index = 0;
+
+  for( current = books; current != NULL; current = current->next, index++ ) {
+    if( current->book != NULL && node_key(current) == key )
+      return index;
+  }
+  return -1;
+}
+
+// entry index of the subbook last selected by select_book, NULL if there is none
+entry_index_t* current_entries() {
+  char path[PATH_MAX];
+
+  if( current_node == NULL || entries_dir[0] == '\0' )
+    return NULL;
+  if( !current_node->entries_opened ) {
+    current_node->entries = entries_path(current_node, "entries", path) == 0
+      ? entry_index_open(&current_bookw->book, path) : NULL;
+    current_node->entries_opened = 1;
+  }
+  return current_node->entries;
+}
+
+// text -> heading index of the subbook last selected by select_book, NULL if there is none
+heading_index_t* current_headings() {
+  char path[PATH_MAX];
+
+  if( current_node == NULL || entries_dir[0] == '\0' )
+    return NULL;
+  if( !current_node->headings_opened ) {
+    current_node->headings = entries_path(current_node, "headings", path) == 0
+      ? heading_index_open(&current_bookw->book, path) : NULL;
+    current_node->headings_opened = 1;
+  }
+  return current_node->headings;
+}
+
+// full text index of the subbook last selected by select_book, NULL if there is none
+fulltext_index_t* current_fulltext() {
+  char path[PATH_MAX];
+
+  if( current_node == NULL || entries_dir[0] == '\0' )
+    return NULL;
+  if( !current_node->fulltext_opened ) {
+    current_node->fulltext = entries_path(current_node, "fulltext", path) == 0
+      ? fulltext_open(&current_bookw->book, path) : NULL;
+    current_node->fulltext_opened = 1;
+  }
+  return current_node->fulltext;
+}
+
+// headword suffix array of the subbook last selected by select_book, NULL if there is none
+suffix_index_t* current_suffixes() {
+  char path[PATH_MAX];
+
+  if( current_node == NULL || entries_dir[0] == '\0' )
+    return NULL;
+  if( !current_node->suffixes_opened ) {
+    current_node->suffixes = entries_path(current_node, "suffixes", path) == 0
+      ? suffix_index_open(&current_bookw->book, path) : NULL;
+    current_node->suffixes_opened = 1;
+  }
+  return current_node->suffixes;
+}
+
+// suffix array of the normalized keys of the heading index, each word giving its heading records
+static int build_suffixes(EB_Book* book, heading_index_t* headings, const char* path) {
+  uint32_t* words = (uint32_t*)malloc(((size_t)headings->keys_size + headings->count) * sizeof(uint32_t));
+  uint32_t* values = (uint32_t*)malloc((headings->count + 1) * sizeof(uint32_t));
+  size_t length = 0;
+  uint32_t n;
+  int result;
+
+  // a key never normalizes to more code points than it has bytes
+  for( n = 0; n < headings->count; n++ ) {
+    const char* key = index_word_to_utf8(book, headings->keys + headings->records[n].key, headings->records[n].key_length);
+    length += normalize_search_text(key, words + length, headings->records[n].key_length);
+    words[length++] = 0;
+    values[n] = n;
+  }
+  result = suffix_index_build(book, path, words, length, values, headings->count);
+  free(words);
+  free(values);
+  return result;
+}
+
+// trie of the normalized keys of the heading index, each word giving its heading record
+static int build_words(EB_Book* book, heading_index_t* headings, const char* path) {
+  fuzzy_trie_t* words = fuzzy_trie_new();
+  unsigned int word[FUZZY_MAX_WORD];
+  uint32_t n;
+  int result;
+
+  for( n = 0; n < headings->count; n++ ) {
+    const char* key = index_word_to_utf8(book, headings->keys + headings->records[n].key, headings->records[n].key_length);
+    fuzzy_trie_add(words, word, normalize_search_text(key, word, FUZZY_MAX_WORD), n);
+  }
+  fuzzy_trie_finish(words);
+  result = fuzzy_trie_save(book, words, path);
+  fuzzy_trie_free(words);
+  return result;
+}
+
+// headword trie of the subbook last selected by select_book, NULL if there is none
+fuzzy_trie_t* current_words() {
+  char path[PATH_MAX];
+
+  if( current_node == NULL || entries_dir[0] == '\0' )
+    return NULL;
+  if( !current_node->words_opened ) {
+    current_node->words = entries_path(current_node, "words", path) == 0
+      ? fuzzy_trie_open(&current_bookw->book, path) : NULL;
+    current_node->words_opened = 1;
+  }
+  return current_node->words;
+}
+
+// render every entry of the entry index through hookset and index its normalized text
+static int build_fulltext(EB_Book* book, entry_index_t* entries, const char* path) {
+  fulltext_builder_t* builder = fulltext_builder_new();
+  EB_Position position;
+  uint32_t n;
+  int result;
+
+  for( n = 0; n < entries->count; n++ ) {
+    entry_index_position(entries, n, &position);
+    if( eb_seek_text(book, &position) != EB_SUCCESS
+      || eb_read_text(book, current_bookw->app, &hookset, NULL, MAXLEN_TEXT, text, &text_length) != EB_SUCCESS )
+      continue;
+    fulltext_builder_add(builder, n, normalized, normalize_search_text(text, normalized, MAXLEN_TEXT));
+  }
+  result = fulltext_builder_write(builder, book, path);
+  fulltext_builder_free(builder);
+  return result;
+}
+
+// build the sidecars of one subbook in a child process, with its own file descriptors
+static void build_entries_child(book_node_t* node) {
+  char path[PATH_MAX];
+  book_t* bookw = book_load(node->book->path);
+
+  if( bookw == NULL || eb_set_subbook(&bookw->book, bookw->subbook_list[node->subbook_index]) != EB_SUCCESS )
+    _exit(1);
+  if( bookw->app != NULL )
+    eb_set_appendix_subbook(bookw->app, bookw->subbook_list[node->subbook_index]);
+  node->book = bookw;
+  current_bookw = bookw; // for the hooks
+  current_node = node;
+  if( eb_have_word_search(&bookw->book) && current_headings() == NULL ) {
+    if( entries_path(node, "headings", path) != 0 || heading_index_build(&bookw->book, path) != 0 )
+      fprintf(stderr, "failed to build the heading index: %s\n", path);
+  }
+  if( current_headings() != NULL && current_suffixes() == NULL ) {
+    if( entries_path(node, "suffixes", path) != 0 || build_suffixes(&bookw->book, current_headings(), path) != 0 )
+      fprintf(stderr, "failed to build the headword suffix array: %s\n", path);
+  }
+  if( current_headings() != NULL && current_words() == NULL ) {
+    if( entries_path(node, "words", path) != 0 || build_words(&bookw->book, current_headings(), path) != 0 )
+      fprintf(stderr, "failed to build the headword trie: %s\n", path);
+  }
+  if( entries_path(node, "entries", path) != 0 || entry_index_build(&bookw->book, bookw->app, path) != 0 ) {
+    fprintf(stderr, "failed to build the entry index: %s\n", path);
+    _exit(1);
+  }
+  fprintf(stderr, "built the entry index: %s\n", path);
+  if( current_entries() != NULL && current_fulltext() == NULL ) {
+    if( entries_path(node, "fulltext", path) != 0 || build_fulltext(&bookw->book, current_entries(), path) != 0 ) {
+      fprintf(stderr, "failed to build the full text index: %s\n", path);
+      _exit(1);
+    }
+    fprintf(stderr, "built the full text index: %s\n", path);
+  }
+  _exit(0);
+}
+
+// build the sidecars of every subbook, up to jobs subbooks at a time. an interrupted build
+// continues where it stopped. returns the number of subbooks that failed
+int books_build_entries(int jobs) {
+  book_node_t* current;
+  int running = 0;
+  int failures = 0;
+  int status;
+  pid_t pid;
+
+  if( entries_dir[0] == '\0' )
+    return -1;
+  fflush(stdout);
+  fflush(stderr);
+  for( current = books; current != NULL || running > 0; ) {
+    if( current != NULL && running < jobs ) {
+      if( current->book != NULL ) {
+        pid = fork();
+        if( pid == 0 )
+          build_entries_child(current);
+        if( pid < 0 )
+          failures++;
+        else
+          running++;
+      }
+      current = current->next;
+      continue;
+    }
+    if( wait(&status) < 0 )
+      break;
+    running--;
+    if( !WIFEXITED(status) || WEXITSTATUS(status) != 0 )
+      failures++;
+  }
+  return failures;
+}
+
 book_t* book_load(const char* path) {
   book_t* bookw = (book_t*)malloc(sizeof(book_t));
   eb_initialize_book(&(bookw->book));
   bookw->gaijimap_tree = NULL;
   bookw->app = NULL;
+  bookw->path = strdup(path);
   EB_Book* book = &bookw->book;
   int i = 0;
   char title[256];
+  struct stat st;
+
+  if( stat(path, &st) != 0 )
+    goto die;
+  bookw->dev = st.st_dev;
+  bookw->ino = st.st_ino;
 
   EB_Error_Code error_code = eb_bind(book, path);
   if (error_code != EB_SUCCESS) {
@@ -469,49 +934,191 @@ void book_unload(book_t* bookw) {
     return;
   if( bookw->gaijimap_tree != NULL )
     mxmlDelete(bookw->gaijimap_tree);
+  if( bookw->app != NULL ) {
+    eb_finalize_appendix(bookw->app);
+    free(bookw->app);
+  }
 	eb_finalize_book(&(bookw->book));
+	free(bookw->path);
 	free(bookw);
 }
 
-char* book_binary_gaiji_narrow(int index, int code, size_t* size) {
+typedef struct {
+  EB_Book_Code book;
+  EB_Subbook_Code subbook;
+  int wide;
+  int code;
+  char* png;
+  size_t size;
+} gaiji_cache_entry_t;
+
+// encoded gaiji, direct mapped by glyph. a colliding entry replaces the old one
+gaiji_cache_entry_t gaiji_cache[GAIJI_CACHE_SIZE];
+
+// 16 dots high bitmap of a gaiji of the current subbook into bitmap
+static EB_Error_Code gaiji_bitmap(EB_Book* book, int wide, int code, char* bitmap) {
+  eb_set_font(book, EB_FONT_16);
+  if( wide )
+    return eb_wide_font_character_bitmap(book, code, bitmap);
+  return eb_narrow_font_character_bitmap(book, code, bitmap);
+}
+
+// png of a gaiji, through gaiji_cache. the returned buffer is the cache's, valid until the next call
+static char* book_binary_gaiji(int index, int wide, int code, size_t* size) {
   EB_Book* book = select_book(index);
   if( book == NULL ) {
     return NULL;
   }
-  eb_set_font(book, EB_FONT_16);
-
-  EB_Error_Code error_code = eb_narrow_font_character_bitmap(book, code, buf_gaiji_narrow_bitmap);
-  if (error_code != EB_SUCCESS) {
+  EB_Subbook_Code subbook = book->subbook_current->code;
+  gaiji_cache_entry_t* entry = &gaiji_cache[(((unsigned int)book->code * 31 + subbook) * 2654435761u
+    ^ ((unsigned int)code * 2 + wide) * 40503u) % GAIJI_CACHE_SIZE];
+  char bitmap[EB_SIZE_WIDE_FONT_16];
+
+  if( entry->png != NULL && entry->book == book->code && entry->subbook == subbook
+    && entry->wide == wide && entry->code == code ) {
+    *size = entry->size;
+    return entry->png;
+  }
+  if( gaiji_bitmap(book, wide, code, bitmap) != EB_SUCCESS ) {
     return NULL;
   }
-
-  if (eb_bitmap_to_png(buf_gaiji_narrow_bitmap, EB_WIDTH_NARROW_FONT_16,
+  if (eb_bitmap_to_png(bitmap, wide ? EB_WIDTH_WIDE_FONT_16 : EB_WIDTH_NARROW_FONT_16,
     EB_HEIGHT_FONT_16, buf_binary, size) != EB_SUCCESS) {
     return NULL;
   }
-  return buf_binary;
+  free(entry->png);
+  entry->png = (char*)malloc(*size);
+  if( entry->png == NULL ) {
+    return buf_binary; // not cached
+  }
+  entry->book = book->code;
+  entry->subbook = subbook;
+  entry->wide = wide;
+  entry->code = code;
+  entry->size = *size;
+  memcpy(entry->png, buf_binary, *size);
+  return entry->png;
+}
+
+char* book_binary_gaiji_narrow(int index, int code, size_t* size) {
+  return book_binary_gaiji(index, 0, code, size);
 }
 
 char* book_binary_gaiji_wide(int index, int code, size_t* size) {
+  return book_binary_gaiji(index, 1, code, size);
+}
+
+// many gaiji as one png, ATLAS_COLUMNS glyphs per row. codes: hex codes separated by spaces, every
+// glyph of the subbook if there is none. *table gets [glyph_width, glyph_height, {"<code>": [x, y], ...}]
+// with codes written as in the text ("a121"). glyphs that can't be read are left out
+char* book_gaiji_atlas(int index, int wide, const char* codes, JSON_Value** table, size_t* size) {
   EB_Book* book = select_book(index);
   if( book == NULL ) {
     return NULL;
   }
+
+  int glyph_width = wide ? EB_WIDTH_WIDE_FONT_16 : EB_WIDTH_NARROW_FONT_16;
+  int glyph_size = wide ? EB_SIZE_WIDE_FONT_16 : EB_SIZE_NARROW_FONT_16;
+  int line_size = ATLAS_COLUMNS * glyph_size / EB_HEIGHT_FONT_16; // bytes of a dot row of the atlas
+  int glyph_line_size = glyph_size / EB_HEIGHT_FONT_16;
+  int code, end = 0;
+  int count = 0;
+  int consumed;
+  int rows;
+  int y;
+  int all = sscanf(codes, " %x", &code) != 1;
+  char key[9];
+  char bitmap[EB_SIZE_WIDE_FONT_16];
+  char* atlas;
+  EB_Error_Code error_code;
+
   eb_set_font(book, EB_FONT_16);
+  if( all ) {
+    if( !(wide ? eb_have_wide_font(book) : eb_have_narrow_font(book)) ) {
+      return NULL;
+    }
+    error_code = wide ? eb_wide_font_start(book, &code) : eb_narrow_font_start(book, &code);
+    if( error_code == EB_SUCCESS )
+      error_code = wide ? eb_wide_font_end(book, &end) : eb_narrow_font_end(book, &end);
+    if( error_code != EB_SUCCESS ) {
+      return NULL;
+    }
+  }
 
-  EB_Error_Code error_code = eb_wide_font_character_bitmap(book, code, buf_gaiji_wide_bitmap);
-  if (error_code != EB_SUCCESS) {
+  atlas = (char*)calloc((size_t)MAX_ATLAS_GLYPHS * glyph_size, 1);
+  if( atlas == NULL ) {
+    return NULL;
+  }
+  *table = json_value_init_array();
+  JSON_Array* table_array = json_value_get_array(*table);
+  JSON_Value* glyphs_value = json_value_init_object();
+  JSON_Object* glyphs = json_value_get_object(glyphs_value);
+  json_array_append_number(table_array, glyph_width);
+  json_array_append_number(table_array, EB_HEIGHT_FONT_16);
+
+  while( count < MAX_ATLAS_GLYPHS ) {
+    if( all ) {
+      if( code > end )
+        break;
+    } else {
+      if( sscanf(codes, " %x%n", &code, &consumed) != 1 )
+        break;
+      codes += consumed;
+      if( code < 0 || code > 0xffff ) // gaiji codes are 2 bytes
+        continue;
+    }
+    snprintf(key, sizeof(key), "%04x", code);
+    if( (all || json_object_get_value(glyphs, key) == NULL) && gaiji_bitmap(book, wide, code, bitmap) == EB_SUCCESS ) {
+      // a glyph cell of the atlas, dot row by dot row
+      char* cell = atlas + (size_t)(count / ATLAS_COLUMNS) * EB_HEIGHT_FONT_16 * line_size
+        + (count % ATLAS_COLUMNS) * glyph_line_size;
+      for( y = 0; y < EB_HEIGHT_FONT_16; y++ )
+        memcpy(cell + y * line_size, bitmap + y * glyph_line_size, glyph_line_size);
+      JSON_Value* position_value = json_value_init_array();
+      json_array_append_number(json_value_get_array(position_value), (count % ATLAS_COLUMNS) * glyph_width);
+      json_array_append_number(json_value_get_array(position_value), (count / ATLAS_COLUMNS) * EB_HEIGHT_FONT_16);
+      json_object_set_value(glyphs, key, position_value);
+      count++;
+    }
+    if( all && (wide ? eb_forward_wide_font_character(book, 1, &code) : eb_forward_narrow_font_character(book, 1, &code)) != EB_SUCCESS )
+      break;
+  }
+  json_array_append_value(table_array, glyphs_value);
+
+  rows = count > 0 ? (count + ATLAS_COLUMNS - 1) / ATLAS_COLUMNS : 1;
+  if( eb_bitmap_to_png(atlas, ATLAS_COLUMNS * glyph_width, rows * EB_HEIGHT_FONT_16, buf_binary, size) != EB_SUCCESS ) {
+    free(atlas);
+    json_value_free(*table);
+    *table = NULL;
     return NULL;
   }
+  free(atlas);
+  return buf_binary;
+}
 
-  if (eb_bitmap_to_png(buf_gaiji_wide_bitmap, EB_WIDTH_WIDE_FONT_16,
-    EB_HEIGHT_FONT_16, buf_binary, size) != EB_SUCCESS) {
+// re-encode the mono graphic bmp in buf_binary (bottom-up lines padded to 4 bytes) as png
+static char* mono_bmp_to_png(int width, int height, size_t* size) {
+  size_t line_size = (width + 7) / 8;
+  size_t bmp_line_size = (width + 31) / 32 * 4;
+  size_t bmp_header_size = 62; // file and info headers, 2 colors
+  char* bitmap;
+  int y;
+
+  if( width <= 0 || height <= 0 || *size < bmp_header_size + bmp_line_size * height )
+    return NULL;
+  bitmap = (char*)malloc(line_size * height);
+  for( y = 0; y < height; y++ )
+    memcpy(bitmap + line_size * y, buf_binary + bmp_header_size + bmp_line_size * (height - 1 - y), line_size);
+  if( eb_bitmap_to_png(bitmap, width, height, buf_binary, size) != EB_SUCCESS ) {
+    free(bitmap);
     return NULL;
   }
+  free(bitmap);
   return buf_binary;
 }
 
-char* book_binary_mono(int index, int page, int offset, int width, int height, size_t* size) {
+// mono graphic as bmp, or as png if png is not 0
+char* book_binary_mono(int index, int page, int offset, int width, int height, int png, size_t* size) {
   EB_Book* book = select_book(index);
   if( book == NULL ) {
     return NULL;
@@ -539,41 +1146,235 @@ char* book_binary_mono(int index, int page, int offset, int width, int height, s
     }
   }
 
+  if( png )
+    return mono_bmp_to_png(width, height, size);
   return buf_binary;
 }
 
-char* book_binary_color(int index, int page, int offset, size_t* size) {
+// width and height of a jpeg from its SOF segment, within the length bytes read. returns 0 if not found
+static int jpeg_dimensions(const unsigned char* p, size_t length, int* width, int* height) {
+  size_t i = 2; // after SOI
+
+  while( i + 9 <= length && p[i] == 0xff ) {
+    unsigned char marker = p[i + 1];
+    if( marker == 0xff ) { // fill byte
+      i++;
+      continue;
+    }
+    if( marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc ) {
+      *height = p[i + 5] << 8 | p[i + 6];
+      *width = p[i + 7] << 8 | p[i + 8];
+      return 1;
+    }
+    i += 2 + (p[i + 2] << 8 | p[i + 3]);
+  }
+  return 0;
+}
+
+// etag of a binary object: its kind and arguments in this subbook, and the size and time of the file
+// holding it, so that it changes when the dictionary is replaced
+static void binary_etag(EB_Book* book, char kind, const int* args, int arg_count, char* etag) {
+  uint64_t hash = 14695981039346656037ull; // fnv-1a
+  struct stat st;
+  uint64_t values[8];
+  size_t i;
+  const unsigned char* p;
+
+  for( p = (const unsigned char*)current_bookw->path; *p; p++ )
+    hash = (hash ^ *p) * 1099511628211ull;
+  for( p = (const unsigned char*)book->subbook_current->directory_name; *p; p++ )
+    hash = (hash ^ *p) * 1099511628211ull;
+  memset(values, 0, sizeof(values));
+  values[0] = kind;
+  for( i = 0; i < (size_t)arg_count; i++ )
+    values[i + 1] = args[i];
+  if( zio_source_status(book->binary_context.zio, &st) == 0 ) {
+    values[6] = st.st_size;
+    values[7] = st.st_mtime;
+  }
+  for( p = (const unsigned char*)values; p < (const unsigned char*)(values + 8); p++ )
+    hash = (hash ^ *p) * 1099511628211ull;
+  sprintf(etag, "%016llx", (unsigned long long)hash);
+}
+
+// size, media type and dimensions of a binary object, reading no more than its header:
+// {"length": bytes or null if unknown, "type": media type, "etag": ..., and "width", "height" for graphics,
+// "channels", "rate", "bits" for wav}. kind and args as the reading commands: 'b' page offset width height png,
+// 'c' page offset, 'd' page offset endpage endoffset. the png of 'b' is encoded to know its length
+JSON_Value* book_binary_probe(int index, char kind, const int* args) {
   EB_Book* book = select_book(index);
   if( book == NULL ) {
     return NULL;
   }
 
-  EB_Position position;
-  position.page = page;
-  position.offset = offset;
-  EB_Error_Code error_code = eb_set_binary_color_graphic(book, &position);
-  if (error_code != EB_SUCCESS) {
-    return NULL;
+  EB_Position position, endposition;
+  EB_Error_Code error_code;
+  const unsigned char* header = (const unsigned char*)buf_binary;
+  ssize_t readcnt = 0;
+  size_t size = 0;
+  int width = 0, height = 0;
+  char etag[17];
+
+  position.page = args[0];
+  position.offset = args[1];
+  JSON_Value* root_value = json_value_init_object();
+  JSON_Object* root = json_value_get_object(root_value);
+
+  switch( kind ) {
+    case 'b':
+      if( eb_set_binary_mono_graphic(book, &position, args[2], args[3]) != EB_SUCCESS )
+        goto failed;
+      binary_etag(book, kind, args, 5, etag);
+      if( args[4] ) {
+        if( book_binary_mono(index, args[0], args[1], args[2], args[3], 1, &size) == NULL )
+          goto failed;
+        json_object_set_number(root, "length", size);
+        json_object_set_string(root, "type", "image/png");
+      } else {
+        json_object_set_number(root, "length", 62 + (size_t)(args[2] + 31) / 32 * 4 * args[3]); // bmp headers + lines
+        json_object_set_string(root, "type", "image/bmp");
+      }
+      json_object_set_number(root, "width", args[2]);
+      json_object_set_number(root, "height", args[3]);
+      break;
+    case 'c':
+      if( eb_set_binary_color_graphic(book, &position) != EB_SUCCESS )
+        goto failed;
+      binary_etag(book, kind, args, 2, etag);
+      if( book->binary_context.size > 0 )
+        json_object_set_number(root, "length", book->binary_context.size);
+      else // a jpeg without a size header, only reading it through tells
+        json_object_set_null(root, "length");
+      while( size < PROBE_SIZE ) {
+        error_code = eb_read_binary(book, PROBE_SIZE - size, buf_binary + size, &readcnt);
+        if( error_code != EB_SUCCESS )
+          goto failed;
+        if( readcnt == 0 )
+          break;
+        size += readcnt;
+        if( size >= 26 && header[0] == 'B' && header[1] == 'M' )
+          break;
+      }
+      if( size >= 26 && header[0] == 'B' && header[1] == 'M' ) {
+        json_object_set_string(root, "type", "image/bmp");
+        width = header[18] | header[19] << 8 | header[20] << 16 | header[21] << 24;
+        height = header[22] | header[23] << 8 | header[24] << 16 | header[25] << 24;
+        json_object_set_number(root, "width", width);
+        json_object_set_number(root, "height", height < 0 ? -height : height); // negative: top-down
+      } else if( size >= 2 && header[0] == 0xff && header[1] == 0xd8 ) {
+        json_object_set_string(root, "type", "image/jpeg");
+        if( jpeg_dimensions(header, size, &width, &height) ) {
+          json_object_set_number(root, "width", width);
+          json_object_set_number(root, "height", height);
+        }
+      } else {
+        json_object_set_string(root, "type", "application/octet-stream");
+      }
+      break;
+    case 'd':
+      endposition.page = args[2];
+      endposition.offset = args[3];
+      if( eb_set_binary_wave(book, &position, &endposition) != EB_SUCCESS )
+        goto failed;
+      binary_etag(book, kind, args, 4, etag);
+      // the 44 bytes riff header is composed by eb_set_binary_wave, the data follows
+      if( eb_read_binary(book, 44, buf_binary, &readcnt) != EB_SUCCESS || readcnt != 44 )
+        goto failed;
+      json_object_set_number(root, "length", 44 + book->binary_context.size);
+      json_object_set_string(root, "type", "audio/wav");
+      json_object_set_number(root, "channels", header[22] | header[23] << 8);
+      json_object_set_number(root, "rate", header[24] | header[25] << 8 | header[26] << 16 | header[27] << 24);
+      json_object_set_number(root, "bits", header[34] | header[35] << 8);
+      break;
+    default:
+      goto failed;
   }
+  json_object_set_string(root, "etag", etag);
+  return root_value;
 
-  *size = 0;
+failed:
+  json_value_free(root_value);
+  return NULL;
+}
+
+// when the binary object set in book is stored plain (not compressed) with a known size, fill region
+// with where the bytes start..start+length (to the end if length is 0) are, instead of reading them. head
+// is the number of bytes libebu composes before the data (the wav header). returns 0 (region->fd -1) if
+// it is not, or if region is NULL
+static int plain_binary_region(EB_Book* book, size_t head, off_t start, size_t length, binary_region_t* region,
+  size_t* size) {
+  EB_Binary_Context* context = &book->binary_context;
+  size_t total, end;
+
+  if( region == NULL )
+    return 0;
+  region->fd = -1;
+  if( start < 0 || context->zio == NULL || context->zio->code != ZIO_PLAIN || context->zio->is_ebnet
+    || context->size == 0 )
+    return 0;
+  total = head + context->size;
+  if( start > total )
+    start = total;
+  end = length > 0 && start + length < total ? start + length : total;
+  region->head = context->cache_buffer + start;
+  region->head_length = start < head ? (end < head ? end : head) - start : 0;
+  region->fd = zio_file(context->zio);
+  region->offset = context->location + (start > head ? start - head : 0);
+  region->length = end > head ? end - (start > head ? start : head) : 0;
+  *size = end - start;
+  return 1;
+}
+
+// read the binary object set in book into buf_binary: length bytes from start, or up to the end if length
+// is 0. the bytes before start are skipped by seeking, not read. fails if length doesn't fit in buf_binary
+static char* read_binary_range(EB_Book* book, off_t start, size_t length, size_t* size) {
+  EB_Error_Code error_code;
   ssize_t readcnt = 0;
-  while( 1 ) {
-    error_code = eb_read_binary(book, sizeof(buf_binary) - *size, buf_binary + *size, &readcnt);
+  size_t max = length > 0 ? length : sizeof(buf_binary);
+
+  if( length > sizeof(buf_binary) )
+    return NULL;
+  if( start > 0 && eb_seek_binary(book, start) != EB_SUCCESS )
+    return NULL;
+  *size = 0;
+  while( *size < max ) {
+    error_code = eb_read_binary(book, max - *size, buf_binary + *size, &readcnt);
     if( error_code != EB_SUCCESS )
       return NULL;
     if( readcnt == 0 )
       break;
     *size += readcnt;
-    if( *size == sizeof(buf_binary) ) { // buff full, consider as fail
-      return NULL;
-    }
+  }
+  if( length == 0 && *size == sizeof(buf_binary) ) { // buff full, consider as fail
+    return NULL;
   }
 
   return buf_binary;
 }
 
-char* book_binary_wav(int index, int page, int offset, int endpage, int endoffset, size_t* size) {
+// color graphic, or length bytes of it from start (to the end if length is 0)
+char* book_binary_color(int index, int page, int offset, off_t start, size_t length, binary_region_t* region, size_t* size) {
+  EB_Book* book = select_book(index);
+  if( book == NULL ) {
+    return NULL;
+  }
+
+  EB_Position position;
+  position.page = page;
+  position.offset = offset;
+  EB_Error_Code error_code = eb_set_binary_color_graphic(book, &position);
+  if (error_code != EB_SUCCESS) {
+    return NULL;
+  }
+
+  if( plain_binary_region(book, 0, start, length, region, size) )
+    return buf_binary;
+  return read_binary_range(book, start, length, size);
+}
+
+// wav, header included, or length bytes of it from start (to the end if length is 0)
+char* book_binary_wav(int index, int page, int offset, int endpage, int endoffset, off_t start, size_t length,
+  binary_region_t* region, size_t* size) {
   EB_Book* book = select_book(index);
   if( book == NULL ) {
     return NULL;
@@ -589,21 +1390,9 @@ char* book_binary_wav(int index, int page, int offset, int endpage, int endoffse
     return NULL;
   }
 
-  *size = 0;
-  ssize_t readcnt = 0;
-  while( 1 ) {
-    error_code = eb_read_binary(book, sizeof(buf_binary) - *size, buf_binary + *size, &readcnt);
-    if( error_code != EB_SUCCESS )
-      return NULL;
-    if( readcnt == 0 )
-      break;
-    *size += readcnt;
-    if( *size == sizeof(buf_binary) ) { // buff full, consider as fail
-      return NULL;
-    }
-  }
-
-  return buf_binary;
+  if( plain_binary_region(book, 44, start, length, region, size) )
+    return buf_binary;
+  return read_binary_range(book, start, length, size);
 }
 
 JSON_Value* book_page(int index, int page) {
@@ -616,6 +1405,29 @@ JSON_Value* book_page(int index, int page) {
   JSON_Array *root_array = json_value_get_array(root_value);
 
   EB_Position position;
+  entry_index_t* entries = current_entries();
+  if( entries != NULL ) {
+    // the entries a forward scan from the page start finds: after page,0 up to page+1,0
+    uint32_t n;
+    position.page = page;
+    position.offset = 1;
+    n = entry_index_find(entries, &position);
+    for( ; n < entries->count && entries->starts[n] <= (uint32_t)page * EB_SIZE_PAGE; n++ ) {
+      entry_index_position(entries, n, &position);
+      if( eb_seek_text(book, &position) != EB_SUCCESS
+        || eb_read_heading(book, NULL, &hookset_header, NULL, MAXLEN_HEADING, heading, &heading_length) != EB_SUCCESS
+        || eb_seek_text(book, &position) != EB_SUCCESS
+        || eb_read_text(book, current_bookw->app, &hookset, NULL, MAXLEN_TEXT, text, &text_length) != EB_SUCCESS ) {
+        break;
+      }
+      json_array_append_string(root_array, heading);
+      json_array_append_string(root_array, text);
+      json_array_append_number(root_array, position.page);
+      json_array_append_number(root_array, position.offset);
+    }
+    return root_value;
+  }
+
   position.page = page;
   position.offset = 0;
 
@@ -657,48 +1469,414 @@ page_end:
   return root_value;
 }
 
-// directly read a position
-JSON_Value* book_get(int index, int page, int offset) {
-  EB_Book* book = select_book(index);
-  if( book == NULL ) {
-    return NULL;
-  }
+typedef struct {
+  EB_Book_Code book;
+  EB_Subbook_Code subbook;
+  EB_Position position;
+  char* heading;
+} reference_cache_entry_t;
 
-  JSON_Value *root_value = json_value_init_array();
-  JSON_Array *root_array = json_value_get_array(root_value);
+// heading of reference targets, direct mapped by position. a colliding entry replaces the old one
+reference_cache_entry_t reference_cache[REFERENCE_CACHE_SIZE];
 
-  EB_Position position;
-  position.page = page;
-  position.offset = offset;
+// hash of a position in the current subbook of book, for direct mapped caches
+unsigned int position_hash(EB_Book* book, const EB_Position* position) {
+  return ((unsigned int)book->code * 31 + book->subbook_current->code) * 2654435761u
+    ^ ((unsigned int)position->page * 2048 + position->offset) * 40503u;
+}
 
-  EB_Error_Code error_code = eb_seek_text(book, &position);
-  if (error_code != EB_SUCCESS) {
-    goto get_end;
-  }
+// read into out the heading the word index gives for the text at position, without decoding the
+// text. returns 0 if there is no heading index or it has no entry for position
+int indexed_heading(EB_Book* book, const EB_Position* position, char* out) {
+  heading_index_t* headings = current_headings();
+  EB_Position heading_position;
+  ssize_t length;
+
+  if( headings == NULL )
+    return 0;
+  uint32_t n = heading_index_find(headings, position);
+  if( !heading_index_match(headings, n, position) )
+    return 0;
+  heading_index_heading(headings, n, &heading_position);
+  return eb_seek_text(book, &heading_position) == EB_SUCCESS
+    && eb_read_heading(book, NULL, &hookset_header, NULL, MAXLEN_HEADING, out, &length) == EB_SUCCESS;
+}
 
-  error_code = eb_read_heading(book, NULL, &hookset_header, NULL, MAXLEN_HEADING, heading, &heading_length);
-  if (error_code != EB_SUCCESS) {
-    goto get_end;
-  }
-  // printf("heading: %s\n", heading);
+// heading of the entry at position, through reference_cache. returns NULL if it can't be read
+const char* reference_heading(EB_Book* book, const EB_Position* position) {
+  EB_Subbook_Code subbook = book->subbook_current->code;
+  reference_cache_entry_t* entry = &reference_cache[position_hash(book, position) % REFERENCE_CACHE_SIZE];
+  char target_heading[MAXLEN_HEADING + 1];
+  ssize_t target_heading_length;
 
-  error_code = eb_seek_text(book, &position);
-  if (error_code != EB_SUCCESS) {
-    goto get_end;
+  if( entry->heading != NULL && entry->book == book->code && entry->subbook == subbook
+    && entry->position.page == position->page && entry->position.offset == position->offset ) {
+    return entry->heading;
   }
-
-  error_code = eb_read_text(book, current_bookw->app, &hookset, NULL, MAXLEN_TEXT, text, &text_length);
-  if (error_code != EB_SUCCESS) {
-    goto get_end;
+  if( !indexed_heading(book, position, target_heading)
+    && (eb_seek_text(book, position) != EB_SUCCESS
+    || eb_read_heading(book, NULL, &hookset_header, NULL, MAXLEN_HEADING, target_heading, &target_heading_length) != EB_SUCCESS) ) {
+    return NULL;
   }
-
-  json_array_append_string(root_array, heading);
-  json_array_append_string(root_array, text);
-  json_array_append_number(root_array, position.page);
-  json_array_append_number(root_array, position.offset);
-
-get_end:
-  return root_value;
+  free(entry->heading);
+  entry->book = book->code;
+  entry->subbook = subbook;
+  entry->position = *position;
+  entry->heading = strdup(target_heading);
+  return entry->heading;
+}
+
+// append [[page, offset, heading], ...] for the references collected while rendering an entry
+void append_references(EB_Book* book, JSON_Array* array) {
+  int i, j;
+  JSON_Value* references_value = json_value_init_array();
+  JSON_Array* references_array = json_value_get_array(references_value);
+
+  for( i = 0; i < reference_count; i++ ) {
+    for( j = 0; j < i; j++ ) {
+      if( memcmp(&references[j], &references[i], sizeof(EB_Position)) == 0 )
+        break;
+    }
+    if( j < i ) // already listed
+      continue;
+    const char* target_heading = reference_heading(book, &references[i]);
+    if( target_heading == NULL )
+      continue;
+    JSON_Value* reference_value = json_value_init_array();
+    JSON_Array* reference = json_value_get_array(reference_value);
+    json_array_append_number(reference, references[i].page);
+    json_array_append_number(reference, references[i].offset);
+    json_array_append_string(reference, target_heading);
+    json_array_append_value(references_array, reference_value);
+  }
+  json_array_append_value(array, references_value);
+}
+
+// read the heading of the entry at position into heading. returns 0 on failure
+static int read_entry_heading(EB_Book* book, const EB_Position* position) {
+  EB_Error_Code error_code;
+
+  if( !indexed_heading(book, position, heading) ) {
+    error_code = eb_seek_text(book, position);
+    if (error_code != EB_SUCCESS) {
+      return 0;
+    }
+
+    error_code = eb_read_heading(book, NULL, &hookset_header, NULL, MAXLEN_HEADING, heading, &heading_length);
+    if (error_code != EB_SUCCESS) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// render the entry at position and append heading, text, page, offset to array.
+// text is left empty if with_text is 0. with resolve_references, a 5th element lists the
+// references in the text with their target headings. returns 0 on failure
+int append_entry(EB_Book* book, const EB_Position* position, int with_text, int resolve_references, JSON_Array* array) {
+  EB_Error_Code error_code;
+
+  if( !read_entry_heading(book, position) ) {
+    return 0;
+  }
+  // printf("heading: %s\n", heading);
+
+  text[0] = '\0';
+  if( with_text ) {
+    error_code = eb_seek_text(book, position);
+    if (error_code != EB_SUCCESS) {
+      return 0;
+    }
+
+    reference_count = 0;
+    collect_references = resolve_references;
+    error_code = eb_read_text(book, current_bookw->app, &hookset, NULL, MAXLEN_TEXT, text, &text_length);
+    collect_references = 0;
+    if (error_code != EB_SUCCESS) {
+      return 0;
+    }
+  }
+
+  json_array_append_string(array, heading);
+  json_array_append_string(array, text);
+  json_array_append_number(array, position->page);
+  json_array_append_number(array, position->offset);
+  if( resolve_references ) {
+    if( !with_text )
+      reference_count = 0;
+    append_references(book, array);
+  }
+  return 1;
+}
+
+// word index entries pointing to the text at page, offset: [[heading, page, offset, key], ...] with the
+// heading position and normalized key of each. needs the heading index sidecar
+JSON_Value* book_headings(int index, int page, int offset) {
+  EB_Book* book = select_book(index);
+  if( book == NULL ) {
+    return NULL;
+  }
+  heading_index_t* headings = current_headings();
+  if( headings == NULL ) {
+    return NULL;
+  }
+
+  JSON_Value *root_value = json_value_init_array();
+  JSON_Array *root_array = json_value_get_array(root_value);
+  EB_Position position;
+  EB_Position heading_position;
+  uint32_t n;
+
+  position.page = page;
+  position.offset = offset;
+  for( n = heading_index_find(headings, &position); heading_index_match(headings, n, &position); n++ ) {
+    const heading_record_t* record = &headings->records[n];
+    heading_index_heading(headings, n, &heading_position);
+    if( eb_seek_text(book, &heading_position) != EB_SUCCESS
+      || eb_read_heading(book, NULL, &hookset_header, NULL, MAXLEN_HEADING, heading, &heading_length) != EB_SUCCESS ) {
+      continue;
+    }
+
+    JSON_Value* heading_value = json_value_init_array();
+    JSON_Array* heading_array = json_value_get_array(heading_value);
+    json_array_append_string(heading_array, heading);
+    json_array_append_number(heading_array, heading_position.page);
+    json_array_append_number(heading_array, heading_position.offset);
+    json_array_append_string(heading_array, index_word_to_utf8(book, headings->keys + record->key, record->key_length));
+    json_array_append_value(root_array, heading_value);
+  }
+  return root_value;
+}
+
+// directly read a position
+JSON_Value* book_get(int index, int page, int offset, int resolve_references) {
+  EB_Book* book = select_book(index);
+  if( book == NULL ) {
+    return NULL;
+  }
+
+  JSON_Value *root_value = json_value_init_array();
+  JSON_Array *root_array = json_value_get_array(root_value);
+
+  EB_Position position;
+  position.page = page;
+  position.offset = offset;
+
+  append_entry(book, &position, 1, resolve_references, root_array);
+  return root_value;
+}
+
+typedef struct {
+  EB_Book_Code book;
+  EB_Subbook_Code subbook;
+  EB_Position position;
+  EB_Position next; // page 0: not known yet, -1: position is the last entry
+  EB_Position prev; // page 0: not known yet, -1: position is the first entry
+} entry_link_t;
+
+// known neighbors of entry starts, direct mapped by position
+entry_link_t entry_links[ENTRY_LINK_CACHE_SIZE];
+
+entry_link_t* entry_link(EB_Book* book, const EB_Position* position) {
+  entry_link_t* link = &entry_links[position_hash(book, position) % ENTRY_LINK_CACHE_SIZE];
+  if( link->book != book->code || link->subbook != book->subbook_current->code
+    || link->position.page != position->page || link->position.offset != position->offset ) {
+    link->book = book->code;
+    link->subbook = book->subbook_current->code;
+    link->position = *position;
+    link->next.page = 0;
+    link->prev.page = 0;
+  }
+  return link;
+}
+
+// start of the entry next to (forward != 0) or before the entry starting at position.
+// returns 0 if there is none
+int entry_neighbor(EB_Book* book, const EB_Position* position, int forward, EB_Position* neighbor) {
+  entry_index_t* entries = current_entries();
+  EB_Error_Code error_code;
+
+  if( entries != NULL ) {
+    uint32_t n = entry_index_find(entries, position);
+    if( forward ) {
+      if( n < entries->count && entries->starts[n] == (uint32_t)(position->page - 1) * EB_SIZE_PAGE + position->offset )
+        n++; // position is an entry start
+      if( n >= entries->count )
+        return 0;
+    } else {
+      if( n == 0 )
+        return 0;
+      n--;
+    }
+    entry_index_position(entries, n, neighbor);
+    return 1;
+  }
+
+  entry_link_t* link = entry_link(book, position);
+  EB_Position* known = forward ? &link->next : &link->prev;
+
+  if( known->page == 0 ) {
+    error_code = eb_seek_text(book, position);
+    if( error_code == EB_SUCCESS )
+      error_code = forward ? eb_forward_text(book, current_bookw->app) : eb_backward_text(book, current_bookw->app);
+    if( error_code == EB_SUCCESS )
+      error_code = eb_tell_text(book, neighbor);
+    if( error_code == EB_ERR_END_OF_CONTENT ) {
+      known->page = -1;
+    } else if( error_code != EB_SUCCESS
+      || (neighbor->page == position->page && neighbor->offset == position->offset) ) {
+      return 0; // not cached, may work next time
+    } else {
+      *known = *neighbor;
+      // the link holds the other way too. the neighbor's slot may be link's own, which this resets:
+      // neighbor is returned as read, not from known
+      entry_link_t* other = entry_link(book, neighbor);
+      if( forward )
+        other->prev = *position;
+      else
+        other->next = *position;
+      return 1;
+    }
+  }
+  if( known->page < 0 )
+    return 0;
+  *neighbor = *known;
+  return 1;
+}
+
+// render up to before entries preceding the entry at page, offset, the entry itself and up to after
+// entries following it, in text order. flags: as book_get_batch
+JSON_Value* book_neighbors(int index, int page, int offset, int before, int after, int flags) {
+  EB_Book* book = select_book(index);
+  if( book == NULL ) {
+    return NULL;
+  }
+
+  EB_Position positions[MAX_NEIGHBORS * 2 + 1];
+  int first = MAX_NEIGHBORS; // positions[first..last) are filled
+  int last = MAX_NEIGHBORS + 1;
+  int i;
+
+  if( before < 0 || before > MAX_NEIGHBORS )
+    before = MAX_NEIGHBORS;
+  if( after < 0 || after > MAX_NEIGHBORS )
+    after = MAX_NEIGHBORS;
+  positions[MAX_NEIGHBORS].page = page;
+  positions[MAX_NEIGHBORS].offset = offset;
+  while( MAX_NEIGHBORS - first < before && entry_neighbor(book, &positions[first], 0, &positions[first - 1]) )
+    first--;
+  while( last - MAX_NEIGHBORS - 1 < after && entry_neighbor(book, &positions[last - 1], 1, &positions[last]) )
+    last++;
+
+  JSON_Value *root_value = json_value_init_array();
+  JSON_Array *root_array = json_value_get_array(root_value);
+  for( i = first; i < last; i++ ) {
+    JSON_Value* entry_value = json_value_init_array();
+    if( !append_entry(book, &positions[i], !(flags & 1), flags & 2, json_value_get_array(entry_value)) ) {
+      json_value_free(entry_value);
+      continue;
+    }
+    json_array_append_value(root_array, entry_value);
+  }
+  return root_value;
+}
+
+// entry count of a subbook, or entries first .. first+count-1 in text order (first < 0: a random one).
+// needs the entry index sidecar. flags: as book_get_batch
+JSON_Value* book_entries(int index, int first, int count, int flags) {
+  EB_Book* book = select_book(index);
+  if( book == NULL ) {
+    return NULL;
+  }
+  entry_index_t* entries = current_entries();
+  if( entries == NULL || entries->count == 0 ) {
+    return NULL;
+  }
+
+  JSON_Value *root_value = json_value_init_array();
+  JSON_Array *root_array = json_value_get_array(root_value);
+  EB_Position position;
+  uint32_t n;
+
+  if( count == 0 ) {
+    json_array_append_number(root_array, entries->count);
+    return root_value;
+  }
+  if( first < 0 ) {
+    first = random() % entries->count;
+    count = 1;
+  }
+  if( count < 0 || count > MAX_BATCH_POSITIONS )
+    count = MAX_BATCH_POSITIONS;
+  for( n = first; n < entries->count && n < (uint32_t)first + count; n++ ) {
+    entry_index_position(entries, n, &position);
+    JSON_Value* entry_value = json_value_init_array();
+    if( !append_entry(book, &position, !(flags & 1), flags & 2, json_value_get_array(entry_value)) ) {
+      json_value_free(entry_value);
+      continue;
+    }
+    json_array_append_value(root_array, entry_value);
+  }
+  return root_value;
+}
+
+typedef struct {
+  int input_index;
+  EB_Position position;
+} batch_position_t;
+
+batch_position_t batch_positions[MAX_BATCH_POSITIONS];
+
+int batch_position_compare(const void* a, const void* b) {
+  const batch_position_t* x = (const batch_position_t*)a;
+  const batch_position_t* y = (const batch_position_t*)b;
+  if( x->position.page != y->position.page )
+    return x->position.page < y->position.page ? -1 : 1;
+  if( x->position.offset != y->position.offset )
+    return x->position.offset < y->position.offset ? -1 : 1;
+  return x->input_index - y->input_index;
+}
+
+// read many positions at once. positions: "page,offset" pairs separated by spaces.
+// they are rendered in page order, so consecutive reads stay in the same or the next slice,
+// and output in input order as [heading, text, page, offset] arrays ([] for a failed one).
+// flags: bit 0, headings only (text left empty); bit 1, resolve references (see append_entry)
+JSON_Value* book_get_batch(int index, int flags, const char* positions) {
+  EB_Book* book = select_book(index);
+  if( book == NULL ) {
+    return NULL;
+  }
+
+  int count = 0;
+  int i, n;
+  const char* p = positions;
+  JSON_Value* results[MAX_BATCH_POSITIONS] = {0};
+
+  while( count < MAX_BATCH_POSITIONS && sscanf(p, " %d,%d%n", &batch_positions[count].position.page,
+    &batch_positions[count].position.offset, &n) == 2 ) {
+    batch_positions[count].input_index = count;
+    count++;
+    p += n;
+  }
+
+  qsort(batch_positions, count, sizeof(batch_position_t), batch_position_compare);
+
+  for( i = 0; i < count; i++ ) {
+    batch_position_t* bp = &batch_positions[i];
+    if( i > 0 && memcmp(&bp->position, &batch_positions[i-1].position, sizeof(EB_Position)) == 0 ) {
+      results[bp->input_index] = json_value_deep_copy(results[batch_positions[i-1].input_index]);
+      continue;
+    }
+    results[bp->input_index] = json_value_init_array();
+    append_entry(book, &bp->position, !(flags & 1), flags & 2, json_value_get_array(results[bp->input_index]));
+  }
+
+  JSON_Value *root_value = json_value_init_array();
+  JSON_Array *root_array = json_value_get_array(root_value);
+  for( i = 0; i < count; i++ ) {
+    json_array_append_value(root_array, results[i]);
+  }
+  return root_value;
 }
 
 JSON_Value* book_text(int index) {
@@ -742,6 +1920,72 @@ JSON_Value* book_menu(int index) {
   return NULL; // no menu or error
 }
 
+// multi searches of the subbook: [[title, [entry_label, ...]], ...], the index in this list is the
+// multi search id of query type 6
+JSON_Value* book_multi(int index) {
+  EB_Book* book = select_book(index);
+  if( book == NULL ) {
+    return NULL;
+  }
+
+  EB_Multi_Search_Code multi_list[EB_MAX_MULTI_SEARCHES];
+  int multi_count;
+  int entry_count;
+  int i, j;
+  char title[EB_MAX_MULTI_TITLE_LENGTH + 1];
+  char label[EB_MAX_MULTI_LABEL_LENGTH + 1];
+
+  if( eb_multi_search_list(book, multi_list, &multi_count) != EB_SUCCESS ) {
+    return NULL;
+  }
+  JSON_Value *root_value = json_value_init_array();
+  JSON_Array *root_array = json_value_get_array(root_value);
+  for( i = 0; i < multi_count; i++ ) {
+    JSON_Value* multi_value = json_value_init_array();
+    JSON_Array* multi_array = json_value_get_array(multi_value);
+    JSON_Value* labels_value = json_value_init_array();
+    JSON_Array* labels_array = json_value_get_array(labels_value);
+    if( eb_multi_title(book, multi_list[i], title) != EB_SUCCESS )
+      title[0] = '\0';
+    json_array_append_string(multi_array, convert_from_internal_encoding(book, title));
+    if( eb_multi_entry_count(book, multi_list[i], &entry_count) != EB_SUCCESS )
+      entry_count = 0;
+    for( j = 0; j < entry_count; j++ ) {
+      if( eb_multi_entry_label(book, multi_list[i], j, label) != EB_SUCCESS )
+        label[0] = '\0';
+      json_array_append_string(labels_array, convert_from_internal_encoding(book, label));
+    }
+    json_array_append_value(multi_array, labels_value);
+    json_array_append_value(root_array, multi_value);
+  }
+  return root_value;
+}
+
+// write uncompressed mirrors (see -u) of the compressed files of the subbook: text, graphics, sound and movies.
+// outputs [files read from a mirror]
+JSON_Value* book_mirror(int index) {
+  EB_Book* book = select_book(index);
+  if( book == NULL ) {
+    return NULL;
+  }
+
+  Zio* zios[] = { &book->subbook_current->text_zio, &book->subbook_current->graphic_zio,
+    &book->subbook_current->sound_zio, &book->subbook_current->movie_zio };
+  int mirrored = 0;
+  size_t i;
+
+  for( i = 0; i < sizeof(zios) / sizeof(zios[0]); i++ ) {
+    if( zio_file(zios[i]) < 0 || (zios[i]->code == ZIO_PLAIN && zios[i]->mirror_code == ZIO_INVALID) )
+      continue;
+    if( zio_write_mirror(zios[i]) != 0 )
+      return NULL;
+    mirrored++;
+  }
+  JSON_Value *root_value = json_value_init_array();
+  json_array_append_number(json_value_get_array(root_value), mirrored);
+  return root_value;
+}
+
 JSON_Value* book_copyright(int index) {
   EB_Book* book = select_book(index);
   if( book == NULL ) {
@@ -762,37 +2006,271 @@ JSON_Value* book_copyright(int index) {
   return NULL; // no menu or error
 }
 
+// keyword (type 4), cross (5) or multi (6) search. words are separated by \t, a multi search
+// starts with the multi search id (see book_multi) and may leave entries empty
+static EB_Error_Code search_words(EB_Book* book, int type, const char* s) {
+  char words[EB_MAX_MULTI_ENTRIES][MAX_SEARCH_WORD + 1];
+  const char* input_words[EB_MAX_MULTI_ENTRIES + 1];
+  char word[MAX_SEARCH_WORD + 1];
+  int multi_id = 0;
+  int count = 0;
+  const char* end;
+  size_t length;
+
+  if( type == 6 ) {
+    multi_id = atoi(s);
+    s = strchr(s, '\t');
+    if( s == NULL )
+      return EB_ERR_NO_WORD;
+    s++;
+  }
+  while( count < EB_MAX_MULTI_ENTRIES ) {
+    end = strchr(s, '\t');
+    if( end == NULL )
+      end = s + strlen(s);
+    length = end - s;
+    if( length > MAX_SEARCH_WORD )
+      length = MAX_SEARCH_WORD;
+    memcpy(word, s, length);
+    word[length] = '\0';
+    snprintf(words[count], sizeof(words[count]), "%s", convert_to_internal_encoding(book, word));
+    input_words[count] = words[count];
+    count++;
+    if( *end == '\0' )
+      break;
+    s = end + 1;
+  }
+  input_words[count] = NULL;
+  switch(type) {
+    case 4:
+      return eb_search_keyword(book, input_words);
+    case 5:
+      return eb_search_cross(book, input_words);
+    default:
+      return eb_search_multi(book, multi_id, input_words);
+  }
+}
+
 // type:
 // 0 prefix
 // 1 suffix
 // 2 exactly
+// 4 keyword, 5 cross, 6 multi: see search_words
+
+EB_Error_Code search_word(EB_Book* book, int type, const char* s) {
+  switch(type) {
+    case 4:
+    case 5:
+    case 6:
+      return search_words(book, type, s);
+    case 1:
+      return eb_search_endword(book, convert_to_internal_encoding(book, s));
+    case 2:
+      return eb_search_exactword(book, convert_to_internal_encoding(book, s));
+    default:
+      return eb_search_word(book, convert_to_internal_encoding(book, s));
+  }
+}
+
+// text positions of the hits output by a query, to drop duplicate hits. open addressing,
+// grown when half full
+typedef struct {
+  uint32_t* slots; // (page - 1) * EB_SIZE_PAGE + offset + 1, 0 if empty
+  size_t capacity; // power of 2
+  size_t count;
+} position_set_t;
+
+position_set_t seen_positions; // reused by every query
+
+static void position_set_clear(position_set_t* set) {
+  if( set->count > 0 )
+    memset(set->slots, 0, set->capacity * sizeof(uint32_t));
+  set->count = 0;
+}
+
+// returns 0 if key was already in set
+static int position_set_insert(position_set_t* set, uint32_t key) {
+  uint32_t hash = key * 2654435761u;
+  size_t i = (hash ^ (hash >> 16)) & (set->capacity - 1);
+  while( set->slots[i] != 0 ) {
+    if( set->slots[i] == key )
+      return 0;
+    i = (i + 1) & (set->capacity - 1);
+  }
+  set->slots[i] = key;
+  set->count++;
+  return 1;
+}
+
+// add position to set. returns 0 if it was already there
+static int position_set_add(position_set_t* set, const EB_Position* position) {
+  uint32_t* slots = set->slots;
+  size_t capacity = set->capacity;
+  size_t i;
+
+  if( (set->count + 1) * 2 > set->capacity ) {
+    set->capacity = capacity ? capacity * 2 : 256;
+    set->slots = (uint32_t*)calloc(set->capacity, sizeof(uint32_t));
+    set->count = 0;
+    for( i = 0; i < capacity; i++ ) {
+      if( slots[i] != 0 )
+        position_set_insert(set, slots[i]);
+    }
+    free(slots);
+  }
+  return position_set_insert(set, (uint32_t)(position->page - 1) * EB_SIZE_PAGE + position->offset + 1);
+}
+
+// queue reads of the headings and texts of hits before rendering them one by one, so that on a cold cache
+// the disk serves them together (io_uring) rather than one after another. a no-op without io_uring
+static void prefetch_hits(EB_Book* book, const EB_Hit* hits, int count) {
+  Zio* zio = &book->subbook_current->text_zio;
+  int i;
+  for( i = 0; i < count; i++ ) {
+    zio_prefetch(zio, ((off_t)hits[i].heading.page - 1) * EB_SIZE_PAGE + hits[i].heading.offset, PREFETCH_HEADING_SIZE);
+    zio_prefetch(zio, ((off_t)hits[i].text.page - 1) * EB_SIZE_PAGE + hits[i].text.offset, PREFETCH_TEXT_SIZE);
+  }
+  zio_submit_prefetch(0);
+}
+
+// render the hit entry and append heading, text, page, offset to array. returns 0 on failure
+int append_hit(EB_Book* book, const EB_Hit* hit, JSON_Array* array) {
+  EB_Error_Code error_code = eb_seek_text(book, &(hit->heading));
+  if (error_code != EB_SUCCESS) {
+    return 0;
+  }
+
+  error_code = eb_read_heading(book, NULL, &hookset_header, NULL, MAXLEN_HEADING, heading, &heading_length);
+  if (error_code != EB_SUCCESS) {
+    return 0;
+  }
+  // printf("heading: %s\n", heading);
+
+  error_code = eb_seek_text(book, &(hit->text));
+  if (error_code != EB_SUCCESS) {
+    return 0;
+  }
+
+  error_code = eb_read_text(book, current_bookw->app, &hookset, NULL, MAXLEN_TEXT, text, &text_length);
+  if (error_code != EB_SUCCESS) {
+    return 0;
+  }
+  // printf("text: %s\n", text);
+
+  json_array_append_string(array, heading);
+  json_array_append_string(array, text);
+  json_array_append_number(array, hit->text.page);
+  json_array_append_number(array, hit->text.offset);
+  return 1;
+}
+
+// headwords matching a glob pattern ('*' any chars, '?' one), or containing s if it has no wildcard.
+// normalized as full text search. output as book_query, the marker is the number of headwords to skip.
+// needs the headword suffix array sidecar
+JSON_Value* book_pattern(int index, int max_hit, const char* s, const char* marker) {
+  EB_Book* book = select_book(index);
+  if( book == NULL ) {
+    return NULL;
+  }
+  suffix_index_t* suffixes = current_suffixes();
+  heading_index_t* headings = current_headings();
+  if( suffixes == NULL || headings == NULL ) {
+    return NULL;
+  }
+
+  unsigned int pattern[FUZZY_MAX_WORD + 2];
+  size_t length = normalize_search_text(s, pattern + 1, FUZZY_MAX_WORD);
+  if( length == 0 ) {
+    return NULL;
+  }
+  size_t fragment = 0, fragment_length = 0;
+  size_t i, j, run;
+  uint32_t* words;
+  size_t word_count;
+  int skip = atoi(marker);
+  int found = 0;
+  uint32_t v;
+  EB_Hit hit;
+  char next_marker[16] = {0};
+
+  for( i = 1; i <= length && (pattern[i] != '*' && pattern[i] != '?'); i++ )
+    ;
+  if( i > length ) { // no wildcard: infix
+    pattern[0] = '*';
+    pattern[length + 1] = '*';
+    length += 2;
+  } else {
+    memmove(pattern, pattern + 1, length * sizeof(unsigned int));
+  }
+  // the longest run of literal chars narrows the words down through the suffix array
+  for( i = 0; i < length; i = j + 1 ) {
+    for( j = i; j < length && pattern[j] != '*' && pattern[j] != '?'; j++ )
+      ;
+    run = j - i;
+    if( run > fragment_length ) {
+      fragment = i;
+      fragment_length = run;
+    }
+  }
+  if( max_hit < 0 || max_hit > MAX_HITS )
+    max_hit = MAX_HITS;
+
+  JSON_Value *root_value = json_value_init_array();
+  JSON_Array *root_array = json_value_get_array(root_value);
+
+  word_count = suffix_index_containing(suffixes, pattern + fragment, fragment_length, &words);
+  for( i = 0; i < word_count; i++ ) {
+    if( !suffix_index_glob(suffixes, words[i], pattern, length) )
+      continue;
+    if( skip > 0 ) {
+      skip--;
+      continue;
+    }
+    if( found == max_hit ) { // there is more
+      sprintf(next_marker, "%d", atoi(marker) + found);
+      break;
+    }
+    for( v = suffixes->words[words[i]].value; v < suffixes->words[words[i] + 1].value; v++ ) {
+      heading_index_heading(headings, suffixes->values[v], &hit.heading);
+      hit.text.page = headings->records[suffixes->values[v]].text / EB_SIZE_PAGE + 1;
+      hit.text.offset = headings->records[suffixes->values[v]].text % EB_SIZE_PAGE;
+      append_hit(book, &hit, root_array);
+    }
+    found++;
+  }
+  free(words);
+  json_array_append_string(root_array, next_marker);
+  return root_value;
+}
 
 JSON_Value* book_query(int index, int type, int max_hit, const char* s, const char* marker) {
+  if( type == 3 )
+    return book_pattern(index, max_hit, s, marker);
+
   EB_Book* book = select_book(index);
   if( book == NULL ) {
     return NULL;
   }
 
-  int i,j;
+  int i;
+  int found; // hits output
+  int hit_total; // hits read, duplicates included
+  int chunk;
   EB_Error_Code error_code;
 
-  switch(type) {
-    case 1:
-      error_code = eb_search_endword(book, convert_to_internal_encoding(book, s));
-    break;
-    case 2:
-      error_code = eb_search_exactword(book, convert_to_internal_encoding(book, s));
-    break;
-    default:
-      error_code = eb_search_word(book, convert_to_internal_encoding(book, s));
-  }
+  error_code = search_word(book, type, s);
 
   if (error_code != EB_SUCCESS) {
     fprintf(stderr, "failed to search for the word, %s: %s\n", eb_error_message(error_code), s);
     return NULL;
   }
 
-  if( marker != NULL && strcmp(marker, "0") != 0 ) {
+  if( type >= 4 ) { // the marker is the number of hits already output
+    for( i = atoi(marker); i > 0; i -= hit_count ) {
+      if( eb_hit_list(book, i < MAX_HITS ? i : MAX_HITS, hits, &hit_count) != EB_SUCCESS || hit_count == 0 )
+        break;
+    }
+  } else if( marker != NULL && strcmp(marker, "0") != 0 ) {
     int page;
     int offset;
     int page_id;
@@ -815,77 +2293,47 @@ JSON_Value* book_query(int index, int type, int max_hit, const char* s, const ch
     book->search_contexts->in_group_entry = in_group_entry;
   }
 
-  if( max_hit < 0 || max_hit > MAX_HITS )
+  if( max_hit < 0 )
     max_hit = MAX_HITS;
-  error_code = eb_hit_list(book, max_hit, hits, &hit_count);
-  if (error_code != EB_SUCCESS) {
-    fprintf(stderr, "failed to get hit entries, %s\n", eb_error_message(error_code));
-    return NULL;
-  }
+  if( max_hit > MAX_QUERY_HITS ) // the whole reply is built in memory
+    max_hit = MAX_QUERY_HITS;
 
   JSON_Value *root_value = json_value_init_array();
   JSON_Array *root_array = json_value_get_array(root_value);
 
-  if( hit_count == 0 )
-    return root_value;
-
-  //insert sort hits indexes according to text position to help detecting duplication
-  hits_index_sorted[0] = 0;
-  for(i = 1; i < hit_count;i++) {
-    j = i;
-    while( j > 0 &&
-      ( hits[hits_index_sorted[j-1]].text.page >  hits[i].text.page ||
-        (hits[hits_index_sorted[j-1]].text.offset >  hits[i].text.offset && (hits[hits_index_sorted[j-1]].text.page ==  hits[i].text.page))
-      )
-    ) {
-      hits_index_sorted[j] = hits_index_sorted[j-1];
-      j--;
-    }
-    hits_index_sorted[j] = i;
-  }
-  // for( i = 0; i < hit_count; i++ )
-  //   printf("%d: %d, %d\n", hits_index_sorted[i], hits[hits_index_sorted[i]].text.page, hits[hits_index_sorted[i]].text.offset);
-
-  EB_Hit* last = NULL;
-  for (i = 0; i < hit_count; i++) {
-    j = hits_index_sorted[i];
-    //printf("hit: heading: %d %d text: %d %d\n", hits[j].heading.page, hits[j].heading.offset, hits[j].text.page, hits[j].text.offset);
-    
-    if( last != NULL && memcmp(&(last->text), &(hits[j].text), sizeof(EB_Position)) == 0 ) {
-      // printf("detech duplicate");
-      continue;
-    }
-
-    error_code = eb_seek_text(book, &(hits[j].heading));
-    if (error_code != EB_SUCCESS) {
-      continue;
-    }
-
-    error_code = eb_read_heading(book, NULL, &hookset_header, NULL, MAXLEN_HEADING, heading, &heading_length);
-    if (error_code != EB_SUCCESS) {
-      continue;
-    }
-    // printf("heading: %s\n", heading);
-
-    error_code = eb_seek_text(book, &(hits[j].text));
+  // hits are read a chunk at a time and rendered as they come, never more than are left to output,
+  // so the search context stops right after the last hit used
+  position_set_clear(&seen_positions);
+  for( found = 0, hit_total = 0, chunk = 0; found < max_hit; ) {
+    chunk = max_hit - found < MAX_HITS ? max_hit - found : MAX_HITS;
+    error_code = eb_hit_list(book, chunk, hits, &hit_count);
     if (error_code != EB_SUCCESS) {
-      continue;
+      fprintf(stderr, "failed to get hit entries, %s\n", eb_error_message(error_code));
+      json_value_free(root_value);
+      return NULL;
     }
-
-    error_code = eb_read_text(book, current_bookw->app, &hookset, NULL, MAXLEN_TEXT, text, &text_length);
-    if (error_code != EB_SUCCESS) {
-      continue;
+    hit_total += hit_count;
+    if( hit_count == 0 )
+      break;
+    prefetch_hits(book, hits, hit_count);
+    for( i = 0; i < hit_count; i++ ) {
+      //printf("hit: heading: %d %d text: %d %d\n", hits[i].heading.page, hits[i].heading.offset, hits[i].text.page, hits[i].text.offset);
+      if( !position_set_add(&seen_positions, &hits[i].text) ) // duplicate
+        continue;
+      if( append_hit(book, &hits[i], root_array) )
+        found++;
     }
-    // printf("text: %s\n", text);
-
-    last = &hits[j];
-    json_array_append_string(root_array, heading);
-    json_array_append_string(root_array, text);
-    json_array_append_number(root_array, hits[j].text.page);
-    json_array_append_number(root_array, hits[j].text.offset);
+    if( hit_count < chunk )
+      break;
   }
+  if( hit_total == 0 )
+    return root_value;
+
   char nextPageMarker[1024] = {0};
-  if( book->search_contexts->comparison_result >= 0) {
+  if( type >= 4 ) {
+    if( hit_count == chunk ) // an AND of several contexts, none of which tells alone whether there is more
+      sprintf(nextPageMarker, "%d", atoi(marker) + hit_total);
+  } else if( book->search_contexts->comparison_result >= 0) {
     sprintf(nextPageMarker, "%d_%d_%d_%d_%d_%d_%d_%d",
       book->search_contexts->page,
       book->search_contexts->offset,
@@ -902,13 +2350,310 @@ JSON_Value* book_query(int index, int type, int max_hit, const char* s, const ch
   return root_value;
 }
 
+// whether text (code points) contains query
+static int contains_code_points(const unsigned int* text, size_t length, const unsigned int* query, size_t query_length) {
+  size_t i;
+  for( i = 0; i + query_length <= length; i++ ) {
+    if( memcmp(text + i, query, query_length * sizeof(unsigned int)) == 0 )
+      return 1;
+  }
+  return 0;
+}
+
+// headwords within max_distance edits of s (normalized as full text search), nearest first:
+// [[heading, distance, page, offset], ...] with the text position of each. needs the heading index sidecar
+JSON_Value* book_fuzzy(int index, int max_distance, int max_hit, const char* s) {
+  EB_Book* book = select_book(index);
+  if( book == NULL ) {
+    return NULL;
+  }
+  fuzzy_trie_t* words = current_words();
+  heading_index_t* headings = current_headings();
+  if( words == NULL || headings == NULL ) {
+    return NULL;
+  }
+
+  unsigned int query[FUZZY_MAX_WORD];
+  fuzzy_match_t matches[MAX_HITS];
+  EB_Position position;
+  size_t match_count;
+  size_t i;
+
+  if( max_hit < 0 || max_hit > MAX_HITS )
+    max_hit = MAX_HITS;
+  match_count = fuzzy_trie_search(words, query, normalize_search_text(s, query, FUZZY_MAX_WORD), max_distance, matches, max_hit);
+
+  JSON_Value *root_value = json_value_init_array();
+  JSON_Array *root_array = json_value_get_array(root_value);
+  for( i = 0; i < match_count; i++ ) {
+    heading_index_heading(headings, matches[i].value, &position);
+    if( eb_seek_text(book, &position) != EB_SUCCESS
+      || eb_read_heading(book, NULL, &hookset_header, NULL, MAXLEN_HEADING, heading, &heading_length) != EB_SUCCESS ) {
+      continue;
+    }
+    JSON_Value* match_value = json_value_init_array();
+    JSON_Array* match_array = json_value_get_array(match_value);
+    json_array_append_string(match_array, heading);
+    json_array_append_number(match_array, matches[i].distance);
+    json_array_append_number(match_array, headings->records[matches[i].value].text / EB_SIZE_PAGE + 1);
+    json_array_append_number(match_array, headings->records[matches[i].value].text % EB_SIZE_PAGE);
+    json_array_append_value(root_array, match_value);
+  }
+  return root_value;
+}
+
+// entries whose text contains s (normalized: case, width, kana and spaces folded, markup ignored), in
+// text order. output as book_query; marker is the entry number to continue from ("0" at first), the
+// trailing marker is empty when there are no more. needs the full text index sidecar
+JSON_Value* book_fulltext(int index, int max_hit, const char* marker, const char* s) {
+  EB_Book* book = select_book(index);
+  if( book == NULL ) {
+    return NULL;
+  }
+  fulltext_index_t* fulltext = current_fulltext();
+  entry_index_t* entries = current_entries();
+  if( fulltext == NULL || entries == NULL ) {
+    return NULL;
+  }
+
+  unsigned int query[MAX_FULLTEXT_QUERY];
+  size_t query_length = normalize_search_text(s, query, MAX_FULLTEXT_QUERY);
+  uint32_t candidates[FULLTEXT_BATCH];
+  size_t candidate_count;
+  uint32_t from = strtoul(marker, NULL, 10);
+  EB_Position position;
+  int found = 0;
+  size_t i;
+  char next_marker[16] = {0};
+
+  if( max_hit < 0 || max_hit > MAX_HITS )
+    max_hit = MAX_HITS;
+
+  JSON_Value *root_value = json_value_init_array();
+  JSON_Array *root_array = json_value_get_array(root_value);
+
+  while( found < max_hit ) {
+    candidate_count = fulltext_candidates(fulltext, query, query_length, from, candidates, FULLTEXT_BATCH);
+    for( i = 0; i < candidate_count && found < max_hit; i++ ) {
+      from = candidates[i] + 1;
+      if( candidates[i] >= entries->count )
+        continue;
+      entry_index_position(entries, candidates[i], &position);
+      // the grams only narrow it down, check the text itself. it is rendered once: the text read for
+      // the check is the one output, as append_entry would render it
+      if( eb_seek_text(book, &position) != EB_SUCCESS
+        || eb_read_text(book, current_bookw->app, &hookset, NULL, MAXLEN_TEXT, text, &text_length) != EB_SUCCESS
+        || !contains_code_points(normalized, normalize_search_text(text, normalized, MAXLEN_TEXT), query, query_length)
+        || !read_entry_heading(book, &position) )
+        continue;
+      json_array_append_string(root_array, heading);
+      json_array_append_string(root_array, text);
+      json_array_append_number(root_array, position.page);
+      json_array_append_number(root_array, position.offset);
+      found++;
+    }
+    if( candidate_count < FULLTEXT_BATCH ) {
+      if( i == candidate_count )
+        from = 0; // exhausted
+      break;
+    }
+  }
+  if( found == max_hit && from != 0 )
+    sprintf(next_marker, "%u", from);
+  json_array_append_string(root_array, next_marker);
+  return root_value;
+}
+
+typedef struct {
+  int input_index;
+  EB_Error_Code error_code;
+  EB_Search_Context context; // state after the index descent, canonicalized word included
+} batch_word_t;
+
+batch_word_t batch_words[MAX_BATCH_WORDS];
+
+// order of the index: leaf page first, then the canonicalized word
+int batch_word_compare(const void* a, const void* b) {
+  const batch_word_t* x = (const batch_word_t*)a;
+  const batch_word_t* y = (const batch_word_t*)b;
+  if( x->context.page != y->context.page )
+    return x->context.page < y->context.page ? -1 : 1;
+  int r = strcmp(x->context.canonicalized_word, y->context.canonicalized_word);
+  if( r != 0 )
+    return r;
+  return x->input_index - y->input_index;
+}
+
+// look up many words at once. words are separated by \t.
+// the words are descended to their leaf pages first, then hit lists are read in index order,
+// so words sharing index pages share the page reads. results are output in input order,
+// one [heading, text, page, offset, ...] array per word.
+JSON_Value* book_query_batch(int index, int type, int max_hit, char* words) {
+  // one word, one search context: prefix, suffix and exact word search only
+  if( type < 0 || type > 2 ) {
+    return NULL;
+  }
+  EB_Book* book = select_book(index);
+  if( book == NULL ) {
+    return NULL;
+  }
+
+  int word_count = 0;
+  int i, j;
+  char* saveptr = NULL;
+  char* word;
+  EB_Error_Code error_code;
+  JSON_Value* results[MAX_BATCH_WORDS] = {0};
+
+  if( max_hit < 0 || max_hit > MAX_HITS )
+    max_hit = MAX_HITS;
+
+  for( word = strtok_r(words, "\t\r\n", &saveptr); word != NULL && word_count < MAX_BATCH_WORDS;
+    word = strtok_r(NULL, "\t\r\n", &saveptr) ) {
+    batch_word_t* w = &batch_words[word_count];
+    w->input_index = word_count++;
+    w->error_code = search_word(book, type, word);
+    if( w->error_code == EB_SUCCESS )
+      memcpy(&w->context, book->search_contexts, sizeof(EB_Search_Context));
+    else
+      memset(&w->context, 0, sizeof(EB_Search_Context));
+  }
+
+  qsort(batch_words, word_count, sizeof(batch_word_t), batch_word_compare);
+
+  for( i = 0; i < word_count; i++ ) {
+    batch_word_t* w = &batch_words[i];
+    if( w->error_code != EB_SUCCESS ) {
+      results[w->input_index] = json_value_init_array();
+      continue;
+    }
+    if( i > 0 && batch_words[i-1].error_code == EB_SUCCESS
+      && w->context.page == batch_words[i-1].context.page
+      && strcmp(w->context.canonicalized_word, batch_words[i-1].context.canonicalized_word) == 0
+      && strcmp(w->context.word, batch_words[i-1].context.word) == 0 ) {
+      // same word repeated in the input
+      results[w->input_index] = json_value_deep_copy(results[batch_words[i-1].input_index]);
+      continue;
+    }
+
+    memcpy(book->search_contexts, &w->context, sizeof(EB_Search_Context));
+    results[w->input_index] = json_value_init_array();
+    JSON_Array* array = json_value_get_array(results[w->input_index]);
+    error_code = eb_hit_list(book, max_hit, hits, &hit_count);
+    if( error_code != EB_SUCCESS ) {
+      continue;
+    }
+    position_set_clear(&seen_positions);
+    prefetch_hits(book, hits, hit_count);
+    for( j = 0; j < hit_count; j++ ) {
+      if( !position_set_add(&seen_positions, &hits[j].text) ) // duplicate
+        continue;
+      append_hit(book, &hits[j], array);
+    }
+  }
+
+  JSON_Value *root_value = json_value_init_array();
+  JSON_Array *root_array = json_value_get_array(root_value);
+  for( i = 0; i < word_count; i++ ) {
+    json_array_append_value(root_array, results[i]);
+  }
+  return root_value;
+}
+
+// whether the index has an entry that matches s (prefix or exact search type), the first hit goes to hit
+static int has_hit(EB_Book* book, int type, const char* s, EB_Hit* hit) {
+  int count;
+  if( search_word(book, type, s) != EB_SUCCESS )
+    return 0;
+  if( eb_hit_list(book, 1, hit, &count) != EB_SUCCESS )
+    return 0;
+  return count > 0;
+}
+
+// whether the heading of hit is word itself, so that an exact search for word would find it too
+static int hit_is_word(EB_Book* book, const EB_Hit* hit, const char* word) {
+  return eb_seek_text(book, &hit->heading) == EB_SUCCESS
+    && eb_read_heading(book, NULL, &hookset_header, NULL, MAXLEN_HEADING, heading, &heading_length) == EB_SUCCESS
+    && strcmp(heading, word) == 0;
+}
+
+// for every char position of text, find the longest headword of each subbook that starts there.
+// indexes: comma separated subbook indexes.
+// outputs one array per char position, holding [subbook_index, length_in_chars, heading, page, offset]
+// for each subbook that has a match there.
+JSON_Value* book_segment(const char* indexes, const char* s) {
+  int offsets[MAX_SEGMENT_CHARS + 1]; // byte offset of each char
+  int char_count = 0;
+  int i, length, longest;
+  int index;
+  const char* p;
+  char word[MAX_SEGMENT_WORD_CHARS * 4 + 1];
+  EB_Hit hit, longest_hit;
+
+  for( p = s; *p && *p != '\r' && *p != '\n' && char_count < MAX_SEGMENT_CHARS; p += utf8_char_length(p) ) {
+    offsets[char_count++] = p - s;
+  }
+  offsets[char_count] = p - s;
+
+  JSON_Value *root_value = json_value_init_array();
+  JSON_Array *root_array = json_value_get_array(root_value);
+  for( i = 0; i < char_count; i++ ) {
+    json_array_append_value(root_array, json_value_init_array());
+  }
+
+  for( p = indexes; *p; ) {
+    if( sscanf(p, "%d", &index) != 1 )
+      break;
+    EB_Book* book = select_book(index);
+    for( i = 0; book != NULL && i < char_count; i++ ) {
+      longest = 0;
+      for( length = 1; length <= MAX_SEGMENT_WORD_CHARS && i + length <= char_count; length++ ) {
+        memcpy(word, s + offsets[i], offsets[i + length] - offsets[i]);
+        word[offsets[i + length] - offsets[i]] = '\0';
+        // no headword starts with this prefix, so no longer one matches either
+        if( !has_hit(book, 0, word, &hit) )
+          break;
+        // a prefix search lists the word itself first when it is a headword: skip the exact search then
+        if( hit_is_word(book, &hit, word) || has_hit(book, 2, word, &hit) ) {
+          longest = length;
+          longest_hit = hit;
+        }
+      }
+      if( longest == 0 )
+        continue;
+      if( eb_seek_text(book, &longest_hit.heading) != EB_SUCCESS
+        || eb_read_heading(book, NULL, &hookset_header, NULL, MAXLEN_HEADING, heading, &heading_length) != EB_SUCCESS ) {
+        continue;
+      }
+      JSON_Array* matches = json_array_get_array(root_array, i);
+      JSON_Value* match_value = json_value_init_array();
+      JSON_Array* match = json_value_get_array(match_value);
+      json_array_append_number(match, index);
+      json_array_append_number(match, longest);
+      json_array_append_string(match, heading);
+      json_array_append_number(match, longest_hit.text.page);
+      json_array_append_number(match, longest_hit.text.offset);
+      json_array_append_value(matches, match_value);
+    }
+    while( *p && *p != ',' )
+      p++;
+    if( *p == ',' )
+      p++;
+  }
+
+  return root_value;
+}
+
 JSON_Value* book_list() {
   JSON_Value *root_value = json_value_init_array();
   JSON_Array *root_array = json_value_get_array(root_value);
 
   book_node_t* current = books;
   while( current != NULL ) {
-    json_array_append_string(root_array, current->title);
+    if( current->book == NULL )
+      json_array_append_null(root_array); // retired
+    else
+      json_array_append_string(root_array, current->title);
     current = current->next;
   }
 
@@ -3,6 +3,8 @@
 #define _BOOK_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
 #include <mxml.h>
 #include <ebu/eb.h>
 #include <ebu/error.h>
@@ -13,30 +15,67 @@
 
 typedef struct {
   EB_Book book;
+  char* path;
+  dev_t dev; // identity of the book dir, to notice a dir replaced under the same name
+  ino_t ino;
   EB_Appendix* app;
   mxml_node_t *gaijimap_tree;
   EB_Subbook_Code subbook_list[EB_MAX_SUBBOOKS]; // EB_MAX_SUBBOOKS: 50
   size_t subbook_count;
 } book_t;
 
+// a binary object stored plain in a book file: head_length bytes at head (composed, as a wav header),
+// then length bytes of fd from offset
+typedef struct {
+  const char* head;
+  size_t head_length;
+  int fd;
+  off_t offset;
+  size_t length;
+} binary_region_t;
+
 extern EB_Hookset hookset;
 extern book_t* current_bookw;
 
 void books_init(const char* rootpath);
+void books_scan();
+JSON_Value* books_reload();
+int books_watch();
+int books_poll_watch();
+void books_entries_dir(const char* dir);
+int books_build_entries(int jobs);
+EB_Book* select_book(int index);
+uint64_t book_current_key();
+int book_index_of_key(uint64_t key);
+int book_current_names(char* book_name, char* subbook_name);
 book_t* book_load(const char* path);
 void book_unload(book_t* book);
+void book_retire(book_t* book);
 char* convert_to_internal_encoding(EB_Book* book, char* s);
 JSON_Value* book_query(int index, int type, int max_hit, const char* s, const char* marker);
-JSON_Value* book_get(int index, int page, int offset);
+JSON_Value* book_fuzzy(int index, int max_distance, int max_hit, const char* s);
+JSON_Value* book_fulltext(int index, int max_hit, const char* marker, const char* s);
+JSON_Value* book_query_batch(int index, int type, int max_hit, char* words);
+JSON_Value* book_segment(const char* indexes, const char* s);
+JSON_Value* book_headings(int index, int page, int offset);
+JSON_Value* book_get(int index, int page, int offset, int resolve_references);
+JSON_Value* book_get_batch(int index, int flags, const char* positions);
+JSON_Value* book_neighbors(int index, int page, int offset, int before, int after, int flags);
+JSON_Value* book_entries(int index, int first, int count, int flags);
 JSON_Value* book_menu(int index);
 JSON_Value* book_text(int index);
 JSON_Value* book_page(int index, int page);
 JSON_Value* book_copyright(int index);
-char* book_binary_mono(int index, int page, int offset, int width, int height, size_t* size);
-char* book_binary_color(int index, int page, int offset, size_t* size);
-char* book_binary_wav(int index, int page, int offset, int endpage, int endoffset, size_t* size);
+JSON_Value* book_multi(int index);
+JSON_Value* book_mirror(int index);
+char* book_binary_mono(int index, int page, int offset, int width, int height, int png, size_t* size);
+char* book_binary_color(int index, int page, int offset, off_t start, size_t length, binary_region_t* region, size_t* size);
+JSON_Value* book_binary_probe(int index, char kind, const int* args);
+char* book_binary_wav(int index, int page, int offset, int endpage, int endoffset, off_t start, size_t length,
+  binary_region_t* region, size_t* size);
 char* book_binary_gaiji_wide(int index, int code, size_t* size); // gaiji bitmap to png
 char* book_binary_gaiji_narrow(int index, int code, size_t* size);
+char* book_gaiji_atlas(int index, int wide, const char* codes, JSON_Value** table, size_t* size);
 JSON_Value* book_list();
 
 #endif
@@ -1,6 +1,7 @@
 
 #include "conv.h"
 #include <iconv.h>
+#include <string.h>
 
 char out[MAX_STR_LEN] = {0};
 iconv_t iso8859_iconver;
@@ -41,4 +42,80 @@ char* conv_utf16be_str(char* in, size_t len) {
 
 char* conv_utf8_to_euc_str(char* in, size_t len) {
 	return conv(utf8_to_euc_iconver, in, len);
-}
\ No newline at end of file
+}
+
+int utf8_char_length(const char* s) {
+	unsigned char c = *s;
+	if( c < 0x80 )
+		return 1;
+	if( (c & 0xe0) == 0xc0 && s[1] )
+		return 2;
+	if( (c & 0xf0) == 0xe0 && s[1] && s[2] )
+		return 3;
+	if( (c & 0xf8) == 0xf0 && s[1] && s[2] && s[3] )
+		return 4;
+	return 1; // broken sequence, step over one byte
+}
+
+unsigned int utf8_decode(const char* s, int* length) {
+	const unsigned char* u = (const unsigned char*)s;
+	*length = utf8_char_length(s);
+	switch( *length ) {
+		case 2:
+			return ((u[0] & 0x1f) << 6) | (u[1] & 0x3f);
+		case 3:
+			return ((u[0] & 0x0f) << 12) | ((u[1] & 0x3f) << 6) | (u[2] & 0x3f);
+		case 4:
+			return ((u[0] & 0x07) << 18) | ((u[1] & 0x3f) << 12) | ((u[2] & 0x3f) << 6) | (u[3] & 0x3f);
+		default:
+			return u[0];
+	}
+}
+
+// tags of the markup written by the hooks of book.c: [tag ...] and [/tag ...]
+static const char* markup_tags[] = {
+	"superscript", "keyword", "subscript", "decoration", "emphasis", "reference", "mono", "image", "wav", NULL
+};
+
+// length of the markup tag at s, 0 if there is none
+static size_t markup_length(const char* s) {
+	const char* p = s + 1;
+	const char* end;
+	size_t length;
+	int i;
+
+	if( *p == '/' )
+		p++;
+	for( i = 0; markup_tags[i] != NULL; i++ ) {
+		length = strlen(markup_tags[i]);
+		if( strncmp(p, markup_tags[i], length) == 0 && (p[length] == ']' || p[length] == ' ') )
+			return (end = strchr(p + length, ']')) != NULL ? end + 1 - s : 0;
+	}
+	return 0;
+}
+
+size_t normalize_search_text(const char* s, unsigned int* out, size_t max) {
+	size_t n = 0;
+	size_t skip;
+	int length;
+	unsigned int c;
+
+	while( *s && n < max ) {
+		if( *s == '[' && (skip = markup_length(s)) > 0 ) {
+			s += skip; // markup written by the hooks
+			continue;
+		}
+		c = utf8_decode(s, &length);
+		s += length;
+		if( c >= 0xff01 && c <= 0xff5e ) // full width ascii
+			c -= 0xfee0;
+		if( c >= 'A' && c <= 'Z' )
+			c += 'a' - 'A';
+		else if( c >= 0x30a1 && c <= 0x30f6 ) // katakana -> hiragana
+			c -= 0x60;
+		if( c <= ' ' || c == 0x3000 )
+			continue;
+		out[n++] = c;
+	}
+	return n;
+}
@@ -11,6 +11,9 @@ char* conv_iso8859_str(char* in, size_t len);
 char* conv_euc_str(char* in, size_t len);
 char* conv_utf16be_str(char* in, size_t len);
 char* conv_utf8_to_euc_str(char* in, size_t len); // utf8 -> euc for internal usage
+int utf8_char_length(const char* s); // byte length of the utf8 char s starts with
+unsigned int utf8_decode(const char* s, int* length); // code point s starts with
+size_t normalize_search_text(const char* s, unsigned int* out, size_t max); // code points for full text search
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,350 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <linux/limits.h>
+#include <ebu/error.h>
+#include <ebu/text.h>
+
+#include "entries.h"
+
+#define ENTRY_INDEX_MAGIC "EBENTRY1"
+#define HEADING_INDEX_MAGIC "EBHEAD01"
+#define ENTRY_INDEX_FLUSH 65536 // entries scanned between checkpoints of an unfinished build
+
+static uint32_t position_to_start(const EB_Position* position) {
+  return (uint32_t)(position->page - 1) * EB_SIZE_PAGE + position->offset;
+}
+
+// header of an index matching the current subbook's text. returns -1 if it has no text
+int sidecar_identify(EB_Book* book, const char* magic, sidecar_header_t* header) {
+  struct stat st;
+  EB_Position position;
+
+  if( eb_text(book, &position) != EB_SUCCESS || zio_source_status(&book->subbook_current->text_zio, &st) != 0 )
+    return -1;
+  memset(header, 0, sizeof(sidecar_header_t));
+  memcpy(header->magic, magic, sizeof(header->magic));
+  header->text_size = st.st_size;
+  header->text_mtime = st.st_mtime;
+  header->text_start = position_to_start(&position);
+  return 0;
+}
+
+static int sidecar_same_text(const sidecar_header_t* a, const sidecar_header_t* b) {
+  return memcmp(a->magic, b->magic, sizeof(a->magic)) == 0 && a->text_size == b->text_size
+    && a->text_mtime == b->text_mtime && a->text_start == b->text_start;
+}
+
+static int entry_index_checkpoint(int fd, sidecar_header_t* header, const uint32_t* starts, uint32_t n) {
+  off_t offset = sizeof(sidecar_header_t) + (off_t)header->count * sizeof(uint32_t);
+  if( n > 0 && pwrite(fd, starts, n * sizeof(uint32_t), offset) != (ssize_t)(n * sizeof(uint32_t)) )
+    return -1;
+  header->count += n;
+  if( pwrite(fd, header, sizeof(sidecar_header_t), 0) != sizeof(sidecar_header_t) )
+    return -1;
+  return 0;
+}
+
+// scan the text of the current subbook of book from its start with eb_forward_text, writing every entry
+// start to path. an unfinished file of the same text is continued from its last checkpoint
+int entry_index_build(EB_Book* book, EB_Appendix* app, const char* path) {
+  sidecar_header_t header;
+  sidecar_header_t expected;
+  EB_Position position;
+  EB_Error_Code error_code;
+  uint32_t* pending;
+  uint32_t pending_count = 0;
+  uint32_t last;
+  int fd;
+
+  if( sidecar_identify(book, ENTRY_INDEX_MAGIC, &expected) != 0 )
+    return -1;
+  fd = open(path, O_RDWR | O_CREAT, 0644);
+  if( fd < 0 )
+    return -1;
+  if( pread(fd, &header, sizeof(header), 0) != sizeof(header) || !sidecar_same_text(&header, &expected) ) {
+    header = expected;
+  } else if( header.complete ) {
+    close(fd);
+    return 0;
+  }
+  // drop whatever was written after the last checkpoint
+  if( ftruncate(fd, sizeof(header) + (off_t)header.count * sizeof(uint32_t)) != 0 )
+    goto failed_close;
+
+  pending = (uint32_t*)malloc(ENTRY_INDEX_FLUSH * sizeof(uint32_t));
+  if( header.count == 0 ) {
+    last = header.text_start;
+    pending[pending_count++] = last;
+  } else if( pread(fd, &last, sizeof(last), sizeof(header) + (off_t)(header.count - 1) * sizeof(uint32_t)) != sizeof(last) ) {
+    goto failed;
+  }
+  position.page = last / EB_SIZE_PAGE + 1;
+  position.offset = last % EB_SIZE_PAGE;
+  if( eb_seek_text(book, &position) != EB_SUCCESS )
+    goto failed;
+
+  while( 1 ) {
+    error_code = eb_forward_text(book, app);
+    if( error_code == EB_ERR_END_OF_CONTENT )
+      break;
+    if( error_code != EB_SUCCESS || eb_tell_text(book, &position) != EB_SUCCESS )
+      goto failed;
+    if( position_to_start(&position) <= last ) // no progress, the text is over
+      break;
+    last = position_to_start(&position);
+    pending[pending_count++] = last;
+    if( pending_count == ENTRY_INDEX_FLUSH ) {
+      if( entry_index_checkpoint(fd, &header, pending, pending_count) != 0 )
+        goto failed;
+      pending_count = 0;
+    }
+  }
+
+  header.complete = 1;
+  if( entry_index_checkpoint(fd, &header, pending, pending_count) != 0 || fsync(fd) != 0 )
+    goto failed;
+  free(pending);
+  close(fd);
+  return 0;
+
+failed:
+  // entries after the last checkpoint are lost, the next build scans them again
+  free(pending);
+failed_close:
+  close(fd);
+  return -1;
+}
+
+// mmap a finished sidecar of the current subbook's text, at least record_size bytes per record.
+// returns its header, NULL if missing, unfinished or stale
+const sidecar_header_t* sidecar_map(EB_Book* book, const char* path, const char* magic,
+  size_t record_size, size_t* map_size) {
+  sidecar_header_t expected;
+  const sidecar_header_t* header;
+  struct stat st;
+  void* map;
+  int fd;
+
+  if( sidecar_identify(book, magic, &expected) != 0 )
+    return NULL;
+  fd = open(path, O_RDONLY);
+  if( fd < 0 )
+    return NULL;
+  if( fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(sidecar_header_t) ) {
+    close(fd);
+    return NULL;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if( map == MAP_FAILED )
+    return NULL;
+
+  header = (const sidecar_header_t*)map;
+  if( !header->complete || !sidecar_same_text(header, &expected)
+    || st.st_size < (off_t)(sizeof(sidecar_header_t) + (off_t)header->count * record_size) ) {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+  *map_size = st.st_size;
+  return header;
+}
+
+entry_index_t* entry_index_open(EB_Book* book, const char* path) {
+  size_t map_size;
+  const sidecar_header_t* header = sidecar_map(book, path, ENTRY_INDEX_MAGIC, sizeof(uint32_t), &map_size);
+  if( header == NULL )
+    return NULL;
+
+  entry_index_t* index = (entry_index_t*)malloc(sizeof(entry_index_t));
+  index->map = (void*)header;
+  index->map_size = map_size;
+  index->starts = (const uint32_t*)(header + 1);
+  index->count = header->count;
+  return index;
+}
+
+void entry_index_close(entry_index_t* index) {
+  if( index == NULL )
+    return;
+  munmap(index->map, index->map_size);
+  free(index);
+}
+
+// index of the first entry starting at or after position, count if there is none
+uint32_t entry_index_find(const entry_index_t* index, const EB_Position* position) {
+  uint32_t start = position_to_start(position);
+  uint32_t low = 0;
+  uint32_t high = index->count;
+  while( low < high ) {
+    uint32_t middle = low + (high - low) / 2;
+    if( index->starts[middle] < start )
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+void entry_index_position(const entry_index_t* index, uint32_t n, EB_Position* position) {
+  position->page = index->starts[n] / EB_SIZE_PAGE + 1;
+  position->offset = index->starts[n] % EB_SIZE_PAGE;
+}
+
+typedef struct {
+  heading_record_t* records;
+  size_t count;
+  size_t capacity;
+  char* keys; // keys of records, not null terminated
+  size_t keys_size;
+  size_t keys_capacity;
+} heading_collector_t;
+
+static int collect_heading(void* data, const char* word, size_t word_length, const EB_Hit* hit) {
+  heading_collector_t* collector = (heading_collector_t*)data;
+  heading_record_t* record;
+
+  if( collector->count == collector->capacity ) {
+    collector->capacity = collector->capacity ? collector->capacity * 2 : 65536;
+    collector->records = (heading_record_t*)realloc(collector->records, collector->capacity * sizeof(heading_record_t));
+  }
+  while( collector->keys_size + word_length > collector->keys_capacity ) {
+    collector->keys_capacity = collector->keys_capacity ? collector->keys_capacity * 2 : 1024 * 1024;
+    collector->keys = (char*)realloc(collector->keys, collector->keys_capacity);
+  }
+  record = &collector->records[collector->count++];
+  record->text = position_to_start(&hit->text);
+  record->heading = position_to_start(&hit->heading);
+  record->key = collector->keys_size;
+  record->key_length = word_length;
+  memcpy(collector->keys + collector->keys_size, word, word_length);
+  collector->keys_size += word_length;
+  return 0;
+}
+
+static const char* sorting_keys; // qsort has no context argument
+
+static int heading_record_compare(const void* a, const void* b) {
+  const heading_record_t* x = (const heading_record_t*)a;
+  const heading_record_t* y = (const heading_record_t*)b;
+  int result;
+
+  if( x->text != y->text )
+    return x->text < y->text ? -1 : 1;
+  if( x->heading != y->heading )
+    return x->heading < y->heading ? -1 : 1;
+  result = memcmp(sorting_keys + x->key, sorting_keys + y->key, x->key_length < y->key_length ? x->key_length : y->key_length);
+  if( result != 0 )
+    return result;
+  return (int)x->key_length - (int)y->key_length;
+}
+
+// walk the word indexes of the current subbook of book and write every (text, heading, key) once, sorted
+// by text position, to path
+int heading_index_build(EB_Book* book, const char* path) {
+  sidecar_header_t header;
+  heading_collector_t collector;
+  char tmp_path[PATH_MAX];
+  FILE* fp;
+  size_t i;
+  size_t unique = 0;
+  uint32_t keys_size = 0;
+  int write_error;
+
+  if( sidecar_identify(book, HEADING_INDEX_MAGIC, &header) != 0 )
+    return -1;
+  memset(&collector, 0, sizeof(collector));
+  if( eb_walk_words(book, collect_heading, &collector) != EB_SUCCESS )
+    goto failed;
+
+  sorting_keys = collector.keys;
+  qsort(collector.records, collector.count, sizeof(heading_record_t), heading_record_compare);
+  // drop the entries found in more than one index, and pack the keys in record order
+  for( i = 0; i < collector.count; i++ ) {
+    if( unique > 0 && heading_record_compare(&collector.records[unique - 1], &collector.records[i]) == 0 )
+      continue;
+    collector.records[unique++] = collector.records[i];
+  }
+
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+  fp = fopen(tmp_path, "wb");
+  if( fp == NULL )
+    goto failed;
+  header.complete = 1;
+  header.count = unique;
+  fwrite(&header, sizeof(header), 1, fp);
+  for( i = 0; i < unique; i++ ) {
+    heading_record_t record = collector.records[i];
+    record.key = keys_size;
+    keys_size += record.key_length;
+    fwrite(&record, sizeof(record), 1, fp);
+  }
+  for( i = 0; i < unique; i++ )
+    fwrite(collector.keys + collector.records[i].key, 1, collector.records[i].key_length, fp);
+  write_error = ferror(fp);
+  if( fclose(fp) != 0 || write_error || rename(tmp_path, path) != 0 ) {
+    unlink(tmp_path);
+    goto failed;
+  }
+  free(collector.records);
+  free(collector.keys);
+  return 0;
+
+failed:
+  free(collector.records);
+  free(collector.keys);
+  return -1;
+}
+
+heading_index_t* heading_index_open(EB_Book* book, const char* path) {
+  size_t map_size;
+  const sidecar_header_t* header = sidecar_map(book, path, HEADING_INDEX_MAGIC, sizeof(heading_record_t), &map_size);
+  if( header == NULL )
+    return NULL;
+
+  heading_index_t* index = (heading_index_t*)malloc(sizeof(heading_index_t));
+  index->map = (void*)header;
+  index->map_size = map_size;
+  index->records = (const heading_record_t*)(header + 1);
+  index->count = header->count;
+  index->keys = (const char*)(index->records + index->count);
+  index->keys_size = map_size - sizeof(sidecar_header_t) - index->count * sizeof(heading_record_t);
+  return index;
+}
+
+void heading_index_close(heading_index_t* index) {
+  if( index == NULL )
+    return;
+  munmap(index->map, index->map_size);
+  free(index);
+}
+
+// index of the first record whose text starts at or after position, count if there is none
+uint32_t heading_index_find(const heading_index_t* index, const EB_Position* position) {
+  uint32_t start = position_to_start(position);
+  uint32_t low = 0;
+  uint32_t high = index->count;
+  while( low < high ) {
+    uint32_t middle = low + (high - low) / 2;
+    if( index->records[middle].text < start )
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+// whether record n is about the text at position
+int heading_index_match(const heading_index_t* index, uint32_t n, const EB_Position* position) {
+  return n < index->count && index->records[n].text == position_to_start(position);
+}
+
+void heading_index_heading(const heading_index_t* index, uint32_t n, EB_Position* position) {
+  position->page = index->records[n].heading / EB_SIZE_PAGE + 1;
+  position->offset = index->records[n].heading % EB_SIZE_PAGE;
+}
@@ -0,0 +1,61 @@
+#ifndef _ENTRIES_H
+#define _ENTRIES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ebu/eb.h>
+
+// header of every sidecar file
+typedef struct {
+  char magic[8];
+  uint32_t complete; // 0 while the build is unfinished, count records are valid so far
+  uint32_t count;
+  uint64_t text_size; // identity of the text file the sidecar was built from
+  int64_t text_mtime;
+  uint32_t text_start;
+  uint32_t reserved;
+} sidecar_header_t;
+
+int sidecar_identify(EB_Book* book, const char* magic, sidecar_header_t* header);
+const sidecar_header_t* sidecar_map(EB_Book* book, const char* path, const char* magic, size_t record_size, size_t* map_size);
+
+// every entry start of a subbook's text, mmap'd from a sidecar file built once by a sequential scan
+typedef struct {
+  void* map;
+  size_t map_size;
+  const uint32_t* starts; // (page - 1) * EB_SIZE_PAGE + offset, ascending
+  uint32_t count;
+} entry_index_t;
+
+int entry_index_build(EB_Book* book, EB_Appendix* app, const char* path); // resumes an interrupted build
+entry_index_t* entry_index_open(EB_Book* book, const char* path); // NULL if missing, unfinished or stale
+void entry_index_close(entry_index_t* index);
+uint32_t entry_index_find(const entry_index_t* index, const EB_Position* position); // first entry at or after position
+void entry_index_position(const entry_index_t* index, uint32_t n, EB_Position* position);
+
+typedef struct {
+  uint32_t text; // starts, as entry_index_t
+  uint32_t heading;
+  uint32_t key; // offset in keys
+  uint32_t key_length;
+} heading_record_t;
+
+// (text, heading, key) of every word index entry of a subbook, sorted by text position. keys are
+// as stored in the index (canonicalized, internal encoding)
+typedef struct {
+  void* map;
+  size_t map_size;
+  const heading_record_t* records;
+  uint32_t count;
+  const char* keys;
+  size_t keys_size;
+} heading_index_t;
+
+int heading_index_build(EB_Book* book, const char* path);
+heading_index_t* heading_index_open(EB_Book* book, const char* path); // NULL if missing or stale
+void heading_index_close(heading_index_t* index);
+uint32_t heading_index_find(const heading_index_t* index, const EB_Position* position); // first record at or after position
+int heading_index_match(const heading_index_t* index, uint32_t n, const EB_Position* position);
+void heading_index_heading(const heading_index_t* index, uint32_t n, EB_Position* position);
+
+#endif
@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <linux/limits.h>
+
+#include "entries.h"
+#include "fulltext.h"
+
+#define FULLTEXT_MAGIC "EBGRAM02"
+#define MAX_QUERY_GRAMS 64
+
+typedef struct {
+  uint64_t gram; // 0: empty slot
+  uint32_t last; // last entry added + 1, 0 if none
+  uint32_t count;
+  unsigned char* data;
+  uint32_t size;
+  uint32_t capacity;
+  fulltext_skip_t* skips; // one every FULLTEXT_SKIP_INTERVAL postings
+  uint32_t skip_capacity;
+} gram_postings_t;
+
+struct fulltext_builder {
+  gram_postings_t* slots; // open addressing
+  size_t capacity; // power of 2
+  size_t used;
+};
+
+static size_t gram_slot(uint64_t gram, size_t capacity) {
+  return (size_t)((gram * 0x9e3779b97f4a7c15ull) >> 20) & (capacity - 1);
+}
+
+fulltext_builder_t* fulltext_builder_new() {
+  fulltext_builder_t* builder = (fulltext_builder_t*)malloc(sizeof(fulltext_builder_t));
+  builder->capacity = 1 << 16;
+  builder->used = 0;
+  builder->slots = (gram_postings_t*)calloc(builder->capacity, sizeof(gram_postings_t));
+  return builder;
+}
+
+static void fulltext_builder_grow(fulltext_builder_t* builder) {
+  gram_postings_t* old = builder->slots;
+  size_t old_capacity = builder->capacity;
+  size_t i, j;
+
+  builder->capacity *= 2;
+  builder->slots = (gram_postings_t*)calloc(builder->capacity, sizeof(gram_postings_t));
+  for( i = 0; i < old_capacity; i++ ) {
+    if( old[i].gram == 0 )
+      continue;
+    for( j = gram_slot(old[i].gram, builder->capacity); builder->slots[j].gram != 0; j = (j + 1) & (builder->capacity - 1) )
+      ;
+    builder->slots[j] = old[i];
+  }
+  free(old);
+}
+
+static void fulltext_builder_post(fulltext_builder_t* builder, uint64_t gram, uint32_t entry) {
+  gram_postings_t* postings;
+  uint32_t delta;
+  size_t i;
+
+  if( builder->used * 2 >= builder->capacity )
+    fulltext_builder_grow(builder);
+  for( i = gram_slot(gram, builder->capacity); builder->slots[i].gram != 0 && builder->slots[i].gram != gram;
+    i = (i + 1) & (builder->capacity - 1) )
+    ;
+  postings = &builder->slots[i];
+  if( postings->gram == 0 ) {
+    postings->gram = gram;
+    builder->used++;
+  }
+  if( postings->last == entry + 1 ) // already posted for this entry
+    return;
+  if( postings->size + 5 > postings->capacity ) {
+    postings->capacity = postings->capacity ? postings->capacity * 2 : 8;
+    postings->data = (unsigned char*)realloc(postings->data, postings->capacity);
+  }
+  delta = entry + 1 - postings->last;
+  while( delta >= 0x80 ) {
+    postings->data[postings->size++] = (delta & 0x7f) | 0x80;
+    delta >>= 7;
+  }
+  postings->data[postings->size++] = delta;
+  postings->last = entry + 1;
+  postings->count++;
+  if( postings->count % FULLTEXT_SKIP_INTERVAL == 0 ) {
+    if( postings->count / FULLTEXT_SKIP_INTERVAL > postings->skip_capacity ) {
+      postings->skip_capacity = postings->skip_capacity ? postings->skip_capacity * 2 : 4;
+      postings->skips = (fulltext_skip_t*)realloc(postings->skips, postings->skip_capacity * sizeof(fulltext_skip_t));
+    }
+    postings->skips[postings->count / FULLTEXT_SKIP_INTERVAL - 1].value = postings->last;
+    postings->skips[postings->count / FULLTEXT_SKIP_INTERVAL - 1].offset = postings->size;
+  }
+}
+
+void fulltext_builder_add(fulltext_builder_t* builder, uint32_t entry, const unsigned int* text, size_t length) {
+  size_t i;
+  for( i = 0; i < length; i++ ) {
+    fulltext_builder_post(builder, (uint64_t)text[i] << 32, entry);
+    if( i + 1 < length )
+      fulltext_builder_post(builder, (uint64_t)text[i] << 32 | text[i + 1], entry);
+  }
+}
+
+static int gram_postings_compare(const void* a, const void* b) {
+  uint64_t x = ((const gram_postings_t*)a)->gram;
+  uint64_t y = ((const gram_postings_t*)b)->gram;
+  return x < y ? -1 : x > y;
+}
+
+int fulltext_builder_write(fulltext_builder_t* builder, EB_Book* book, const char* path) {
+  sidecar_header_t header;
+  fulltext_gram_t gram;
+  char tmp_path[PATH_MAX];
+  uint64_t offset = 0;
+  uint32_t skip = 0;
+  size_t i, n = 0;
+  int write_error;
+  FILE* fp;
+
+  if( sidecar_identify(book, FULLTEXT_MAGIC, &header) != 0 )
+    return -1;
+  // pack the used slots at the front, sorted by gram
+  for( i = 0; i < builder->capacity; i++ ) {
+    if( builder->slots[i].gram != 0 )
+      builder->slots[n++] = builder->slots[i];
+  }
+  for( i = n; i < builder->capacity; i++ )
+    memset(&builder->slots[i], 0, sizeof(gram_postings_t));
+  builder->used = n;
+  qsort(builder->slots, n, sizeof(gram_postings_t), gram_postings_compare);
+
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+  fp = fopen(tmp_path, "wb");
+  if( fp == NULL )
+    return -1;
+  header.complete = 1;
+  header.count = n;
+  fwrite(&header, sizeof(header), 1, fp);
+  memset(&gram, 0, sizeof(gram));
+  for( i = 0; i < n; i++ ) {
+    gram.gram = builder->slots[i].gram;
+    gram.offset = offset;
+    gram.count = builder->slots[i].count;
+    gram.skip = skip;
+    offset += builder->slots[i].size;
+    skip += builder->slots[i].count / FULLTEXT_SKIP_INTERVAL;
+    fwrite(&gram, sizeof(gram), 1, fp);
+  }
+  for( i = 0; i < n; i++ )
+    fwrite(builder->slots[i].skips, sizeof(fulltext_skip_t), builder->slots[i].count / FULLTEXT_SKIP_INTERVAL, fp);
+  for( i = 0; i < n; i++ )
+    fwrite(builder->slots[i].data, 1, builder->slots[i].size, fp);
+  write_error = ferror(fp);
+  if( fclose(fp) != 0 || write_error || rename(tmp_path, path) != 0 ) {
+    unlink(tmp_path);
+    return -1;
+  }
+  return 0;
+}
+
+void fulltext_builder_free(fulltext_builder_t* builder) {
+  size_t i;
+  if( builder == NULL )
+    return;
+  for( i = 0; i < builder->capacity; i++ ) {
+    free(builder->slots[i].data);
+    free(builder->slots[i].skips);
+  }
+  free(builder->slots);
+  free(builder);
+}
+
+fulltext_index_t* fulltext_open(EB_Book* book, const char* path) {
+  size_t map_size;
+  const sidecar_header_t* header = sidecar_map(book, path, FULLTEXT_MAGIC, sizeof(fulltext_gram_t), &map_size);
+  if( header == NULL )
+    return NULL;
+
+  const fulltext_gram_t* grams = (const fulltext_gram_t*)(header + 1);
+  uint32_t skip_count = header->count > 0
+    ? grams[header->count - 1].skip + grams[header->count - 1].count / FULLTEXT_SKIP_INTERVAL : 0;
+  size_t head_size = sizeof(sidecar_header_t) + header->count * sizeof(fulltext_gram_t)
+    + (size_t)skip_count * sizeof(fulltext_skip_t);
+  fulltext_index_t* index = head_size <= map_size ? (fulltext_index_t*)malloc(sizeof(fulltext_index_t)) : NULL;
+  if( index == NULL ) {
+    munmap((void*)header, map_size);
+    return NULL;
+  }
+  index->map = (void*)header;
+  index->map_size = map_size;
+  index->grams = grams;
+  index->gram_count = header->count;
+  index->skips = (const fulltext_skip_t*)(index->grams + index->gram_count);
+  index->skip_count = skip_count;
+  index->postings = (const unsigned char*)(index->skips + index->skip_count);
+  index->postings_size = map_size - head_size;
+  return index;
+}
+
+void fulltext_close(fulltext_index_t* index) {
+  if( index == NULL )
+    return;
+  munmap(index->map, index->map_size);
+  free(index);
+}
+
+static const fulltext_gram_t* fulltext_find(const fulltext_index_t* index, uint64_t gram) {
+  uint32_t low = 0;
+  uint32_t high = index->gram_count;
+  while( low < high ) {
+    uint32_t middle = low + (high - low) / 2;
+    if( index->grams[middle].gram < gram )
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  if( low < index->gram_count && index->grams[low].gram == gram )
+    return &index->grams[low];
+  return NULL;
+}
+
+typedef struct {
+  const unsigned char* start;
+  const unsigned char* p;
+  const unsigned char* end;
+  uint32_t value; // current entry + 1, 0 before the first
+  const fulltext_skip_t* skips;
+  uint32_t skip_count;
+} posting_cursor_t;
+
+static int posting_cursor_next(posting_cursor_t* cursor) {
+  uint32_t delta = 0;
+  int shift = 0;
+  while( cursor->p < cursor->end ) {
+    unsigned char c = *cursor->p++;
+    delta |= (uint32_t)(c & 0x7f) << shift;
+    if( !(c & 0x80) ) {
+      cursor->value += delta;
+      return 1;
+    }
+    shift += 7;
+  }
+  return 0;
+}
+
+// move cursor, if it is before, to the last skip before the posting of value target
+static void posting_cursor_seek(posting_cursor_t* cursor, uint32_t target) {
+  uint32_t low = 0;
+  uint32_t high = cursor->skip_count;
+  while( low < high ) {
+    uint32_t middle = low + (high - low) / 2;
+    if( cursor->skips[middle].value < target )
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  if( low > 0 && cursor->skips[low - 1].value > cursor->value ) {
+    cursor->value = cursor->skips[low - 1].value;
+    cursor->p = cursor->start + cursor->skips[low - 1].offset;
+  }
+}
+
+static int fulltext_gram_compare(const void* a, const void* b) {
+  uint32_t x = (*(const fulltext_gram_t* const*)a)->count;
+  uint32_t y = (*(const fulltext_gram_t* const*)b)->count;
+  return x < y ? -1 : x > y;
+}
+
+// entries from entry number from on having every gram of query, ascending, at most max. the query text
+// itself still has to be checked in them
+size_t fulltext_candidates(const fulltext_index_t* index, const unsigned int* query, size_t length, uint32_t from,
+  uint32_t* entries, size_t max) {
+  const fulltext_gram_t* grams[MAX_QUERY_GRAMS];
+  posting_cursor_t cursors[MAX_QUERY_GRAMS];
+  size_t gram_count = 0;
+  size_t found = 0;
+  size_t i;
+  uint32_t target;
+
+  if( length == 0 )
+    return 0;
+  for( i = 0; (length == 1 ? i < 1 : i + 1 < length) && gram_count < MAX_QUERY_GRAMS; i++ ) {
+    uint64_t gram = length == 1 ? (uint64_t)query[0] << 32 : (uint64_t)query[i] << 32 | query[i + 1];
+    const fulltext_gram_t* g = fulltext_find(index, gram);
+    if( g == NULL )
+      return 0;
+    grams[gram_count++] = g;
+  }
+  // rarest first, it drives the intersection
+  qsort(grams, gram_count, sizeof(grams[0]), fulltext_gram_compare);
+  for( i = 0; i < gram_count; i++ ) {
+    cursors[i].start = cursors[i].p = index->postings + grams[i]->offset;
+    // postings are laid out in gram order, they end where the next gram's start
+    cursors[i].end = grams[i] + 1 < index->grams + index->gram_count
+      ? index->postings + grams[i][1].offset : index->postings + index->postings_size;
+    cursors[i].value = 0;
+    cursors[i].skips = index->skips + grams[i]->skip;
+    cursors[i].skip_count = grams[i]->count / FULLTEXT_SKIP_INTERVAL;
+  }
+
+  target = from + 1;
+  while( found < max ) {
+    // leapfrog: move every cursor to target or past it, restarting when one overshoots. skips make
+    // a page starting deep in the postings as cheap as the first one
+    for( i = 0; i < gram_count; i++ ) {
+      if( cursors[i].value < target )
+        posting_cursor_seek(&cursors[i], target);
+      while( cursors[i].value < target ) {
+        if( !posting_cursor_next(&cursors[i]) )
+          return found;
+      }
+      if( cursors[i].value > target ) {
+        target = cursors[i].value;
+        i = (size_t)-1;
+      }
+    }
+    entries[found++] = target - 1;
+    target++;
+  }
+  return found;
+}
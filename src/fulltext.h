@@ -0,0 +1,49 @@
+#ifndef _FULLTEXT_H
+#define _FULLTEXT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ebu/eb.h>
+
+#define FULLTEXT_SKIP_INTERVAL 128 // postings of a gram between skips
+
+// unigrams and bigrams of the normalized text of every entry, posting entry numbers of the entry index
+typedef struct {
+  uint64_t gram; // first code point << 32 | second code point (0 for a unigram)
+  uint64_t offset; // of the postings, delta + varint coded
+  uint32_t count; // entries containing the gram
+  uint32_t skip; // its first skip, it has count / FULLTEXT_SKIP_INTERVAL
+} fulltext_gram_t;
+
+// where the postings of a gram stand after every FULLTEXT_SKIP_INTERVAL of them, to seek an entry without
+// decoding them all from the start
+typedef struct {
+  uint32_t value; // entry + 1 of the last posting passed
+  uint32_t offset; // from the start of the gram's postings
+} fulltext_skip_t;
+
+// file: sidecar header, grams, skips, postings
+typedef struct {
+  void* map;
+  size_t map_size;
+  const fulltext_gram_t* grams; // ascending
+  uint32_t gram_count;
+  const fulltext_skip_t* skips;
+  uint32_t skip_count;
+  const unsigned char* postings;
+  size_t postings_size;
+} fulltext_index_t;
+
+typedef struct fulltext_builder fulltext_builder_t;
+
+fulltext_builder_t* fulltext_builder_new();
+void fulltext_builder_add(fulltext_builder_t* builder, uint32_t entry, const unsigned int* text, size_t length); // entries in ascending order
+int fulltext_builder_write(fulltext_builder_t* builder, EB_Book* book, const char* path);
+void fulltext_builder_free(fulltext_builder_t* builder);
+
+fulltext_index_t* fulltext_open(EB_Book* book, const char* path); // NULL if missing or stale
+void fulltext_close(fulltext_index_t* index);
+size_t fulltext_candidates(const fulltext_index_t* index, const unsigned int* query, size_t length, uint32_t from,
+  uint32_t* entries, size_t max);
+
+#endif
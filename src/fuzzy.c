@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <linux/limits.h>
+
+#include "entries.h"
+#include "fuzzy.h"
+
+#define FUZZY_MAGIC "EBFUZZ01"
+
+typedef struct {
+  unsigned int c;
+  uint32_t child; // first child, 0 if none (node 0 is the root)
+  uint32_t sibling; // next child of the parent, in code point order
+  int64_t value; // -1 if no word ends here
+} fuzzy_node_t;
+
+typedef struct {
+  size_t offset; // in chars
+  uint32_t length;
+  uint32_t value;
+} fuzzy_word_t;
+
+struct fuzzy_trie {
+  void* map; // of the sidecar the nodes are in, NULL if built here
+  size_t map_size;
+  fuzzy_node_t* nodes;
+  size_t node_count;
+  size_t node_capacity;
+  // words added so far, the trie is built from them sorted by fuzzy_trie_finish
+  unsigned int* chars;
+  size_t chars_size;
+  size_t chars_capacity;
+  fuzzy_word_t* words;
+  size_t word_count;
+  size_t word_capacity;
+};
+
+fuzzy_trie_t* fuzzy_trie_new() {
+  fuzzy_trie_t* trie = (fuzzy_trie_t*)calloc(1, sizeof(fuzzy_trie_t));
+  return trie;
+}
+
+void fuzzy_trie_add(fuzzy_trie_t* trie, const unsigned int* word, size_t length, uint32_t value) {
+  if( length == 0 )
+    return;
+  if( length > FUZZY_MAX_WORD )
+    length = FUZZY_MAX_WORD;
+  if( trie->word_count == trie->word_capacity ) {
+    trie->word_capacity = trie->word_capacity ? trie->word_capacity * 2 : 4096;
+    trie->words = (fuzzy_word_t*)realloc(trie->words, trie->word_capacity * sizeof(fuzzy_word_t));
+  }
+  while( trie->chars_size + length > trie->chars_capacity ) {
+    trie->chars_capacity = trie->chars_capacity ? trie->chars_capacity * 2 : 65536;
+    trie->chars = (unsigned int*)realloc(trie->chars, trie->chars_capacity * sizeof(unsigned int));
+  }
+  trie->words[trie->word_count].offset = trie->chars_size;
+  trie->words[trie->word_count].length = length;
+  trie->words[trie->word_count].value = value;
+  trie->word_count++;
+  memcpy(trie->chars + trie->chars_size, word, length * sizeof(unsigned int));
+  trie->chars_size += length;
+}
+
+static const unsigned int* sorting_chars; // qsort has no context argument
+
+static int fuzzy_word_compare(const void* a, const void* b) {
+  const fuzzy_word_t* x = (const fuzzy_word_t*)a;
+  const fuzzy_word_t* y = (const fuzzy_word_t*)b;
+  uint32_t i;
+  for( i = 0; i < x->length && i < y->length; i++ ) {
+    unsigned int cx = sorting_chars[x->offset + i];
+    unsigned int cy = sorting_chars[y->offset + i];
+    if( cx != cy )
+      return cx < cy ? -1 : 1;
+  }
+  if( x->length != y->length )
+    return x->length < y->length ? -1 : 1;
+  return x->value < y->value ? -1 : x->value > y->value; // keeps the first value of a word first
+}
+
+static uint32_t fuzzy_trie_node(fuzzy_trie_t* trie, unsigned int c) {
+  if( trie->node_count == trie->node_capacity ) {
+    trie->node_capacity = trie->node_capacity ? trie->node_capacity * 2 : 65536;
+    trie->nodes = (fuzzy_node_t*)realloc(trie->nodes, trie->node_capacity * sizeof(fuzzy_node_t));
+  }
+  trie->nodes[trie->node_count].c = c;
+  trie->nodes[trie->node_count].child = 0;
+  trie->nodes[trie->node_count].sibling = 0;
+  trie->nodes[trie->node_count].value = -1;
+  return trie->node_count++;
+}
+
+// build the trie from the words added. in sorted order, a word shares its prefix with the previous
+// one, and its first new node is the last child of where they part
+void fuzzy_trie_finish(fuzzy_trie_t* trie) {
+  uint32_t path[FUZZY_MAX_WORD + 1];
+  const unsigned int* previous = NULL;
+  uint32_t previous_length = 0;
+  size_t i;
+  uint32_t common, depth, node;
+
+  sorting_chars = trie->chars;
+  qsort(trie->words, trie->word_count, sizeof(fuzzy_word_t), fuzzy_word_compare);
+  path[0] = fuzzy_trie_node(trie, 0);
+
+  for( i = 0; i < trie->word_count; i++ ) {
+    const unsigned int* word = trie->chars + trie->words[i].offset;
+    uint32_t length = trie->words[i].length;
+    for( common = 0; common < previous_length && common < length && previous[common] == word[common]; common++ )
+      ;
+    if( common == length && common == previous_length ) // same word again
+      continue;
+    for( depth = common; depth < length; depth++ ) {
+      node = fuzzy_trie_node(trie, word[depth]);
+      if( depth == common && previous_length > common )
+        trie->nodes[path[depth + 1]].sibling = node;
+      else
+        trie->nodes[path[depth]].child = node;
+      path[depth + 1] = node;
+    }
+    trie->nodes[path[length]].value = trie->words[i].value;
+    previous = word;
+    previous_length = length;
+  }
+
+  free(trie->words);
+  trie->words = NULL;
+  trie->word_count = trie->word_capacity = 0;
+  free(trie->chars);
+  trie->chars = NULL;
+  trie->chars_size = trie->chars_capacity = 0;
+}
+
+typedef struct {
+  const fuzzy_trie_t* trie;
+  const unsigned int* query;
+  size_t length;
+  int distance; // exact distance collected in this walk
+  fuzzy_match_t* matches;
+  size_t max;
+  size_t found;
+} fuzzy_walk_t;
+
+// one row of the edit distance table per trie level. a subtree is skipped once every cell of the
+// row is over the distance
+static void fuzzy_walk(fuzzy_walk_t* walk, uint32_t node, const int* previous_row, int depth) {
+  int row[FUZZY_MAX_WORD + 1];
+  uint32_t child;
+  size_t j;
+
+  for( child = walk->trie->nodes[node].child; child != 0 && walk->found < walk->max; child = walk->trie->nodes[child].sibling ) {
+    unsigned int c = walk->trie->nodes[child].c;
+    int minimum = row[0] = previous_row[0] + 1;
+    for( j = 1; j <= walk->length; j++ ) {
+      int cost = previous_row[j - 1] + (walk->query[j - 1] == c ? 0 : 1);
+      if( row[j - 1] + 1 < cost )
+        cost = row[j - 1] + 1;
+      if( previous_row[j] + 1 < cost )
+        cost = previous_row[j] + 1;
+      row[j] = cost;
+      if( cost < minimum )
+        minimum = cost;
+    }
+    if( walk->trie->nodes[child].value >= 0 && row[walk->length] == walk->distance ) {
+      walk->matches[walk->found].value = walk->trie->nodes[child].value;
+      walk->matches[walk->found].distance = walk->distance;
+      walk->found++;
+    }
+    if( minimum <= walk->distance && depth < FUZZY_MAX_WORD )
+      fuzzy_walk(walk, child, row, depth + 1);
+  }
+}
+
+// words within max_distance edits of query, nearest first (then in code point order), at most max
+size_t fuzzy_trie_search(const fuzzy_trie_t* trie, const unsigned int* query, size_t length, int max_distance,
+  fuzzy_match_t* matches, size_t max) {
+  int row[FUZZY_MAX_WORD + 1];
+  fuzzy_walk_t walk;
+  size_t j;
+
+  if( trie->node_count == 0 )
+    return 0;
+  if( length > FUZZY_MAX_WORD )
+    length = FUZZY_MAX_WORD;
+  if( max_distance > FUZZY_MAX_DISTANCE )
+    max_distance = FUZZY_MAX_DISTANCE;
+  for( j = 0; j <= length; j++ )
+    row[j] = j;
+  walk.trie = trie;
+  walk.query = query;
+  walk.length = length;
+  walk.matches = matches;
+  walk.max = max;
+  walk.found = 0;
+  // a walk per distance ranks the matches without sorting, and the near walks prune more
+  for( walk.distance = 0; walk.distance <= max_distance && walk.found < max; walk.distance++ )
+    fuzzy_walk(&walk, 0, row, 0);
+  return walk.found;
+}
+
+// write the nodes of a finished trie to a sidecar of the current subbook
+int fuzzy_trie_save(EB_Book* book, const fuzzy_trie_t* trie, const char* path) {
+  sidecar_header_t header;
+  char tmp_path[PATH_MAX];
+  int write_error;
+  FILE* fp;
+
+  if( sidecar_identify(book, FUZZY_MAGIC, &header) != 0 )
+    return -1;
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+  fp = fopen(tmp_path, "wb");
+  if( fp == NULL )
+    return -1;
+  header.complete = 1;
+  header.count = trie->node_count;
+  fwrite(&header, sizeof(header), 1, fp);
+  fwrite(trie->nodes, sizeof(fuzzy_node_t), trie->node_count, fp);
+  write_error = ferror(fp);
+  if( fclose(fp) != 0 || write_error || rename(tmp_path, path) != 0 ) {
+    unlink(tmp_path);
+    return -1;
+  }
+  return 0;
+}
+
+fuzzy_trie_t* fuzzy_trie_open(EB_Book* book, const char* path) {
+  size_t map_size;
+  const sidecar_header_t* header = sidecar_map(book, path, FUZZY_MAGIC, sizeof(fuzzy_node_t), &map_size);
+  if( header == NULL )
+    return NULL;
+
+  fuzzy_trie_t* trie = fuzzy_trie_new();
+  trie->map = (void*)header;
+  trie->map_size = map_size;
+  trie->nodes = (fuzzy_node_t*)(header + 1);
+  trie->node_count = header->count;
+  return trie;
+}
+
+void fuzzy_trie_free(fuzzy_trie_t* trie) {
+  if( trie == NULL )
+    return;
+  if( trie->map != NULL )
+    munmap(trie->map, trie->map_size);
+  else
+    free(trie->nodes);
+  free(trie->words);
+  free(trie->chars);
+  free(trie);
+}
@@ -0,0 +1,28 @@
+#ifndef _FUZZY_H
+#define _FUZZY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ebu/eb.h>
+
+#define FUZZY_MAX_WORD 64 // code points of a word / query
+#define FUZZY_MAX_DISTANCE 3
+
+// trie of headwords (normalized code points), searched within an edit distance
+typedef struct fuzzy_trie fuzzy_trie_t;
+
+typedef struct {
+  uint32_t value; // given with the word to fuzzy_trie_add
+  int distance;
+} fuzzy_match_t;
+
+fuzzy_trie_t* fuzzy_trie_new();
+void fuzzy_trie_add(fuzzy_trie_t* trie, const unsigned int* word, size_t length, uint32_t value);
+void fuzzy_trie_finish(fuzzy_trie_t* trie);
+size_t fuzzy_trie_search(const fuzzy_trie_t* trie, const unsigned int* query, size_t length, int max_distance,
+  fuzzy_match_t* matches, size_t max);
+int fuzzy_trie_save(EB_Book* book, const fuzzy_trie_t* trie, const char* path); // a finished trie
+fuzzy_trie_t* fuzzy_trie_open(EB_Book* book, const char* path); // NULL if missing or stale
+void fuzzy_trie_free(fuzzy_trie_t* trie);
+
+#endif
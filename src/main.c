@@ -1,11 +1,19 @@
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
 
 #include "book.h"
 #include "conv.h"
 #include "functions.h"
 #include "parson.h"
+#include "trace.h"
+
+#define SHARED_CACHE_SIZE (64 * 1024 * 1024) // when creating the shared cache file
+#define WARM_BUDGET 64 // MiB read by warmup at startup, unless -W is given
 
 void dumpHex(const void* data, size_t size) {
   char ascii[17];
@@ -48,20 +56,117 @@ int output_and_free_json(JSON_Value* value) {
   return 0;
 }
 
+// write the payload of a frame from region: the head bytes, then the file bytes, moved by the kernel from
+// the file to stdout without being copied through ebclient. read and written if stdout can't take them so
+// (sendfile to a tty or a file on old kernels). a frame has promised its size already, so bytes that can't
+// be read are sent as 0s
+void output_binary_region(const binary_region_t* region) {
+  char buf[65536];
+  off_t offset = region->offset;
+  size_t left = region->length;
+  ssize_t done;
+
+  fwrite(region->head, 1, region->head_length, stdout);
+  fflush(stdout);
+  while( left > 0 ) {
+    done = sendfile(STDOUT_FILENO, region->fd, &offset, left);
+    if( done <= 0 )
+      break;
+    left -= done;
+  }
+  while( left > 0 ) {
+    done = pread(region->fd, buf, left < sizeof(buf) ? left : sizeof(buf), offset);
+    if( done < 0 && errno == EINTR )
+      continue;
+    if( done <= 0 ) {
+      memset(buf, 0, sizeof(buf));
+      done = left < sizeof(buf) ? left : sizeof(buf);
+    }
+    fwrite(buf, 1, done, stdout);
+    offset += done;
+    left -= done;
+  }
+}
+
 int main(int argc, char *argv[]) {
-  if (argc < 2) {
-    fprintf(stderr, "Usage: %s books-path\n", argv[0]);
+  int opt;
+  int watch = 0;
+  int build_entries = 0;
+  const char* shared_cache = NULL;
+  int shared_cache_open = 0; // warmup needs it: what a child uncompresses is kept there only
+  const char* trace = NULL;
+  const char* profile = NULL;
+  int warm_budget = WARM_BUDGET;
+
+  while( (opt = getopt(argc, argv, "wbx:c:u:t:W:p:")) != -1 ) {
+    switch( opt ) {
+      case 'w': // reload books when dirs are added to / removed from books-path
+        watch = 1;
+        break;
+      case 'x': // dir of entry index sidecars
+        books_entries_dir(optarg);
+        break;
+      case 'b': // build the entry indexes of every subbook, then exit
+        build_entries = 1;
+        break;
+      case 'c': // file of the slice cache shared with other ebclient processes
+        shared_cache = optarg;
+        break;
+      case 'u': // dir of uncompressed mirrors of compressed files, written by the 'u' command
+        zio_set_mirror_directory(optarg);
+        break;
+      case 't': // file of the profile of the slices read, kept across restarts
+        trace = optarg;
+        break;
+      case 'W': // MiB of the hottest slices read at startup, 0 for none
+        warm_budget = atoi(optarg);
+        break;
+      case 'p': // write the hottest pages of the trace (-t), -W MiB of them, for ebzip --profile, then exit
+        profile = optarg;
+        break;
+      default:
+        optind = argc;
+        break;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "Usage: %s [-w] [-c shared-cache] [-u mirror-dir] [-t trace-file [-W warm-MiB] [-p ebzip-profile]] [-x entries-dir [-b]] books-path\n", argv[0]);
     exit(1);
   }
 
   init_conv();
-  books_init(argv[1]);
+  books_init(argv[optind]);
+  if( shared_cache != NULL && zio_open_shared_cache(shared_cache, SHARED_CACHE_SIZE) != 0 ) {
+    fprintf(stderr, "failed to open the shared cache %s, slices are cached per process\n", shared_cache);
+  } else if( shared_cache != NULL ) {
+    shared_cache_open = 1;
+  }
+  if( trace != NULL && !build_entries ) {
+    if( trace_open(trace) != 0 )
+      fprintf(stderr, "failed to open the trace %s, reads are not recorded\n", trace);
+    else if( profile != NULL )
+      exit(trace_export(profile, (size_t)warm_budget * 1024 * 1024) >= 0 ? 0 : 1);
+    else if( warm_budget > 0 && shared_cache_open )
+      trace_warm((size_t)warm_budget * 1024 * 1024);
+  }
+  if( profile != NULL ) {
+    fprintf(stderr, "-p needs the trace of -t\n");
+    exit(1);
+  }
+  if( build_entries ) {
+    int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    exit(books_build_entries(jobs > 0 ? jobs : 1) == 0 ? 0 : 1);
+  }
+  if( watch && books_watch() != 0 ) {
+    fprintf(stderr, "failed to watch the books dir, only the 'r' command reloads it\n");
+  }
   output_and_free_json(book_list());
 
   char* line = NULL;
   size_t n = 0;
   char word[513] = {0};
   char marker[1024] = {0};
+  char subbooks[1024] = {0}; // comma separated subbook indexes
   int index;
   int code; // gaiji code
   int type = 0;
@@ -70,25 +175,40 @@ int main(int argc, char *argv[]) {
   int offset = 0;
   int endpage = 0;
   int endoffset = 0;
+  int before; // entries before / after a position
+  int after;
+  int first; // entry number
+  int count;
   char* binary_buf;
   size_t binary_size;
+  binary_region_t region; // where 'c' / 'd' bytes stored plain are
   int mono_width;
   int mono_height;
+  int consumed;
+  JSON_Value* table; // gaiji atlas coordinates
+  long long range_start; // byte range of 'c' / 'd'
+  size_t range_length;
+  char probe_kind; // command letter of the binary object to probe
+  int probe_args[5];
 
   while( 1 ) {
     getline(&line, &n, stdin);
+    books_poll_watch();
+    trace_poll();
     if( *line == 'a' ) {
-      if( sscanf(line, "a %d %d %d", &index, &page, &offset) != 3 || !output_and_free_json(book_get(index, page, offset)) ) {
+      type = 0; // optional: resolve references
+      if( sscanf(line, "a %d %d %d %d", &index, &page, &offset, &type) < 3 || !output_and_free_json(book_get(index, page, offset, type)) ) {
         printf("[]\n");
         fflush(stdout);
       }
     } else if( *line == 'b' ) { // read binary mono graph bmp
-      if( sscanf(line, "b %d %d %d %d %d", &index, &page, &offset, &mono_width, &mono_height) != 5 ) {
+      type = 0; // optional: 1 for png
+      if( sscanf(line, "b %d %d %d %d %d %d", &index, &page, &offset, &mono_width, &mono_height, &type) < 5 ) {
         fwrite("\x00\x01\x00\x00\x00\x00", 1, 6, stdout);
         fflush(stdout);
         continue;
       }
-      binary_buf = book_binary_mono(index, page, offset, mono_width, mono_height, &binary_size);
+      binary_buf = book_binary_mono(index, page, offset, mono_width, mono_height, type, &binary_size);
       if( binary_buf == NULL ) {
         fwrite("\x00\x02\x00\x00\x00\x00", 1, 6, stdout);
       } else {
@@ -99,35 +219,43 @@ int main(int argc, char *argv[]) {
       }
       fflush(stdout);
     } else if( *line == 'c' ) { // read binary color graph
-      if( sscanf(line, "c %d %d %d", &index, &page, &offset) != 3 ) {
+      range_start = range_length = 0; // optional: a byte range
+      if( sscanf(line, "c %d %d %d %lld %zu", &index, &page, &offset, &range_start, &range_length) < 3 ) {
         fwrite("\x00\x01\x00\x00\x00\x00", 1, 6, stdout);
         fflush(stdout);
         continue;
       }
-      binary_buf = book_binary_color(index, page, offset, &binary_size);
+      binary_buf = book_binary_color(index, page, offset, range_start, range_length, &region, &binary_size);
       if( binary_buf == NULL ) {
         fwrite("\x00\x02\x00\x00\x00\x00", 1, 6, stdout);
       } else {
         // dumpHex(binary_buf,256);
         fwrite("\x00\x00", 1, 2, stdout);
         fwrite(&binary_size, 4, 1, stdout);
-        fwrite(binary_buf, 1, binary_size, stdout);
+        if( region.fd >= 0 )
+          output_binary_region(&region);
+        else
+          fwrite(binary_buf, 1, binary_size, stdout);
       }
       fflush(stdout);
     } else if( *line == 'd' ) { // read binary wav
-      if( sscanf(line, "d %d %d %d %d %d", &index, &page, &offset, &endpage, &endoffset) != 5 ) {
+      range_start = range_length = 0; // optional: a byte range
+      if( sscanf(line, "d %d %d %d %d %d %lld %zu", &index, &page, &offset, &endpage, &endoffset, &range_start, &range_length) < 5 ) {
         fwrite("\x00\x01\x00\x00\x00\x00", 1, 6, stdout);
         fflush(stdout);
         continue;
       }
-      binary_buf = book_binary_wav(index, page, offset, endpage, endoffset, &binary_size);
+      binary_buf = book_binary_wav(index, page, offset, endpage, endoffset, range_start, range_length, &region, &binary_size);
       if( binary_buf == NULL ) {
         fwrite("\x00\x02\x00\x00\x00\x00", 1, 6, stdout);
       } else {
         // dumpHex(binary_buf,256);
         fwrite("\x00\x00", 1, 2, stdout);
         fwrite(&binary_size, 4, 1, stdout);
-        fwrite(binary_buf, 1, binary_size, stdout);
+        if( region.fd >= 0 )
+          output_binary_region(&region);
+        else
+          fwrite(binary_buf, 1, binary_size, stdout);
       }
       fflush(stdout);
     } else if( *line == 'e' ) { // copyright
@@ -169,8 +297,94 @@ int main(int argc, char *argv[]) {
         printf("[]\n");
         fflush(stdout);
       }
+    } else if( *line == 'j' ) { // batch lookup, words separated by \t
+      if( sscanf(line, "j %d %d %d%n", &index, &type, &max_hit, &consumed) != 3 || !output_and_free_json(book_query_batch(index, type, max_hit, line + consumed)) ) {
+        printf("[]\n");
+        fflush(stdout);
+      }
+    } else if( *line == 'k' ) { // longest headword matches at each char of a text
+      if( sscanf(line, "k %1023s %n", subbooks, &consumed) != 1 || !output_and_free_json(book_segment(subbooks, line + consumed)) ) {
+        printf("[]\n");
+        fflush(stdout);
+      }
+    } else if( *line == 'l' ) { // read many positions, "page,offset" separated by spaces. type: flags
+      if( sscanf(line, "l %d %d%n", &index, &type, &consumed) != 2 || !output_and_free_json(book_get_batch(index, type, line + consumed)) ) {
+        printf("[]\n");
+        fflush(stdout);
+      }
+    } else if( *line == 'm' ) { // multi search titles and entry labels
+      if( sscanf(line, "m %d", &index) != 1 || !output_and_free_json(book_multi(index)) ) {
+        printf("[]\n");
+        fflush(stdout);
+      }
+    } else if( *line == 'n' ) { // entries before and after a position
+      type = 0; // optional: flags
+      if( sscanf(line, "n %d %d %d %d %d %d", &index, &page, &offset, &before, &after, &type) < 5 || !output_and_free_json(book_neighbors(index, page, offset, before, after, type)) ) {
+        printf("[]\n");
+        fflush(stdout);
+      }
+    } else if( *line == 'p' ) { // size, type, dimensions and etag of what 'b', 'c' or 'd' would read
+      probe_args[2] = probe_args[3] = probe_args[4] = 0;
+      if( sscanf(line, "p %d %c %d %d %d %d %d", &index, &probe_kind, &probe_args[0], &probe_args[1], &probe_args[2],
+        &probe_args[3], &probe_args[4]) < 4
+        || !output_and_free_json(book_binary_probe(index, probe_kind, probe_args)) ) {
+        printf("[]\n");
+        fflush(stdout);
+      }
+    } else if( *line == 'r' ) { // rescan books-path, output the updated subbook list
+      output_and_free_json(books_reload());
+    } else if( *line == 's' ) { // gaiji atlas: a json line of glyph positions, then the png
+      if( sscanf(line, "s %d %d%n", &index, &type, &consumed) != 2
+        || (binary_buf = book_gaiji_atlas(index, type, line + consumed, &table, &binary_size)) == NULL ) {
+        printf("[]\n");
+        fflush(stdout);
+        continue;
+      }
+      output_and_free_json(table);
+      fwrite("\x00\x00", 1, 2, stdout);
+      fwrite(&binary_size, 4, 1, stdout);
+      fwrite(binary_buf, 1, binary_size, stdout);
+      fflush(stdout);
+    } else if( *line == 't' ) { // full text search. needs -x
+      if( sscanf(line, "t %d %d %1023s %n", &index, &max_hit, marker, &consumed) != 3 || !output_and_free_json(book_fulltext(index, max_hit, marker, line + consumed)) ) {
+        printf("[]\n");
+        fflush(stdout);
+      }
+    } else if( *line == 'u' ) { // write uncompressed mirrors of the subbook's files. needs -u
+      if( sscanf(line, "u %d", &index) != 1 || !output_and_free_json(book_mirror(index)) ) {
+        printf("[]\n");
+        fflush(stdout);
+      }
+    } else if( *line == 'w' ) { // read the hottest slices of the trace, in the background. needs -t and -c
+      max_hit = WARM_BUDGET; // optional: MiB
+      sscanf(line, "w %d", &max_hit);
+      count = max_hit > 0 && shared_cache_open ? trace_warm((size_t)max_hit * 1024 * 1024) : -1;
+      if( count < 0 ) {
+        printf("[]\n");
+      } else {
+        printf("[%d]\n", count);
+      }
+      fflush(stdout);
+    } else if( *line == 'x' ) { // entry count, or entries by number. needs -x
+      first = 0; // -1: a random entry
+      count = 0; // 0: output [entry_count]
+      type = 0; // flags
+      if( sscanf(line, "x %d %d %d %d", &index, &first, &count, &type) < 1 || !output_and_free_json(book_entries(index, first, count, type)) ) {
+        printf("[]\n");
+        fflush(stdout);
+      }
+    } else if( *line == 'y' ) { // headwords of a text position. needs -x
+      if( sscanf(line, "y %d %d %d", &index, &page, &offset) != 3 || !output_and_free_json(book_headings(index, page, offset)) ) {
+        printf("[]\n");
+        fflush(stdout);
+      }
+    } else if( *line == 'z' ) { // fuzzy headword search, type: max edit distance. needs -x
+      if( sscanf(line, "z %d %d %d %n", &index, &type, &max_hit, &consumed) != 3 || !output_and_free_json(book_fuzzy(index, type, max_hit, line + consumed)) ) {
+        printf("[]\n");
+        fflush(stdout);
+      }
     } else {
-      if( sscanf(line, "%d %d %d %[^\t\r\n,],%[^\t\r\n]", &index, &type, &max_hit, &marker, word) != 5 || !output_and_free_json(book_query(index, type, max_hit, word, marker)) ) {
+      if( sscanf(line, "%d %d %d %[^\t\r\n,],%512[^\r\n]", &index, &type, &max_hit, &marker, word) != 5 || !output_and_free_json(book_query(index, type, max_hit, word, marker)) ) {
         printf("[]\n");
         fflush(stdout);
       }
@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <linux/limits.h>
+
+#include "entries.h"
+#include "suffix.h"
+
+#define SUFFIX_MAGIC "EBSUFX01"
+
+typedef struct {
+  uint32_t text_length;
+  uint32_t suffix_count;
+  uint32_t value_count;
+  uint32_t reserved;
+} suffix_header_t; // after the sidecar header, whose count is the word count
+
+static const uint32_t* sorting_text; // qsort has no context argument
+
+// compare the 0 terminated code point strings at a and b
+static int suffix_compare_at(uint32_t a, uint32_t b) {
+  const uint32_t* x = sorting_text + a;
+  const uint32_t* y = sorting_text + b;
+  while( *x != 0 && *x == *y ) {
+    x++;
+    y++;
+  }
+  if( *x != *y )
+    return *x < *y ? -1 : 1;
+  return 0;
+}
+
+static int suffix_word_compare(const void* a, const void* b) {
+  const suffix_word_t* x = (const suffix_word_t*)a;
+  const suffix_word_t* y = (const suffix_word_t*)b;
+  int result = suffix_compare_at(x->start, y->start);
+  if( result != 0 )
+    return result;
+  return x->value < y->value ? -1 : x->value > y->value;
+}
+
+static int suffix_compare(const void* a, const void* b) {
+  uint32_t x = *(const uint32_t*)a;
+  uint32_t y = *(const uint32_t*)b;
+  int result = suffix_compare_at(x, y);
+  if( result != 0 )
+    return result;
+  return x < y ? -1 : x > y;
+}
+
+int suffix_index_build(EB_Book* book, const char* path, const uint32_t* text, size_t text_length,
+  const uint32_t* values, size_t count) {
+  sidecar_header_t header;
+  suffix_header_t suffix_header;
+  suffix_word_t* words = (suffix_word_t*)malloc((count + 1) * sizeof(suffix_word_t));
+  uint32_t* sorted_values = (uint32_t*)malloc((count + 1) * sizeof(uint32_t));
+  uint32_t* sorted_text = (uint32_t*)malloc((text_length + 1) * sizeof(uint32_t));
+  uint32_t* suffixes = NULL;
+  char tmp_path[PATH_MAX];
+  size_t i, n = 0, length = 0, suffix_count = 0, value_count = 0;
+  uint32_t previous = 0; // start in text of the last word kept
+  const uint32_t* p;
+  int write_error;
+  FILE* fp;
+  int result = -1;
+
+  if( sidecar_identify(book, SUFFIX_MAGIC, &header) != 0 )
+    goto finished;
+
+  // distinct words in order, laid out again in that order. the values of a word are
+  // sorted_values[words[i].value .. words[i + 1].value)
+  for( i = 0, p = text; i < count; i++ ) {
+    words[i].start = p - text;
+    words[i].value = values[i];
+    while( *p++ != 0 )
+      ;
+  }
+  sorting_text = text;
+  qsort(words, count, sizeof(suffix_word_t), suffix_word_compare);
+  for( i = 0; i < count; i++ ) {
+    uint32_t start = words[i].start;
+    if( text[start] == 0 )
+      continue;
+    sorted_values[value_count++] = words[i].value;
+    if( n > 0 && suffix_compare_at(start, previous) == 0 )
+      continue;
+    previous = start;
+    words[n].start = length;
+    words[n++].value = value_count - 1;
+    for( p = text + start; *p != 0; p++ )
+      sorted_text[length++] = *p;
+    sorted_text[length++] = 0;
+  }
+  words[n].start = length;
+  words[n].value = value_count; // end of the values of the last word
+
+  suffixes = (uint32_t*)malloc((length + 1) * sizeof(uint32_t));
+  for( i = 0; i < length; i++ ) {
+    if( sorted_text[i] != 0 )
+      suffixes[suffix_count++] = i;
+  }
+  sorting_text = sorted_text;
+  qsort(suffixes, suffix_count, sizeof(uint32_t), suffix_compare);
+
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+  fp = fopen(tmp_path, "wb");
+  if( fp == NULL )
+    goto finished;
+  header.complete = 1;
+  header.count = n;
+  suffix_header.text_length = length;
+  suffix_header.suffix_count = suffix_count;
+  suffix_header.value_count = value_count;
+  suffix_header.reserved = 0;
+  fwrite(&header, sizeof(header), 1, fp);
+  fwrite(&suffix_header, sizeof(suffix_header), 1, fp);
+  fwrite(words, sizeof(suffix_word_t), n + 1, fp);
+  fwrite(sorted_values, sizeof(uint32_t), value_count, fp);
+  fwrite(sorted_text, sizeof(uint32_t), length, fp);
+  fwrite(suffixes, sizeof(uint32_t), suffix_count, fp);
+  write_error = ferror(fp);
+  if( fclose(fp) != 0 || write_error || rename(tmp_path, path) != 0 ) {
+    unlink(tmp_path);
+    goto finished;
+  }
+  result = 0;
+
+finished:
+  free(words);
+  free(sorted_values);
+  free(sorted_text);
+  free(suffixes);
+  return result;
+}
+
+suffix_index_t* suffix_index_open(EB_Book* book, const char* path) {
+  size_t map_size;
+  const sidecar_header_t* header = sidecar_map(book, path, SUFFIX_MAGIC, sizeof(suffix_word_t), &map_size);
+  const suffix_header_t* suffix_header;
+  if( header == NULL )
+    return NULL;
+
+  suffix_header = (const suffix_header_t*)(header + 1);
+  if( map_size < sizeof(sidecar_header_t) + sizeof(suffix_header_t) + (header->count + 1) * sizeof(suffix_word_t)
+    + ((size_t)suffix_header->value_count + suffix_header->text_length + suffix_header->suffix_count) * sizeof(uint32_t) ) {
+    munmap((void*)header, map_size);
+    return NULL;
+  }
+  suffix_index_t* index = (suffix_index_t*)malloc(sizeof(suffix_index_t));
+  index->map = (void*)header;
+  index->map_size = map_size;
+  index->words = (const suffix_word_t*)(suffix_header + 1);
+  index->word_count = header->count;
+  index->values = (const uint32_t*)(index->words + index->word_count + 1);
+  index->text = index->values + suffix_header->value_count;
+  index->text_length = suffix_header->text_length;
+  index->suffixes = index->text + index->text_length;
+  index->suffix_count = suffix_header->suffix_count;
+  return index;
+}
+
+void suffix_index_close(suffix_index_t* index) {
+  if( index == NULL )
+    return;
+  munmap(index->map, index->map_size);
+  free(index);
+}
+
+// compare the suffix at start with fragment, as a prefix: 0 if the suffix starts with fragment
+static int suffix_prefix_compare(const suffix_index_t* index, uint32_t start, const unsigned int* fragment, size_t length) {
+  size_t i;
+  for( i = 0; i < length; i++ ) {
+    uint32_t c = index->text[start + i]; // 0 at the end of the word, before any fragment char
+    if( c != fragment[i] )
+      return c < fragment[i] ? -1 : 1;
+  }
+  return 0;
+}
+
+static uint32_t suffix_word_of(const suffix_index_t* index, uint32_t start) {
+  uint32_t low = 0;
+  uint32_t high = index->word_count;
+  while( high - low > 1 ) {
+    uint32_t middle = low + (high - low) / 2;
+    if( index->words[middle].start <= start )
+      low = middle;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+static int uint32_compare(const void* a, const void* b) {
+  uint32_t x = *(const uint32_t*)a;
+  uint32_t y = *(const uint32_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+// the words containing fragment, ascending, into *words (malloc'ed, to be freed). an empty fragment
+// gives every word
+size_t suffix_index_containing(const suffix_index_t* index, const unsigned int* fragment, size_t length, uint32_t** words) {
+  uint32_t low = 0, high = index->suffix_count, first, i;
+  size_t n = 0;
+
+  if( length == 0 ) {
+    *words = (uint32_t*)malloc((index->word_count + 1) * sizeof(uint32_t));
+    for( i = 0; i < index->word_count; i++ )
+      (*words)[i] = i;
+    return index->word_count;
+  }
+  // the suffixes starting with fragment are a range of the array
+  while( low < high ) {
+    uint32_t middle = low + (high - low) / 2;
+    if( suffix_prefix_compare(index, index->suffixes[middle], fragment, length) < 0 )
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  first = low;
+  high = index->suffix_count;
+  while( low < high ) {
+    uint32_t middle = low + (high - low) / 2;
+    if( suffix_prefix_compare(index, index->suffixes[middle], fragment, length) <= 0 )
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  *words = (uint32_t*)malloc((low - first + 1) * sizeof(uint32_t));
+  for( i = first; i < low; i++ )
+    (*words)[n++] = suffix_word_of(index, index->suffixes[i]);
+  qsort(*words, n, sizeof(uint32_t), uint32_compare);
+  for( i = 0, low = 0; i < n; i++ ) { // a word may contain fragment more than once
+    if( low == 0 || (*words)[low - 1] != (*words)[i] )
+      (*words)[low++] = (*words)[i];
+  }
+  return low;
+}
+
+static int glob_match(const unsigned int* pattern, size_t length, const uint32_t* word) {
+  const unsigned int* end = pattern + length;
+  const unsigned int* star = NULL; // last '*' seen, and where the word was then
+  const uint32_t* star_word = NULL;
+
+  while( *word != 0 ) {
+    if( pattern < end && (*pattern == '?' || *pattern == *word) ) {
+      pattern++;
+      word++;
+    } else if( pattern < end && *pattern == '*' ) {
+      star = pattern++;
+      star_word = word;
+    } else if( star != NULL ) {
+      pattern = star + 1;
+      word = ++star_word;
+    } else {
+      return 0;
+    }
+  }
+  while( pattern < end && *pattern == '*' )
+    pattern++;
+  return pattern == end;
+}
+
+// whether the whole word matches pattern, '*' for any chars and '?' for one
+int suffix_index_glob(const suffix_index_t* index, uint32_t word, const unsigned int* pattern, size_t length) {
+  return glob_match(pattern, length, index->text + index->words[word].start);
+}
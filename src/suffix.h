@@ -0,0 +1,33 @@
+#ifndef _SUFFIX_H
+#define _SUFFIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ebu/eb.h>
+
+// suffix array over the distinct headwords (normalized code points) of a subbook
+typedef struct {
+  uint32_t start; // in text
+  uint32_t value; // first of the word's values, up to the next word's
+} suffix_word_t;
+
+typedef struct {
+  void* map;
+  size_t map_size;
+  const suffix_word_t* words; // in code point order, plus one marking the end
+  uint32_t word_count;
+  const uint32_t* values; // given with the words to suffix_index_build
+  const uint32_t* text; // the words, each followed by a 0
+  uint32_t text_length;
+  const uint32_t* suffixes; // starts of the suffixes of every word, in suffix order
+  uint32_t suffix_count;
+} suffix_index_t;
+
+int suffix_index_build(EB_Book* book, const char* path, const uint32_t* text, size_t text_length,
+  const uint32_t* values, size_t count); // count words in text, each followed by a 0
+suffix_index_t* suffix_index_open(EB_Book* book, const char* path); // NULL if missing or stale
+void suffix_index_close(suffix_index_t* index);
+size_t suffix_index_containing(const suffix_index_t* index, const unsigned int* fragment, size_t length, uint32_t** words);
+int suffix_index_glob(const suffix_index_t* index, uint32_t word, const unsigned int* pattern, size_t length);
+
+#endif
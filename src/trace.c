@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <linux/limits.h>
+
+#include "book.h"
+#include "trace.h"
+
+#define TRACE_MAGIC "EBTRACE1"
+#define TRACE_MAX_RECORDS 65536 // slots of the profile, a power of 2. 3/4 of them are used at most
+#define TRACE_SAVE_READS 4096 // slices read between saves of the profile
+#define TRACE_WARM_READ 65536 // the largest slice read by warmup (ebzip level 5)
+
+enum { TRACE_TEXT, TRACE_GRAPHIC, TRACE_SOUND };
+
+// how many times a slice of a subbook file has been read, in this run and (halved at each restart)
+// the earlier ones
+typedef struct {
+  uint64_t subbook; // book_current_key, 0 for a free slot
+  uint64_t location; // start of the slice
+  uint32_t kind; // file of the subbook, TRACE_TEXT...
+  uint32_t count;
+} trace_record_t;
+
+typedef struct {
+  char magic[8];
+  uint32_t count;
+  uint32_t reserved;
+} trace_header_t; // followed by count records
+
+static trace_record_t* records = NULL;
+static size_t record_count = 0;
+static size_t unsaved_reads = 0;
+static char trace_path[PATH_MAX];
+static const Zio* last_zio = NULL; // slice of the last read, not counted again while it is read on
+static off_t last_location = -1;
+static pid_t warm_pid = -1;
+
+static trace_record_t* trace_find(uint64_t subbook, uint32_t kind, uint64_t location, int insert) {
+  uint64_t hash = (subbook ^ (location * 4 + kind)) * 0x9e3779b97f4a7c15ull;
+  size_t i = (hash >> 32) & (TRACE_MAX_RECORDS - 1);
+  trace_record_t* record;
+
+  for( ;; i = (i + 1) & (TRACE_MAX_RECORDS - 1) ) {
+    record = records + i;
+    if( record->subbook == subbook && record->kind == kind && record->location == location )
+      return record;
+    if( record->subbook == 0 )
+      break;
+  }
+  if( !insert || record_count >= TRACE_MAX_RECORDS / 4 * 3 )
+    return NULL;
+  record->subbook = subbook;
+  record->kind = kind;
+  record->location = location;
+  record->count = 0;
+  record_count++;
+  return record;
+}
+
+// zio trace function: count the slices read from the text, graphic and sound files of the current subbook
+static void trace_read(Zio* zio, off_t location, size_t length) {
+  EB_Subbook* subbook;
+  trace_record_t* record;
+  uint64_t key = 0;
+  uint32_t kind;
+  off_t slice;
+
+  if( current_bookw == NULL || (subbook = current_bookw->book.subbook_current) == NULL )
+    return;
+  if( zio == &subbook->text_zio )
+    kind = TRACE_TEXT;
+  else if( zio == &subbook->graphic_zio )
+    kind = TRACE_GRAPHIC;
+  else if( zio == &subbook->sound_zio )
+    kind = TRACE_SOUND;
+  else
+    return;
+
+  for( slice = location / zio->slice_size * zio->slice_size; slice < location + (off_t)length; slice += zio->slice_size ) {
+    if( zio == last_zio && slice == last_location )
+      continue;
+    last_zio = zio;
+    last_location = slice;
+    if( key == 0 && (key = book_current_key()) == 0 )
+      return;
+    record = trace_find(key, kind, slice, 1);
+    if( record != NULL && record->count < UINT32_MAX )
+      record->count++;
+    unsaved_reads++; // saved by trace_poll, between commands
+  }
+}
+
+int trace_open(const char* path) {
+  trace_header_t header;
+  trace_record_t record;
+  trace_record_t* found;
+  uint32_t i;
+  FILE* fp;
+
+  if( strlen(path) + 5 > sizeof(trace_path) )
+    return -1;
+  records = (trace_record_t*)calloc(TRACE_MAX_RECORDS, sizeof(trace_record_t));
+  if( records == NULL )
+    return -1;
+  strcpy(trace_path, path);
+
+  // older reads count for less: halved at every restart
+  fp = fopen(path, "rb");
+  if( fp != NULL ) {
+    if( fread(&header, sizeof(header), 1, fp) == 1 && memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) == 0 ) {
+      for( i = 0; i < header.count && fread(&record, sizeof(record), 1, fp) == 1; i++ ) {
+        if( record.subbook == 0 || record.count / 2 == 0 )
+          continue;
+        found = trace_find(record.subbook, record.kind, record.location, 1);
+        if( found != NULL )
+          found->count = record.count / 2;
+      }
+    }
+    fclose(fp);
+  }
+  zio_set_trace_function(trace_read);
+  atexit(trace_save);
+  return 0;
+}
+
+void trace_save() {
+  trace_header_t header;
+  char tmp_path[sizeof(trace_path) + 4]; // with ".tmp"
+  size_t i;
+  int write_error;
+  FILE* fp;
+
+  if( records == NULL )
+    return;
+  unsaved_reads = 0;
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", trace_path);
+  fp = fopen(tmp_path, "wb");
+  if( fp == NULL )
+    return;
+  memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+  header.count = record_count;
+  header.reserved = 0;
+  fwrite(&header, sizeof(header), 1, fp);
+  for( i = 0; i < TRACE_MAX_RECORDS; i++ ) {
+    if( records[i].subbook != 0 )
+      fwrite(records + i, sizeof(trace_record_t), 1, fp);
+  }
+  write_error = ferror(fp);
+  if( fclose(fp) != 0 || write_error || rename(tmp_path, trace_path) != 0 )
+    unlink(tmp_path);
+}
+
+// hottest first, then in file order
+static int trace_record_compare(const void* a, const void* b) {
+  const trace_record_t* x = (const trace_record_t*)a;
+  const trace_record_t* y = (const trace_record_t*)b;
+  if( x->count != y->count )
+    return x->count > y->count ? -1 : 1;
+  if( x->subbook != y->subbook )
+    return x->subbook < y->subbook ? -1 : 1;
+  if( x->kind != y->kind )
+    return x->kind < y->kind ? -1 : 1;
+  return x->location < y->location ? -1 : x->location > y->location;
+}
+
+// read the slices of hot in turn until budget bytes are read. what is read stays in the page cache, and
+// in the shared slice cache (-c) uncompressed, for the parent and any other ebclient process
+static void warm_child(const trace_record_t* hot, size_t count, size_t budget) {
+  static char buffer[TRACE_WARM_READ];
+  EB_Book* book = NULL;
+  EB_Subbook* subbook;
+  Zio* zio;
+  uint64_t key = 0;
+  size_t total = 0;
+  size_t i;
+  ssize_t done;
+  int index;
+
+  zio_set_trace_function(NULL);
+  nice(10); // behind the processes serving queries
+  for( i = 0; i < count && total < budget; i++ ) {
+    if( hot[i].subbook != key ) {
+      key = hot[i].subbook;
+      index = book_index_of_key(key);
+      book = index >= 0 ? select_book(index) : NULL;
+    }
+    if( book == NULL || (subbook = book->subbook_current) == NULL )
+      continue;
+    zio = hot[i].kind == TRACE_TEXT ? &subbook->text_zio
+      : hot[i].kind == TRACE_GRAPHIC ? &subbook->graphic_zio : &subbook->sound_zio;
+    if( zio_file(zio) < 0 )
+      continue;
+    done = zio_pread(zio, buffer, zio->slice_size < sizeof(buffer) ? zio->slice_size : sizeof(buffer), hot[i].location);
+    if( done > 0 )
+      total += done;
+  }
+  _exit(0);
+}
+
+// pages of a subbook text file, 2048 bytes each and numbered from 1 as in ebzip speedup regions
+typedef struct {
+  uint64_t subbook;
+  uint32_t start_page;
+  uint32_t end_page;
+} trace_pages_t;
+
+// by subbook, then in file order
+static int trace_pages_compare(const void* a, const void* b) {
+  const trace_pages_t* x = (const trace_pages_t*)a;
+  const trace_pages_t* y = (const trace_pages_t*)b;
+  if( x->subbook != y->subbook )
+    return x->subbook < y->subbook ? -1 : 1;
+  return x->start_page < y->start_page ? -1 : x->start_page > y->start_page;
+}
+
+// write the page ranges of the hottest text slices, up to budget bytes of them, one line
+// "<dict dir name> <subbook dir name> <start page> <end page>" per range. ebzip --profile keeps these
+// pages uncompressed, so that the reads that matter most skip inflate.
+// returns the number of ranges written, or -1
+int trace_export(const char* path, size_t budget) {
+  char book_name[PATH_MAX];
+  char subbook_name[EB_MAX_DIRECTORY_NAME_LENGTH + 1];
+  trace_record_t* hot;
+  trace_pages_t* pages;
+  EB_Book* book = NULL;
+  uint64_t key = 0;
+  size_t total = 0;
+  size_t i, j, n = 0, m = 0;
+  int index, lines = 0;
+  int write_error;
+  FILE* fp;
+
+  if( records == NULL )
+    return -1;
+  hot = (trace_record_t*)malloc((record_count + 1) * sizeof(trace_record_t));
+  pages = (trace_pages_t*)malloc((record_count + 1) * sizeof(trace_pages_t));
+  if( hot == NULL || pages == NULL ) {
+    free(hot);
+    free(pages);
+    return -1;
+  }
+  for( i = 0; i < TRACE_MAX_RECORDS; i++ ) {
+    if( records[i].subbook != 0 && records[i].kind == TRACE_TEXT )
+      hot[n++] = records[i];
+  }
+  qsort(hot, n, sizeof(trace_record_t), trace_record_compare);
+
+  // pages of the slices in the budget. a slice is 2048 << ebzip level bytes of the file as it is now,
+  // pages stay the same whatever level it is compressed at next
+  for( i = 0; i < n && total < budget; i++ ) {
+    if( hot[i].subbook != key ) {
+      key = hot[i].subbook;
+      index = book_index_of_key(key);
+      book = index >= 0 ? select_book(index) : NULL;
+    }
+    if( book == NULL || book->subbook_current == NULL || zio_file(&book->subbook_current->text_zio) < 0 )
+      continue;
+    pages[m].subbook = key;
+    pages[m].start_page = hot[i].location / EB_SIZE_PAGE + 1;
+    pages[m].end_page = (hot[i].location + book->subbook_current->text_zio.slice_size) / EB_SIZE_PAGE;
+    total += book->subbook_current->text_zio.slice_size;
+    m++;
+  }
+  free(hot);
+  qsort(pages, m, sizeof(trace_pages_t), trace_pages_compare);
+
+  fp = fopen(path, "w");
+  if( fp == NULL ) {
+    free(pages);
+    return -1;
+  }
+  fprintf(fp, "# hot pages of the text files, for ebzip --profile\n");
+  for( i = 0; i < m; i = j ) {
+    // neighbouring slices make one range
+    for( j = i + 1; j < m && pages[j].subbook == pages[i].subbook && pages[j].start_page <= pages[j-1].end_page + 1; j++ )
+      ;
+    index = book_index_of_key(pages[i].subbook);
+    if( index < 0 || select_book(index) == NULL || book_current_names(book_name, subbook_name) != 0 )
+      continue;
+    fprintf(fp, "%s %s %u %u\n", book_name, subbook_name, pages[i].start_page, pages[j-1].end_page);
+    lines++;
+  }
+  free(pages);
+  write_error = ferror(fp);
+  if( fclose(fp) != 0 || write_error )
+    return -1;
+  return lines;
+}
+
+// between commands: save the profile every TRACE_SAVE_READS reads, and reap the warmup child once it has
+// ended. returns 1 while it is running, else 0
+int trace_poll() {
+  if( unsaved_reads >= TRACE_SAVE_READS )
+    trace_save();
+  if( warm_pid > 0 && waitpid(warm_pid, NULL, WNOHANG) == 0 )
+    return 1;
+  warm_pid = -1;
+  return 0;
+}
+
+// returns the number of slices in the profile, or -1 if there is none or a warmup is still running
+int trace_warm(size_t budget) {
+  trace_record_t* hot;
+  size_t i, n = 0;
+  pid_t pid;
+
+  if( records == NULL || trace_poll() )
+    return -1;
+  trace_save();
+
+  hot = (trace_record_t*)malloc((record_count + 1) * sizeof(trace_record_t));
+  if( hot == NULL )
+    return -1;
+  for( i = 0; i < TRACE_MAX_RECORDS; i++ ) {
+    if( records[i].subbook != 0 )
+      hot[n++] = records[i];
+  }
+  qsort(hot, n, sizeof(trace_record_t), trace_record_compare);
+  fflush(stdout);
+  fflush(stderr);
+  pid = fork();
+  if( pid == 0 )
+    warm_child(hot, n, budget);
+  free(hot);
+  if( pid < 0 )
+    return -1;
+  warm_pid = pid;
+  return n;
+}
@@ -0,0 +1,12 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stddef.h>
+
+int trace_open(const char* path); // load the profile recorded at path, and record the reads from now on
+void trace_save(); // write the profile to its file
+int trace_warm(size_t budget); // read the hottest slices, up to budget bytes, in a child process
+int trace_poll(); // save the profile now and then, reap the warmup child if it has ended
+int trace_export(const char* path, size_t budget); // write the pages of the hottest text slices for ebzip --profile
+
+#endif